@@ -3,6 +3,10 @@
 #define LIGHT_AREA_DOUBLE_SIDED 2
 #define LIGHT_SKY 3
 
+#define LIGHT_SAMPLING_UNIFORM 0
+#define LIGHT_SAMPLING_BVH 1
+#define LIGHT_SAMPLING_POWER 2
+
 struct light_t {
     vec3 intensity;
     int emission_tex;
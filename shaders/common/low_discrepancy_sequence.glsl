@@ -1,18 +1,64 @@
-float binary_decimal_inverse(in uint bits) 
-{
-    bits = (bits << 16u) | (bits >> 16u);
-    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
-    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
-    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
-    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
-    return float(bits) * 2.3283064365386963e-10; // / 0x100000000
+// Owen scrambled Sobol points after Burley, Practical Hash-based Owen
+// Scrambling. Dimensions are padded with the first two Sobol dimensions, every
+// pair shuffles the sample index with its own seed so that pairs don't
+// correlate, and the seed of the pixel decorrelates neighbouring pixels.
+
+uint sobol_pixel_seed = 0;
+uint sobol_dimension = 0;
+
+uint hash_uint(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint hash_combine(const in uint seed, const in uint v) {
+    return hash_uint(seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+// Owen scrambling of the bits of x from the lowest one up.
+uint laine_karras_permutation(uint x, const in uint seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint nested_uniform_scramble(const in uint x, const in uint seed) {
+    return bitfieldReverse(laine_karras_permutation(bitfieldReverse(x), seed));
+}
+
+// First two dimensions of the Sobol sequence, the second one is generated by
+// the Pascal matrix.
+uvec2 sobol_2d(const in uint index) {
+    uint y = 0u;
+    uint v = 1u << 31;
+    for (uint i = index; i != 0u; i >>= 1, v ^= v >> 1) {
+        if ((i & 1u) != 0u) {
+            y ^= v;
+        }
+    }
+    return uvec2(bitfieldReverse(index), y);
+}
+
+void start_sobol_sample(const in uint seed, const in uint pixel) {
+    sobol_pixel_seed = hash_combine(seed, pixel);
+    sobol_dimension = 0;
 }
 
-// Hammersley low discrepancy sequence, see
-// http://holger.dammertz.org/stuff/notes_HammersleyOnHemisphere.html
-vec2 hammersley(const in uint i, 
-                const in uint N)
-{
-    // i should not be greater than N
-    return vec2(float(i)/float(N), binary_decimal_inverse(i));
+// Next dimension of the point of the sample, in [0, 1).
+float sobol_01(const in uint sample_index) {
+    const uint dimension = sobol_dimension++;
+    const uint pair_seed = hash_combine(sobol_pixel_seed, dimension / 2);
+    const uvec2 point =
+        sobol_2d(nested_uniform_scramble(sample_index, pair_seed));
+    const uint value =
+        nested_uniform_scramble((dimension & 1u) == 0u ? point.x : point.y,
+            hash_combine(pair_seed, dimension));
+    return float(value >> 8) * (1.0 / 16777216.0);
 }
@@ -1,6 +1,11 @@
 
 // Random generator stolen from https://github.com/grigoryoskin/vulkan-compute-ray-tracing/blob/master/resources/shaders/source/include/random.glsl
 
+// The including shader declares the sampler, random_seed and sample_index
+// push constants and includes low_discrepancy_sequence.glsl first.
+#define SAMPLER_RANDOM 0
+#define SAMPLER_SOBOL 1
+
 uint random_seed_step(const in uint r) {
     return r * 747796405 + 1;
 }
@@ -9,14 +14,44 @@ void random_seed_hash_combine(const in uint v) {
     seed = v + 0x9e3779b9 + (seed<<6) + (seed>>2);
 }
 
-uint rand_uint(const in uint min,
-               const in uint max) {
+// Restarts the random numbers of the current sample for the pixel.
+void start_pixel_sample(const in uint pixel) {
+    seed = random_seed;
+    random_seed_hash_combine(pixel);
+    start_sobol_sample(random_seed, pixel);
+}
+
+// What a path carries between kernels to continue its random numbers, the
+// seed or the next Sobol dimension.
+uint get_sampler_state() {
+    return sampler == SAMPLER_SOBOL ? sobol_dimension : seed;
+}
+
+void set_sampler_state(const in uint pixel, const in uint state) {
+    if (sampler == SAMPLER_SOBOL) {
+        start_sobol_sample(random_seed, pixel);
+        sobol_dimension = state;
+    } else {
+        seed = state;
+    }
+}
+
+float rand_01();
+
+uint rand_uint(const in uint low,
+               const in uint high) {
+    const uint range = high - low + 1;
+    if (sampler == SAMPLER_SOBOL) {
+        return low + min(uint(rand_01() * range), range - 1);
+    }
     seed = random_seed_step(seed);
-    const uint range = max - min + 1;
-    return min + seed % range;
+    return low + seed % range;
 }
 
 float rand_01() {
+    if (sampler == SAMPLER_SOBOL) {
+        return sobol_01(sample_index);
+    }
     seed = random_seed_step(seed);
     uint word = ((seed >> ((seed >> 28) + 4)) ^ seed) * 277803737;
     word = (word >> 22) ^ word;
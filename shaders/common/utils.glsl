@@ -16,40 +16,6 @@ float luminance(const in vec3 c) {
     return 0.212671 * c.x + 0.715160 * c.y + 0.072169 * c.z;
 }
 
-struct stack_t {
-    uint top;
-    uint data[63];
-};
-
-void push_stack(inout stack_t stk, const in uint d) {
-    stk.data[stk.top] = d;
-    ++stk.top;
-}
-
-bool pop_stack(inout stack_t stk, inout uint d) {
-    if (stk.top > 0) {
-        d = stk.data[stk.top - 1];
-        --stk.top;
-        return true;
-    } else {
-        return false;
-    }
-}
-
-void clear_stack(inout stack_t stk) {
-    stk.top = 0;
-}
-
-struct vector_t {
-    uint size;
-    uint data[15];
-};
-
-void push_vector(inout vector_t vec, const in uint d) {
-    vec.data[vec.size] = d;
-    ++vec.size;
-}
-
 float square(const in float val) {
     return val * val;
 }
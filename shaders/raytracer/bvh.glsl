@@ -30,3 +30,20 @@ struct bvh_node_t {
     uint obj_count;
     int split_axis;
 };
+
+#define LIGHT_BVH_LEAF 1
+#define LIGHT_BVH_TWO_SIDED 2
+#define LIGHT_BVH_NO_LEAF 0xffffffffu
+
+struct light_bvh_node_t {
+    vec3 bounds_min;
+    float phi;
+    vec3 bounds_max;
+    float cos_theta_o;
+    vec3 axis;
+    float cos_theta_e;
+    uint right;
+    uint light;
+    uint triangle;
+    uint flags;
+};
@@ -12,12 +12,14 @@ layout(set = 0, binding = 0) uniform sampler2D frame[2];
 
 layout(std430, push_constant) uniform push_constant {
     float frame_scalar;
-    uint preview;
+    uint image;  // of the two frames the raytracer binds
 };
 
+// alpha counts the samples summed into a texel, 1 for frames holding a mean
 void main() {
+    const vec4 texel = texture(frame[image], texcoord.xy);
     const vec3 color = 
         gamma_correct(
-            tone_mapping(frame_scalar * texture(frame[preview], texcoord.xy).rgb));
+            tone_mapping(frame_scalar * texel.rgb / max(texel.a, 1.0)));
     out_frag = vec4(color, 1.0);
 }
@@ -8,7 +8,7 @@ vec3 uniform_sample_sphere() {
     const float r1 = rand_01();
     const float cos_theta = 1 - 2.0 * r0;
     const float sin_theta = sqrt(max(0.0, 1 - cos_theta * cos_theta));
-    const float phi = 2.0 * r1;
+    const float phi = TWO_PI * r1;
     return vec3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
 }
 
@@ -0,0 +1,755 @@
+// Scene data and queries shared by the raytracers. The including shader
+// declares the light_count, sky_light and light_sampling push constants, the
+// seed of the random generator and a traced_rays counter before including
+// this file.
+
+layout(std430, set = 0, binding = 0) readonly buffer TLAS {
+    bvh_node_t tlas[];
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer BLAS {
+    bvh_node_t blas[];
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer MESH {
+    mesh_t meshes[];
+};
+
+layout(std430, set = 1, binding = 1) readonly buffer TRANSFORM {
+    mat4 transforms[];
+};
+
+layout(std430, set = 1, binding = 2) readonly buffer INVERSE_TRANSFORM {
+    mat4 inverse_transforms[];
+};
+
+layout(std430, set = 1, binding = 3) readonly buffer INSTANCE {
+    instance_t instances[];
+};
+
+layout(std430, set = 1, binding = 4) readonly buffer TRIANGLES {
+    vec4 packed_triangles[];
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer MATERIAL {
+    material_t materials[];
+};
+
+layout(std430, set = 2, binding = 1) readonly buffer MEDIUM {
+    medium_t mediums[];
+};
+
+layout(std430, set = 2, binding = 2) readonly buffer LIGHT {
+    light_t lights[];
+};
+
+// emitting triangles of the area lights, the root has zero power without any
+layout(std430, set = 2, binding = 3) readonly buffer LIGHT_BVH {
+    light_bvh_node_t light_bvh[];
+};
+
+// marginal CDF over the rows of the environment map followed by the CDF over
+// the columns of every row
+layout(std430, set = 2, binding = 4) readonly buffer SKY_DISTRIBUTION {
+    float sky_distribution[];
+};
+
+struct alias_entry_t {
+    float threshold;
+    uint alias;
+    float pmf;
+    uint link;
+};
+
+// alias table over the lights by power, then over the triangles of every area
+// light by area, link is the start of the triangle table of a light and the
+// light BVH leaf of a triangle
+layout(std430, set = 2, binding = 5) readonly buffer LIGHT_ALIAS {
+    alias_entry_t light_alias[];
+};
+
+layout(set = 3, binding = 1) uniform sampler2D textures[50];
+
+// 64 bit total of every closest hit and any hit query
+layout(std430, set = 3, binding = 2) buffer RAY_COUNTER {
+    uint traced_rays_low;
+    uint traced_rays_high;
+};
+
+// Entries of the traversal stack, the depth of the TLAS plus the depth of the
+// deepest BLAS of the scene, so a stack shared by both levels never overflows.
+layout(constant_id = 3) const uint TRAVERSAL_STACK_SIZE = 63;
+
+// The top entries of every traversal stack live in workgroup shared memory,
+// interleaved by invocation, and the private array is a small overflow for the
+// deepest entries. Keeping the stack out of private memory lowers register
+// pressure and scratch traffic, 0 keeps the whole stack private.
+layout(constant_id = 2) const uint SHARED_STACK_SIZE = 0;
+const uint PRIVATE_STACK_SIZE = TRAVERSAL_STACK_SIZE > SHARED_STACK_SIZE ?
+                                    TRAVERSAL_STACK_SIZE - SHARED_STACK_SIZE :
+                                    1;
+const uint WORKGROUP_INVOCATIONS = gl_WorkGroupSize.x * gl_WorkGroupSize.y;
+
+shared uint shared_stack[SHARED_STACK_SIZE * WORKGROUP_INVOCATIONS + 1];
+
+triangle_t unpack_triangle(const in uint idx) {
+    const vertex_t a = unpack_vertex(
+        packed_triangles[idx * 6 + 0], packed_triangles[idx * 6 + 1]);
+    const vertex_t b = unpack_vertex(
+        packed_triangles[idx * 6 + 2], packed_triangles[idx * 6 + 3]);
+    const vertex_t c = unpack_vertex(
+        packed_triangles[idx * 6 + 4], packed_triangles[idx * 6 + 5]);
+    return triangle_t(a, b, c);
+}
+
+void get_surface_info(inout state_t state, out surface_info_t surface_info) {
+    surface_info = empty_surface_info();
+    if (state.inst_light >= 0) {
+        const light_t light = lights[state.inst_light];
+        if (state.front_face || light.type == LIGHT_AREA_DOUBLE_SIDED) {
+            surface_info.emission = light.intensity;
+            if (light.emission_tex >= 0) {
+                surface_info.emission *=
+                    texture(textures[light.emission_tex], state.hit_uv).rgb;
+            }
+        } else {
+            surface_info.emission = vec3(0.0);
+        }
+    } else if (state.inst_material >= 0) {
+        const material_t material = materials[state.inst_material];
+        surface_info.albedo = material.albedo;
+        surface_info.emission = material.emission;
+        surface_info.metallic = material.metallic;
+        surface_info.spec_trans = material.spec_trans;
+        surface_info.eta = state.front_face ? 1.0 / material.ior : material.ior;
+        surface_info.ior = material.ior;
+        surface_info.subsurface = material.subsurface;
+        surface_info.roughness = material.roughness;
+        surface_info.specular_tint = material.specular_tint;
+        surface_info.anisotropic = material.anisotropic;
+        surface_info.sheen = material.sheen;
+        surface_info.sheen_tint = material.sheen_tint;
+        surface_info.clearcoat = material.clearcoat;
+        surface_info.clearcoat_gloss = material.clearcoat_gloss;
+        if (material.albedo_tex >= 0) {
+            surface_info.albedo *=
+                texture(textures[material.albedo_tex], state.hit_uv).rgb;
+        }
+        if (material.emission_tex >= 0) {
+            surface_info.emission *=
+                texture(textures[material.emission_tex], state.hit_uv).rgb;
+        }
+        if (material.normal_tex >= 0) {
+            const vec3 normal_texel = normalize(
+                texture(textures[material.normal_tex], state.hit_uv).rgb * 2.0 -
+                vec3(1.0));
+            state.hit_normal = normalize(normal_texel.x * state.hit_tangent +
+                                         normal_texel.y * state.hit_bitangent +
+                                         normal_texel.z * state.hit_normal);
+        }
+        if (material.metallic_roughness_tex >= 0) {
+            const vec2 mr_texel =
+                texture(textures[material.metallic_roughness_tex], state.hit_uv)
+                    .bg;
+            surface_info.metallic = mr_texel.x;
+            surface_info.roughness = max(mr_texel.y * mr_texel.y, 0.001);
+        }
+        const float aspect = sqrt(1.0 - material.anisotropic * 0.9);
+        surface_info.ax = max(0.001, material.roughness / aspect);
+        surface_info.ay = max(0.001, material.roughness * aspect);
+    }
+}
+
+// Ray of the instance space, the parameter t is the same as in world space
+// since the direction is transformed without normalizing it.
+uint enter_instance(const in ray_t ray, const in uint instance_idx,
+    out ray_t instance_ray, out vec3 inv_dir, out ivec3 neg_dir) {
+    const instance_t instance = instances[instance_idx];
+    const mat4 inverse_transform =
+        instance.transform >= 0 ? inverse_transforms[instance.transform] :
+                                  mat4(1.0);
+    instance_ray = ray_t(vec3(inverse_transform * vec4(ray.origin, 1.0)),
+        vec3(inverse_transform * vec4(ray.direction, 0.0)));
+    inv_dir = vec3(1.0) / instance_ray.direction;
+    neg_dir = ivec3(instance_ray.direction.x < 0.0,
+        instance_ray.direction.y < 0.0, instance_ray.direction.z < 0.0);
+    return meshes[instance.mesh].bvh_start;
+}
+
+// Walks the TLAS and the BLAS of every reached instance with one stack. The
+// BLAS of an instance is entered as soon as its TLAS leaf is reached, nearer
+// children are visited first, so a hit culls the farther TLAS nodes as well.
+// The BLAS nodes sit above blas_base on the stack, below it are the TLAS
+// nodes still to visit. With any set it stops at the first hit.
+bool traverse_scene(const in ray_t ray, const in bool any, inout float t_max,
+    out uint closest_instance, out uint closest_triangle,
+    out hit_record_t closest_hit_record) {
+    const float t_min = 0.0;
+    closest_instance = 0;
+    closest_triangle = 0;
+    closest_hit_record = empty_hit_record();
+    bool hit = false;
+    uint private_stack[PRIVATE_STACK_SIZE];
+    uint stack_top = 0;
+    const vec3 world_inv_dir = vec3(1.0) / ray.direction;
+    const ivec3 world_neg_dir = ivec3(ray.direction.x < 0.0,
+        ray.direction.y < 0.0, ray.direction.z < 0.0);
+    ray_t current_ray = ray;
+    vec3 inv_dir = world_inv_dir;
+    ivec3 neg_dir = world_neg_dir;
+    bool in_blas = false;
+    uint blas_base = 0;
+    // instances of the last reached TLAS leaf
+    uint instance = 0;
+    uint next_instance = 0;
+    uint instance_end = 0;
+    uint current_node = 0;
+    while (true) {
+        const bvh_node_t node =
+            in_blas ? blas[current_node] : tlas[current_node];
+        if (hit_aabb(
+                node.aabb, current_ray, inv_dir, neg_dir, t_min, t_max)) {
+            if (node.obj_count == 0) {
+                const bool neg = neg_dir[node.split_axis] != 0;
+                const uint near_node = neg ? node.right : current_node + 1;
+                const uint far_node = neg ? current_node + 1 : node.right;
+                current_node = near_node;
+                if (stack_top < SHARED_STACK_SIZE) {
+                    shared_stack[stack_top * WORKGROUP_INVOCATIONS +
+                                 gl_LocalInvocationIndex] = far_node;
+                } else {
+                    private_stack[stack_top - SHARED_STACK_SIZE] = far_node;
+                }
+                ++stack_top;
+                continue;
+            }
+            if (in_blas) {
+                for (uint t = node.first_obj;
+                     t < node.first_obj + node.obj_count; ++t) {
+                    const triangle_t triangle = unpack_triangle(t);
+                    if (any) {
+                        if (hit_triangle_quick(
+                                triangle, current_ray, t_min, t_max)) {
+                            return true;
+                        }
+                        continue;
+                    }
+                    const hit_record_t hit_rec =
+                        hit_triangle(triangle, current_ray, t_min, t_max);
+                    if (hit_rec.hit) {
+                        t_max = hit_rec.t;
+                        closest_instance = instance;
+                        closest_triangle = t;
+                        closest_hit_record = hit_rec;
+                        hit = true;
+                    }
+                }
+            } else {
+                next_instance = node.first_obj;
+                instance_end = node.first_obj + node.obj_count;
+                blas_base = stack_top;
+            }
+        }
+        // the node is done, continue in the BLAS, with the next instance of
+        // the leaf or back in the TLAS
+        if (!in_blas || stack_top == blas_base) {
+            if (next_instance < instance_end) {
+                instance = next_instance++;
+                current_node = enter_instance(
+                    ray, instance, current_ray, inv_dir, neg_dir);
+                in_blas = true;
+                continue;
+            }
+            if (in_blas) {
+                in_blas = false;
+                current_ray = ray;
+                inv_dir = world_inv_dir;
+                neg_dir = world_neg_dir;
+            }
+        }
+        if (stack_top == 0) {
+            break;
+        }
+        --stack_top;
+        current_node = stack_top < SHARED_STACK_SIZE ?
+                           shared_stack[stack_top * WORKGROUP_INVOCATIONS +
+                                        gl_LocalInvocationIndex] :
+                           private_stack[stack_top - SHARED_STACK_SIZE];
+    }
+    return hit;
+}
+
+// Finds the closest triangle along the ray without shading it, so the hit
+// can be stored compactly and turned into a state later.
+bool intersect_closest(const in ray_t ray, out uint closest_instance,
+    out uint closest_triangle, out hit_record_t closest_hit_record) {
+    ++traced_rays;
+    float t_max = INFINITY;
+    return traverse_scene(ray, false, t_max, closest_instance,
+        closest_triangle, closest_hit_record);
+}
+
+void get_hit_state(const in ray_t ray, const in uint closest_instance,
+    const in uint closest_triangle, const in hit_record_t closest_hit_record,
+    out state_t state) {
+    const instance_t instance = instances[closest_instance];
+    const triangle_t triangle = unpack_triangle(closest_triangle);
+    const vec3 a = triangle.a.position;
+    const vec3 b = triangle.b.position;
+    const vec3 c = triangle.c.position;
+    const vec3 a_normal = triangle.a.normal;
+    const vec3 b_normal = triangle.b.normal;
+    const vec3 c_normal = triangle.c.normal;
+    const vec2 a_uv = triangle.a.tex_coord;
+    const vec2 b_uv = triangle.b.tex_coord;
+    const vec2 c_uv = triangle.c.tex_coord;
+    state.hit_position = ray_at(ray, closest_hit_record.t);
+    // normal coordinate in model space
+    const vec3 outward_normal = closest_hit_record.b0 * a_normal +
+                                closest_hit_record.b1 * b_normal +
+                                closest_hit_record.b2 * c_normal;
+    state.front_face = dot(ray.direction, outward_normal) < 0.0;
+    state.hit_normal = state.front_face ? outward_normal : -outward_normal;
+    const vec3 delta_pos1 = b - a;
+    const vec3 delta_pos2 = c - a;
+    const vec2 delta_uv1 = b_uv - a_uv;
+    const vec2 delta_uv2 = c_uv - a_uv;
+    const float delta_uv_inv_dev =
+        1.0 / (delta_uv1.x * delta_uv2.y - delta_uv2.x * delta_uv1.y);
+    state.hit_tangent = delta_uv_inv_dev *
+                        (delta_uv2.y * delta_pos1 - delta_uv1.y * delta_pos2);
+    state.hit_bitangent = delta_uv_inv_dev * (-delta_uv2.x * delta_pos1 +
+                                                 delta_uv1.x * delta_pos2);
+    // transform to world space
+    if (instance.transform >= 0) {
+        const mat4 transform = transforms[instance.transform];
+        state.hit_normal =
+            normalize(transpose(inverse(mat3(transform))) * state.hit_normal);
+        state.hit_tangent = normalize(mat3(transform) * state.hit_tangent);
+        state.hit_bitangent = normalize(mat3(transform) * state.hit_bitangent);
+    }
+    state.hit_uv = closest_hit_record.b0 * a_uv + closest_hit_record.b1 * b_uv +
+                   closest_hit_record.b2 * c_uv;
+    state.hit_t = closest_hit_record.t;
+    state.inst_material = instance.material;
+    state.inst_medium = instance.medium;
+    state.inst_light = instance.light;
+    state.hit_triangle = closest_triangle;
+}
+
+bool closest_hit(const in ray_t ray, inout state_t state) {
+    uint closest_instance;
+    uint closest_triangle;
+    hit_record_t closest_hit_record;
+    if (!intersect_closest(
+            ray, closest_instance, closest_triangle, closest_hit_record)) {
+        return false;
+    }
+    get_hit_state(
+        ray, closest_instance, closest_triangle, closest_hit_record, state);
+    return true;
+}
+
+bool any_hit(const in ray_t ray, const in float t_max) {
+    ++traced_rays;
+    float shadow_t_max = t_max;
+    uint instance;
+    uint triangle;
+    hit_record_t hit_record;
+    return traverse_scene(
+        ray, true, shadow_t_max, instance, triangle, hit_record);
+}
+
+vec4 eval_sky_light(const in ray_t ray) {
+    vec4 intensity_pdf = vec4(0.0);
+    if (sky_light < 0) {
+        return intensity_pdf;
+    }
+    const light_t sky = lights[sky_light];
+    if (sky.emission_tex < 0) {
+        intensity_pdf.xyz = sky.intensity;
+        intensity_pdf.w = ONE_OVER_FOUR_PI;
+    } else {
+        const float theta = acos(clamp(ray.direction.y, -1.0, 1.0));
+        const vec2 uv = vec2(
+            (PI + atan(ray.direction.z, ray.direction.x)) * ONE_OVER_TWO_PI,
+            theta * ONE_OVER_PI);
+        intensity_pdf.xyz =
+            sky.intensity *
+            tone_mapping(texture(textures[sky.emission_tex], uv).rgb);
+        const uint width = uint(sky.direction.y);
+        const uint height = uint(sky.direction.z);
+        const uint column = min(uint(uv.x * width), width - 1);
+        const uint row = min(uint(uv.y * height), height - 1);
+        const uint row_offset = height + 1 + row * (width + 1);
+        const float row_pdf =
+            (sky_distribution[row + 1] - sky_distribution[row]) * height;
+        const float column_pdf = (sky_distribution[row_offset + column + 1] -
+                                     sky_distribution[row_offset + column]) *
+                                 width;
+        // from the texture space to solid angle
+        intensity_pdf.w = row_pdf * column_pdf /
+                          (TWO_PI * PI * pad_above_zero(sin(theta)));
+    }
+    return intensity_pdf;
+}
+
+// Bucket of the CDF at offset holding u, the CDF has count + 1 entries.
+uint find_cdf_interval(const in uint offset, const in uint count,
+    const in float u) {
+    uint first = 0;
+    uint remaining = count;
+    while (remaining > 0) {
+        const uint half_remaining = remaining / 2;
+        const uint middle = first + half_remaining;
+        if (sky_distribution[offset + middle + 1] <= u) {
+            first = middle + 1;
+            remaining -= half_remaining + 1;
+        } else {
+            remaining = half_remaining;
+        }
+    }
+    return min(first, count - 1);
+}
+
+// Direction toward the sky in proportion to its radiance, eval_sky_light
+// gives its pdf.
+vec3 sample_sky_direction() {
+    const light_t sky = lights[sky_light];
+    if (sky.emission_tex < 0) {
+        return uniform_sample_sphere();
+    }
+    const uint width = uint(sky.direction.y);
+    const uint height = uint(sky.direction.z);
+    const uint row = find_cdf_interval(0, height, rand_01());
+    const uint column =
+        find_cdf_interval(height + 1 + row * (width + 1), width, rand_01());
+    const vec2 uv =
+        vec2((column + rand_01()) / width, (row + rand_01()) / height);
+    const float theta = uv.y * PI;
+    const float phi = uv.x * TWO_PI - PI;
+    return vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+float cos_sub_clamped(const in float sin_a, const in float cos_a,
+    const in float sin_b, const in float cos_b) {
+    return cos_a > cos_b ? 1.0 : cos_a * cos_b + sin_a * sin_b;
+}
+
+float sin_sub_clamped(const in float sin_a, const in float cos_a,
+    const in float sin_b, const in float cos_b) {
+    return cos_a > cos_b ? 0.0 : sin_a * cos_b - cos_a * sin_b;
+}
+
+// Bounds the light reaching the position from the emitters below the node,
+// pbrt's LightBounds::Importance without the cosine at the receiver.
+float light_bvh_importance(
+    const in light_bvh_node_t node, const in vec3 position) {
+    const vec3 center = 0.5 * (node.bounds_min + node.bounds_max);
+    const vec3 to_position = position - center;
+    const float dist2 = dot(to_position, to_position);
+    const float radius2 = 0.25 * dot(node.bounds_max - node.bounds_min,
+                                     node.bounds_max - node.bounds_min);
+    float cos_theta_w =
+        dist2 > 0.0 ? dot(node.axis, to_position) * inversesqrt(dist2) : 1.0;
+    if ((node.flags & LIGHT_BVH_TWO_SIDED) != 0) {
+        cos_theta_w = abs(cos_theta_w);
+    }
+    const float sin_theta_w = sqrt(max(0.0, 1.0 - square(cos_theta_w)));
+    // half angle of the bounding sphere seen from the position
+    float cos_theta_b = -1.0;
+    float sin_theta_b = 0.0;
+    if (dist2 > radius2) {
+        sin_theta_b = sqrt(radius2 / dist2);
+        cos_theta_b = sqrt(1.0 - radius2 / dist2);
+    }
+    const float sin_theta_o = sqrt(max(0.0, 1.0 - square(node.cos_theta_o)));
+    const float cos_theta_x = cos_sub_clamped(
+        sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+    const float sin_theta_x = sin_sub_clamped(
+        sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+    const float cos_theta_p =
+        cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+    if (cos_theta_p <= node.cos_theta_e) {
+        return 0.0;
+    }
+    // points inside the box would make the bound blow up
+    return node.phi * cos_theta_p / max(dist2, sqrt(radius2));
+}
+
+// Walks down the light BVH choosing children in proportion to their
+// importance, pmf is the probability of the emitter reached.
+bool sample_light_bvh(const in vec3 position, out uint light_idx,
+    out uint triangle_idx, out float pmf) {
+    light_idx = 0;
+    triangle_idx = 0;
+    pmf = 1.0;
+    if (!(light_bvh_importance(light_bvh[0], position) > 0.0)) {
+        return false;
+    }
+    uint node_idx = 0;
+    while (true) {
+        const light_bvh_node_t node = light_bvh[node_idx];
+        if ((node.flags & LIGHT_BVH_LEAF) != 0) {
+            light_idx = node.light;
+            triangle_idx = node.triangle;
+            return true;
+        }
+        const float left =
+            light_bvh_importance(light_bvh[node_idx + 1], position);
+        const float right =
+            light_bvh_importance(light_bvh[node.right], position);
+        if (!(left + right > 0.0)) {
+            return false;
+        }
+        const float left_pmf = left / (left + right);
+        if (rand_01() < left_pmf) {
+            node_idx = node_idx + 1;
+            pmf *= left_pmf;
+        } else {
+            node_idx = node.right;
+            pmf *= 1.0 - left_pmf;
+        }
+    }
+    return false;
+}
+
+// Probability of sample_light_bvh reaching the leaf from the position. The
+// subtree of the first child of a node lies between it and the second child,
+// so the index of the leaf tells which child leads to it.
+float get_light_bvh_pmf(const in vec3 position, const in uint leaf) {
+    if (leaf == LIGHT_BVH_NO_LEAF ||
+        !(light_bvh_importance(light_bvh[0], position) > 0.0)) {
+        return 0.0;
+    }
+    float pmf = 1.0;
+    uint node_idx = 0;
+    while (node_idx != leaf) {
+        const light_bvh_node_t node = light_bvh[node_idx];
+        if ((node.flags & LIGHT_BVH_LEAF) != 0) {
+            return 0.0;
+        }
+        const float left =
+            light_bvh_importance(light_bvh[node_idx + 1], position);
+        const float right =
+            light_bvh_importance(light_bvh[node.right], position);
+        if (!(left + right > 0.0)) {
+            return 0.0;
+        }
+        const float left_pmf = left / (left + right);
+        if (leaf < node.right) {
+            node_idx = node_idx + 1;
+            pmf *= left_pmf;
+        } else {
+            node_idx = node.right;
+            pmf *= 1.0 - left_pmf;
+        }
+    }
+    return pmf;
+}
+
+// Picks an index of the alias table of count entries at offset in constant
+// time, pmf is the probability of the index.
+uint sample_alias_table(
+    const in uint offset, const in uint count, out float pmf) {
+    const float u = rand_01() * count;
+    const uint slot = min(uint(u), count - 1);
+    const alias_entry_t entry = light_alias[offset + slot];
+    const uint idx = u - slot < entry.threshold ? slot : entry.alias;
+    pmf = light_alias[offset + idx].pmf;
+    return idx;
+}
+
+// Probability of sample_light_ray picking the sky, the mis weight of paths
+// escaping to it needs it as well.
+float get_sky_pick_pdf() {
+    if (sky_light < 0) {
+        return 0.0;
+    }
+    if (light_sampling != LIGHT_SAMPLING_UNIFORM) {
+        // the sky has no power to weigh against the emitters and takes half
+        // of the samples, the root of the light BVH tells if there are any
+        return light_bvh[0].phi > 0.0 ? 0.5 : 1.0;
+    }
+    return 1.0 / light_count;
+}
+
+// Samples a light as seen from the position without testing visibility,
+// the shadow ray goes from the position along light_sample.wi up to t_max.
+bool sample_light_ray(const in ray_t ray, const in vec3 position,
+    out light_sample_t light_sample, out float shadow_t_max) {
+    light_sample = empty_light_sample();
+    uint light_idx;
+    float light_pdf;
+    // the triangle of an area light when the light and the triangle are
+    // picked together, its pmf is part of light_pdf
+    int picked_triangle = -1;
+    if (light_sampling == LIGHT_SAMPLING_BVH) {
+        const float sky_pdf = get_sky_pick_pdf();
+        if (rand_01() < sky_pdf) {
+            light_idx = uint(sky_light);
+            light_pdf = sky_pdf;
+        } else {
+            uint triangle_idx;
+            float pmf;
+            if (!sample_light_bvh(position, light_idx, triangle_idx, pmf)) {
+                return false;
+            }
+            picked_triangle = int(triangle_idx);
+            light_pdf = (1.0 - sky_pdf) * pmf;
+        }
+    } else if (light_sampling == LIGHT_SAMPLING_POWER) {
+        const float sky_pdf = get_sky_pick_pdf();
+        if (rand_01() < sky_pdf) {
+            light_idx = uint(sky_light);
+            light_pdf = sky_pdf;
+        } else {
+            float light_pmf;
+            light_idx = sample_alias_table(0, light_count, light_pmf);
+            const mesh_t mesh = meshes[lights[light_idx].mesh];
+            float triangle_pmf;
+            const uint triangle_idx =
+                sample_alias_table(light_alias[light_idx].link,
+                    mesh.triangle_count, triangle_pmf);
+            if (!(light_pmf * triangle_pmf > 0.0)) {
+                return false;
+            }
+            picked_triangle = int(mesh.triangle_offset + triangle_idx);
+            light_pdf = (1.0 - sky_pdf) * light_pmf * triangle_pmf;
+        }
+    } else {
+        light_idx = rand_uint(0, light_count - 1);
+        light_pdf = 1.0 / light_count;
+    }
+    const light_t light = lights[light_idx];
+    const float infinity_light_t_max = INFINITY - EPSILON;
+    light_sample.type = light.type;
+    if (light.type == LIGHT_SKY) {
+        const vec3 direction = sample_sky_direction();
+        const ray_t shadow_ray = ray_t(position, direction);
+        shadow_t_max = infinity_light_t_max;
+        const vec4 intensity_pdf = eval_sky_light(shadow_ray);
+        light_sample.intensity = intensity_pdf.xyz;
+        light_sample.pdf = light_pdf * intensity_pdf.w;
+        light_sample.wi = direction;
+        return true;
+    } else if (light.type == LIGHT_DISTANT) {
+    } else if (light.type == LIGHT_AREA_SINGLE_SIDED ||
+               light.type == LIGHT_AREA_DOUBLE_SIDED) {
+        const mesh_t mesh = meshes[light.mesh];
+        const uint triangle_i =
+            picked_triangle >= 0 ?
+                uint(picked_triangle) :
+                mesh.triangle_offset + rand_uint(0, mesh.triangle_count - 1);
+        const mat4 transform =
+            light.transform >= 0 ? transforms[light.transform] : mat4(1.0);
+        const mat3 inverse_transform =
+            light.transform >= 0 ? inverse(mat3(transform)) : mat3(1.0);
+        const triangle_t triangle = unpack_triangle(triangle_i);
+        const vec3 tri_coord = uniform_sample_triangle();
+        const vec3 light_sample_pos =
+            vec3(transform * vec4(tri_coord.x * triangle.a.position +
+                                      tri_coord.y * triangle.b.position +
+                                      tri_coord.z * triangle.c.position,
+                                 1.0));
+        const vec3 light_sample_nor =
+            transpose(inverse_transform) *
+            (tri_coord.x * triangle.a.normal + tri_coord.y * triangle.b.normal +
+                tri_coord.z * triangle.c.normal);
+        const vec3 light_to_frag = light_sample_pos - position;
+        if (light.type != LIGHT_AREA_DOUBLE_SIDED &&
+            dot(light_to_frag, light_sample_nor) > 0.0) {
+            return false;
+        }
+        const float light_frag_dist = length(light_to_frag);
+        const float light_frag_dist2 = light_frag_dist * light_frag_dist;
+        const vec3 light_frag_direction = light_to_frag / light_frag_dist;
+        const ray_t shadow_ray = ray_t(position, light_frag_direction);
+        shadow_t_max = light_frag_dist - EPSILON;
+        vec3 intensity = light.intensity;
+        if (light.emission_tex >= 0) {
+            const vec2 uv = tri_coord.x * triangle.a.tex_coord +
+                            tri_coord.y * triangle.b.tex_coord +
+                            tri_coord.z * triangle.c.tex_coord;
+            intensity *= texture(textures[light.emission_tex], uv).rgb;
+        }
+        float pdf_on_light = 1.0 / light.direction.x;
+        if (picked_triangle >= 0) {
+            // the point is uniform on the area of the picked triangle
+            const vec3 edge_1 = mat3(transform) *
+                                (triangle.b.position - triangle.a.position);
+            const vec3 edge_2 = mat3(transform) *
+                                (triangle.c.position - triangle.a.position);
+            pdf_on_light = 2.0 / length(cross(edge_1, edge_2));
+        }
+        light_sample.intensity = intensity;
+        light_sample.pdf = light_pdf * pdf_on_light *
+                           (light_frag_dist2 / abs(dot(light_sample_nor,
+                                                   light_frag_direction)));
+        light_sample.wi = shadow_ray.direction;
+        return true;
+    }
+    return false;
+}
+
+// Solid angle density of sample_light_ray picking the point of an area light
+// that a ray from the position hit, the mis weight of the emission a bsdf
+// sample finds needs it.
+float get_area_light_pdf(const in vec3 position, const in state_t state) {
+    const light_t light = lights[state.inst_light];
+    const mesh_t mesh = meshes[light.mesh];
+    const uint triangle_entry = light_alias[state.inst_light].link +
+                                state.hit_triangle - mesh.triangle_offset;
+    float light_pdf;
+    if (light_sampling == LIGHT_SAMPLING_BVH) {
+        const uint leaf = light_alias[triangle_entry].link;
+        light_pdf =
+            (1.0 - get_sky_pick_pdf()) * get_light_bvh_pmf(position, leaf);
+    } else if (light_sampling == LIGHT_SAMPLING_POWER) {
+        light_pdf = (1.0 - get_sky_pick_pdf()) *
+                    light_alias[state.inst_light].pmf *
+                    light_alias[triangle_entry].pmf;
+    } else {
+        light_pdf = 1.0 / light_count;
+    }
+    float pdf_on_light = 1.0 / light.direction.x;
+    if (light_sampling != LIGHT_SAMPLING_UNIFORM) {
+        // the point is uniform on the area of the picked triangle
+        const mat3 transform = light.transform >= 0 ?
+                                   mat3(transforms[light.transform]) :
+                                   mat3(1.0);
+        const triangle_t triangle = unpack_triangle(state.hit_triangle);
+        const vec3 edge_1 =
+            transform * (triangle.b.position - triangle.a.position);
+        const vec3 edge_2 =
+            transform * (triangle.c.position - triangle.a.position);
+        pdf_on_light = 2.0 / length(cross(edge_1, edge_2));
+    }
+    const vec3 light_to_frag = state.hit_position - position;
+    const float light_frag_dist2 = dot(light_to_frag, light_to_frag);
+    const float cos_light = abs(
+        dot(state.hit_normal, light_to_frag * inversesqrt(light_frag_dist2)));
+    return light_pdf * pdf_on_light * light_frag_dist2 /
+           max(cos_light, EPSILON);
+}
+
+bool sample_light(const in ray_t ray, const in vec3 position,
+    out light_sample_t light_sample) {
+    float shadow_t_max;
+    if (!sample_light_ray(ray, position, light_sample, shadow_t_max)) {
+        return false;
+    }
+    return !any_hit(ray_t(position, light_sample.wi), shadow_t_max);
+}
+
+// Adds the rays traced by the invocation to the 64 bit total, one atomic per
+// subgroup.
+void count_traced_rays() {
+    const uint subgroup_rays = subgroupAdd(traced_rays);
+    if (subgroupElect()) {
+        const uint previous = atomicAdd(traced_rays_low, subgroup_rays);
+        if (previous + subgroup_rays < previous) {
+            atomicAdd(traced_rays_high, 1);
+        }
+    }
+}
@@ -8,6 +8,7 @@ struct state_t {
     int inst_material;
     int inst_medium;
     int inst_light;
+    uint hit_triangle;  // index into the triangles of the BVH
     bool front_face;
 };
 
@@ -0,0 +1,170 @@
+// Shared by the kernels of the wavefront raytracer. A wave is a range of
+// paths, each kernel handles one stage of every path in a queue and appends
+// the paths of the next stage to another queue. Indirect dispatches grow
+// with the queues, so no stage launches more invocations than it has work.
+
+layout(push_constant, std430) uniform PUSH_CONSTANT {
+    float packed_camera[12];
+    uint random_seed;
+    uint preview;
+    uint max_depth;
+    uint light_count;
+    int sky_light;
+    uint light_sampling;
+    // SAMPLER_RANDOM or SAMPLER_SOBOL, the index of the Sobol point
+    uint sampler;
+    uint sample_index;
+    uint count_rays;
+    // pixels of the render, paths of a wave are a range of them in rows
+    uvec2 rect_min;
+    uvec2 rect_max;
+    uint first_path;
+    uint path_count;
+    // the ray queue extended this bounce, the other one is filled by shade
+    uint ray_queue;
+    // shade reads the hit queue sorted by material
+    uint sort_hits;
+};
+
+uint seed = random_seed;
+
+uint traced_rays = 0;
+
+#include "../common/utils.glsl"
+#include "../common/to_ldr.glsl"
+#include "../common/geometry.glsl"
+#include "../common/material.glsl"
+#include "../common/light.glsl"
+#include "../common/low_discrepancy_sequence.glsl"
+#include "../common/random.glsl"
+#include "state.glsl"
+#include "aabb.glsl"
+#include "bvh.glsl"
+#include "ray.glsl"
+#include "camera.glsl"
+#include "sampling.glsl"
+#include "disney.glsl"
+
+layout(rgba32f, set = 3, binding = 0) uniform image2D out_img[2];
+
+#include "scene.glsl"
+
+struct path_t {
+    vec3 origin;
+    uint pixel;  // x in the low and y in the high 16 bits
+    vec3 direction;
+    uint seed;  // state of the sampler, see get_sampler_state
+    vec3 throughput;
+    float bsdf_pdf;  // of the bounce that made the ray, for mis on the sky
+    vec3 radiance;
+    uint depth;
+};
+
+struct hit_t {
+    float b0;
+    float b1;
+    float b2;
+    float t;
+    uint instance;
+    uint triangle;
+    uint hit;
+    uint padding;
+};
+
+struct shadow_ray_t {
+    vec3 origin;
+    float t_max;
+    vec3 direction;
+    uint path;
+    vec3 contribution;  // added to the path when nothing is in the way
+    uint padding;
+};
+
+struct queue_t {
+    uint count;
+    // VkDispatchIndirectCommand of the kernel consuming the queue
+    uint group_count_x;
+    uint group_count_y;
+    uint group_count_z;
+};
+
+#define RAY_QUEUE_0 0
+#define RAY_QUEUE_1 1
+#define HIT_QUEUE 2
+#define SHADOW_QUEUE 3
+
+layout(std430, set = 4, binding = 0) buffer PATHS {
+    path_t paths[];
+};
+
+// by path, the closest hit of its last extended ray
+layout(std430, set = 4, binding = 1) buffer HITS {
+    hit_t hits[];
+};
+
+layout(std430, set = 4, binding = 2) buffer SHADOW_RAYS {
+    shadow_ray_t shadow_rays[];
+};
+
+// two queues of path indices back to back
+layout(std430, set = 4, binding = 3) buffer RAY_QUEUES {
+    uint ray_queues[];
+};
+
+layout(std430, set = 4, binding = 4) buffer HIT_QUEUE_BUFFER {
+    uint hit_queue[];
+};
+
+layout(std430, set = 4, binding = 5) buffer QUEUES {
+    queue_t queues[];
+};
+
+// hits per material bin, turned into the first slot of every bin
+layout(std430, set = 4, binding = 6) buffer MATERIAL_BINS {
+    uint material_bins[];
+};
+
+layout(std430, set = 4, binding = 7) buffer SORTED_HIT_QUEUE_BUFFER {
+    uint sorted_hit_queue[];
+};
+
+uint get_ray_queue_capacity() {
+    return ray_queues.length() / 2;
+}
+
+// Reserves a slot in the queue for every active invocation with one atomic
+// per subgroup, and adds the workgroups the slots need to its dispatch.
+uint push_queue(const in uint queue) {
+    const uvec4 ballot = subgroupBallot(true);
+    const uint count = subgroupBallotBitCount(ballot);
+    uint first = 0;
+    if (subgroupElect()) {
+        first = atomicAdd(queues[queue].count, count);
+        const uint size = gl_WorkGroupSize.x;
+        const uint groups =
+            (first + count + size - 1) / size - (first + size - 1) / size;
+        if (groups > 0) {
+            atomicAdd(queues[queue].group_count_x, groups);
+        }
+    }
+    return subgroupBroadcastFirst(first) +
+           subgroupBallotExclusiveBitCount(ballot);
+}
+
+ivec2 unpack_pixel(const in uint pixel) {
+    return ivec2(pixel & 0xffff, pixel >> 16);
+}
+
+// Bin of the hit of a path, misses shading the sky come first, then hits on
+// lights, then one bin per material.
+uint get_material_bin(const in uint path) {
+    const hit_t hit = hits[path];
+    if (hit.hit == 0) {
+        return 0;
+    }
+    const instance_t instance = instances[hit.instance];
+    if (instance.light >= 0 || instance.material < 0) {
+        return 1;
+    }
+    return uint(instance.material) + 2;
+}
@@ -0,0 +1,98 @@
+#include "camera_path.h"
+#include "check.h"
+
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#include "nlohmann/json.hpp"
+#pragma clang diagnostic pop
+
+#pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
+
+inline glm::vec3 catmull_rom(glm::vec3 const& p0, glm::vec3 const& p1,
+    glm::vec3 const& p2, glm::vec3 const& p3, float t) {
+    float const t2 = t * t;
+    float const t3 = t2 * t;
+    return 0.5f * (2.0f * p1 + (p2 - p0) * t +
+                      (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+                      (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+}
+
+camera_path load_camera_path(std::string_view file_path) {
+    try {
+        std::ifstream ifs{file_path.data()};
+        nlohmann::json root_json = nlohmann::json::parse(ifs);
+        nlohmann::json const& path_json =
+            root_json.contains("/camera/keyframes"_json_pointer) ?
+                root_json.at("/camera"_json_pointer) :
+                root_json;
+        camera_path path{};
+        path.fps = path_json.value("/fps"_json_pointer, 24.0f);
+        for (auto const& val : path_json.at("/keyframes"_json_pointer)) {
+            camera_keyframe const keyframe{
+                .time = val.at("/time"_json_pointer),
+                .lookfrom =
+                    glm::vec3{
+                        val.at("/lookfrom/0"_json_pointer),
+                        val.at("/lookfrom/1"_json_pointer),
+                        val.at("/lookfrom/2"_json_pointer),
+                    },
+                .lookat =
+                    glm::vec3{
+                        val.at("/lookat/0"_json_pointer),
+                        val.at("/lookat/1"_json_pointer),
+                        val.at("/lookat/2"_json_pointer),
+                    },
+                .fov = val.value("/fov"_json_pointer, 45.0f),
+            };
+            path.keyframes.push_back(keyframe);
+        }
+        CHECK(!path.keyframes.empty(), "{} has no camera keyframes",
+            file_path);
+        CHECK(path.fps > 0.0f, "Camera path fps must be positive");
+        std::stable_sort(path.keyframes.begin(), path.keyframes.end(),
+            [](camera_keyframe const& a, camera_keyframe const& b) {
+                return a.time < b.time;
+            });
+        return path;
+    } catch (std::exception& exp) {
+        CHECK(false, "{}", exp.what());
+    }
+}
+
+uint32_t get_camera_path_frame_count(camera_path const& path) {
+    float const duration =
+        path.keyframes.back().time - path.keyframes.front().time;
+    return (uint32_t) std::floor(duration * path.fps) + 1;
+}
+
+camera evaluate_camera_path(camera_path const& path, uint32_t frame) {
+    std::vector<camera_keyframe> const& keys = path.keyframes;
+    if (keys.size() == 1) {
+        return create_camera(
+            keys.front().lookfrom, keys.front().lookat, keys.front().fov);
+    }
+    float const time = keys.front().time + (float) frame / path.fps;
+    // the segment holding the time ends at keyframe next
+    auto const upper = std::upper_bound(keys.begin(), keys.end(), time,
+        [](float t, camera_keyframe const& key) { return t < key.time; });
+    uint32_t const last = (uint32_t) keys.size() - 1;
+    uint32_t const next =
+        std::clamp((uint32_t) (upper - keys.begin()), 1u, last);
+    camera_keyframe const& k0 = keys[next == 1 ? 0 : next - 2];
+    camera_keyframe const& k1 = keys[next - 1];
+    camera_keyframe const& k2 = keys[next];
+    camera_keyframe const& k3 = keys[std::min(next + 1, last)];
+    float const span = k2.time - k1.time;
+    float const t =
+        span > 0.0f ? std::clamp((time - k1.time) / span, 0.0f, 1.0f) : 1.0f;
+    glm::vec3 const lookfrom =
+        catmull_rom(k0.lookfrom, k1.lookfrom, k2.lookfrom, k3.lookfrom, t);
+    glm::vec3 const lookat =
+        catmull_rom(k0.lookat, k1.lookat, k2.lookat, k3.lookat, t);
+    float const fov = glm::mix(k1.fov, k2.fov, t);
+    return create_camera(lookfrom, lookat, fov);
+}
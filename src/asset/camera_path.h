@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <string_view>
+
+#include "asset/camera.h"
+
+struct camera_keyframe {
+    float time;
+    glm::vec3 lookfrom;
+    glm::vec3 lookat;
+    float fov;
+};
+
+struct camera_path {
+    float fps = 24.0f;
+    std::vector<camera_keyframe> keyframes;  // sorted by time
+};
+
+// Reads /camera/keyframes of a scene file, or the root of a sidecar file
+// holding just the fps and keyframes.
+camera_path load_camera_path(std::string_view file_path);
+
+uint32_t get_camera_path_frame_count(camera_path const& path);
+
+// Positions and targets follow a Catmull-Rom spline through the keyframes,
+// the fov is interpolated linearly.
+camera evaluate_camera_path(camera_path const& path, uint32_t frame);
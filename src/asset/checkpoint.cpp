@@ -0,0 +1,151 @@
+#include "checkpoint.h"
+#include "check.h"
+
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+
+#pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
+
+static uint32_t constexpr CHECKPOINT_MAGIC = 0x4b435452;  // "RTCK"
+// 2 counts the samples of every pixel in alpha with either renderer, 3 lists
+// the finished jobs of a distributed render after the sums
+static uint32_t constexpr CHECKPOINT_VERSION = 3;
+
+struct checkpoint_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t setup_hash;
+    uint32_t width;
+    uint32_t height;
+    uint32_t seed;
+    uint32_t sample_count;
+    uint64_t traced_rays;
+};
+
+static uint64_t fnv1a(uint64_t hash, void const* data, size_t size) {
+    uint8_t const* const bytes = (uint8_t const*) data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+template <typename T>
+static uint64_t fnv1a(uint64_t hash, T const& value) {
+    return fnv1a(hash, &value, sizeof(T));
+}
+
+uint64_t hash_render_setup(std::string_view scene_file,
+    render_options const& options, camera const& camera,
+    uint32_t distributed_samples) {
+    std::ifstream ifs{scene_file.data(), std::ios::binary};
+    CHECK(ifs.is_open(), "Can't open {}", scene_file);
+    std::string const scene{std::istreambuf_iterator<char>{ifs}, {}};
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = fnv1a(hash, scene.data(), scene.size());
+    // only the options that change the accumulation, not the padding of the
+    // struct nor the budgets of the window
+    hash = fnv1a(hash, options.resolution_x);
+    hash = fnv1a(hash, options.resolution_y);
+    hash = fnv1a(hash, options.max_depth);
+    hash = fnv1a(hash, options.tile_width);
+    hash = fnv1a(hash, options.tile_height);
+    hash = fnv1a(hash, options.seed);
+    hash = fnv1a(hash, options.light_sampling);
+    hash = fnv1a(hash, options.sampler);
+    hash = fnv1a(hash, options.aovs);
+    hash = fnv1a(hash, options.adaptive_threshold);
+    hash = fnv1a(hash, camera.position);
+    hash = fnv1a(hash, camera.front);
+    hash = fnv1a(hash, camera.fov);
+    if (distributed_samples != 0) {
+        hash = fnv1a(hash, distributed_samples);
+    }
+    return hash;
+}
+
+void write_checkpoint(
+    std::string_view file_path, checkpoint const& checkpoint) {
+    std::string const path{file_path};
+    std::string const temp_path = path + ".tmp";
+    checkpoint_header const header{
+        .magic = CHECKPOINT_MAGIC,
+        .version = CHECKPOINT_VERSION,
+        .setup_hash = checkpoint.setup_hash,
+        .width = checkpoint.width,
+        .height = checkpoint.height,
+        .seed = checkpoint.seed,
+        .sample_count = checkpoint.accumulation.sample_count,
+        .traced_rays = checkpoint.accumulation.traced_rays,
+    };
+    {
+        std::ofstream ofs{temp_path, std::ios::binary | std::ios::trunc};
+        CHECK(ofs.is_open(), "Can't write checkpoint {}", temp_path);
+        ofs.write((char const*) &header, sizeof(header));
+        ofs.write((char const*) checkpoint.accumulation.sums.data(),
+            (std::streamsize) (checkpoint.accumulation.sums.size() *
+                               sizeof(float)));
+        uint32_t const finished_job_count =
+            (uint32_t) checkpoint.finished_jobs.size();
+        ofs.write((char const*) &finished_job_count, sizeof(uint32_t));
+        ofs.write((char const*) checkpoint.finished_jobs.data(),
+            (std::streamsize) (finished_job_count * sizeof(uint32_t)));
+        ofs.flush();
+        CHECK(ofs.good(), "Can't write checkpoint {}", temp_path);
+    }
+    std::filesystem::rename(temp_path, path);
+}
+
+std::optional<checkpoint> read_checkpoint(std::string_view file_path,
+    uint64_t setup_hash, uint32_t width, uint32_t height, uint32_t seed) {
+    std::ifstream ifs{file_path.data(), std::ios::binary};
+    if (!ifs.is_open()) {
+        return std::nullopt;
+    }
+    checkpoint_header header{};
+    ifs.read((char*) &header, sizeof(header));
+    if (!ifs.good() || header.magic != CHECKPOINT_MAGIC ||
+        header.version != CHECKPOINT_VERSION) {
+        fmt::println("{} isn't a checkpoint of this version, starting over",
+            file_path);
+        return std::nullopt;
+    }
+    if (header.setup_hash != setup_hash || header.width != width ||
+        header.height != height || header.seed != seed) {
+        fmt::println(
+            "{} was taken from another scene, camera or options, starting "
+            "over",
+            file_path);
+        return std::nullopt;
+    }
+    checkpoint ret{
+        .setup_hash = header.setup_hash,
+        .width = header.width,
+        .height = header.height,
+        .seed = header.seed,
+        .accumulation =
+            accumulation{
+                .sums = std::vector<float>(
+                    4 * (size_t) header.width * header.height),
+                .sample_count = header.sample_count,
+                .traced_rays = header.traced_rays,
+            },
+    };
+    ifs.read((char*) ret.accumulation.sums.data(),
+        (std::streamsize) (ret.accumulation.sums.size() * sizeof(float)));
+    uint32_t finished_job_count = 0;
+    ifs.read((char*) &finished_job_count, sizeof(uint32_t));
+    if (ifs.good()) {
+        ret.finished_jobs.resize(finished_job_count);
+        ifs.read((char*) ret.finished_jobs.data(),
+            (std::streamsize) (finished_job_count * sizeof(uint32_t)));
+    }
+    if (!ifs.good()) {
+        fmt::println("Checkpoint {} is truncated, starting over", file_path);
+        return std::nullopt;
+    }
+    return ret;
+}
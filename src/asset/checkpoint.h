@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "asset/camera.h"
+#include "renderer/renderer.h"
+#include "renderer/render_options.h"
+
+// Everything needed to continue a progressive render. The seed of a sample
+// is derived from the base seed and its index, so the sample count and the
+// seed are the whole random state. A distributed render continues from the
+// jobs it has merged instead, the per-pixel counts of its sums hold their
+// samples.
+struct checkpoint {
+    uint64_t setup_hash;
+    uint32_t width;
+    uint32_t height;
+    uint32_t seed;
+    accumulation accumulation;
+    std::vector<uint32_t> finished_jobs = {};
+};
+
+// Hash of the scene file, the options and the camera, a checkpoint only
+// resumes the render it was taken from. A distributed render splits its jobs
+// by its sample target, which it adds.
+uint64_t hash_render_setup(std::string_view scene_file,
+    render_options const& options, camera const& camera,
+    uint32_t distributed_samples = 0);
+
+// Writes to a temporary file first and renames it, so a preempted write
+// leaves the previous checkpoint intact.
+void write_checkpoint(
+    std::string_view file_path, checkpoint const& checkpoint);
+
+// Reads the checkpoint at the path if there is one of this version taken from
+// the render of the setup hash, resolution and seed. Any other file is
+// reported and its sums aren't read, the render starts over then.
+std::optional<checkpoint> read_checkpoint(std::string_view file_path,
+    uint64_t setup_hash, uint32_t width, uint32_t height, uint32_t seed);
@@ -0,0 +1,143 @@
+#include <cmath>
+#include <array>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <utility>
+#include <algorithm>
+
+#include "image_writer.h"
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#include "stb_image_write.h"
+#pragma clang diagnostic pop
+
+#include "check.h"
+
+struct exr_channel {
+    std::string name;
+    std::span<float const> data;
+    uint32_t component;  // offset of the channel inside a pixel
+    uint32_t stride;     // floats per pixel
+};
+
+template <typename T>
+static void write_binary(std::ofstream& file, T const& value) {
+    file.write(reinterpret_cast<char const*>(&value), sizeof(T));
+}
+
+static void write_exr_attribute(std::ofstream& file, std::string_view name,
+    std::string_view type, uint32_t size) {
+    file << name << '\0' << type << '\0';
+    write_binary(file, size);
+}
+
+// Single part scanline OpenEXR with uncompressed 32 bit float channels.
+static void write_exr(std::string const& path, uint32_t width,
+    uint32_t height, std::vector<exr_channel> channels) {
+    std::ofstream file{path, std::ios::binary};
+    CHECK(file.is_open(), "Can't write image {}", path);
+    // readers expect the channel list sorted by name
+    std::ranges::sort(channels, {}, &exr_channel::name);
+    uint32_t channel_list_size = 1;
+    for (auto const& channel : channels) {
+        channel_list_size += (uint32_t) channel.name.size() + 1 + 16;
+    }
+    write_binary(file, 20000630u);
+    write_binary(file, 2u);
+    write_exr_attribute(file, "channels", "chlist", channel_list_size);
+    for (auto const& channel : channels) {
+        file << channel.name << '\0';
+        write_binary(file, 2u);  // FLOAT
+        write_binary(file, 0u);  // pLinear and reserved
+        write_binary(file, 1u);  // x sampling
+        write_binary(file, 1u);  // y sampling
+    }
+    file << '\0';
+    write_exr_attribute(file, "compression", "compression", 1);
+    file << '\0';
+    std::array const window{0, 0, (int32_t) width - 1, (int32_t) height - 1};
+    write_exr_attribute(file, "dataWindow", "box2i", sizeof(window));
+    write_binary(file, window);
+    write_exr_attribute(file, "displayWindow", "box2i", sizeof(window));
+    write_binary(file, window);
+    write_exr_attribute(file, "lineOrder", "lineOrder", 1);
+    file << '\0';
+    write_exr_attribute(file, "pixelAspectRatio", "float", sizeof(float));
+    write_binary(file, 1.0f);
+    write_exr_attribute(file, "screenWindowCenter", "v2f", 2 * sizeof(float));
+    write_binary(file, std::array{0.0f, 0.0f});
+    write_exr_attribute(file, "screenWindowWidth", "float", sizeof(float));
+    write_binary(file, 1.0f);
+    file << '\0';
+    // one scanline per chunk: y, byte count, then every channel of the line
+    uint32_t const line_size =
+        width * (uint32_t) channels.size() * (uint32_t) sizeof(float);
+    uint64_t const first_line =
+        (uint64_t) file.tellp() + height * sizeof(uint64_t);
+    for (uint32_t y = 0; y < height; ++y) {
+        write_binary(file, first_line + y * (line_size + 8ull));
+    }
+    std::vector<float> line(width);
+    for (uint32_t y = 0; y < height; ++y) {
+        write_binary(file, (int32_t) y);
+        write_binary(file, line_size);
+        for (auto const& channel : channels) {
+            for (uint32_t x = 0; x < width; ++x) {
+                line[x] = channel.data[(y * width + x) * channel.stride +
+                                       channel.component];
+            }
+            file.write(reinterpret_cast<char const*>(line.data()),
+                (std::streamsize) (line.size() * sizeof(float)));
+        }
+    }
+    CHECK(file.good(), "Can't write image {}", path);
+}
+
+static uint8_t to_ldr(float radiance) {
+    float const mapped = radiance / (radiance + 1.0f);
+    float const corrected = std::pow(mapped, 1.0f / 2.2f);
+    return (uint8_t) std::clamp(corrected * 255.0f + 0.5f, 0.0f, 255.0f);
+}
+
+void write_image(std::string_view image_path, uint32_t width, uint32_t height,
+    std::span<float const> rgba, std::span<image_layer const> layers) {
+    CHECK(rgba.size() == 4ull * width * height,
+        "Image data doesn't match {}x{}", width, height);
+    std::string const path{image_path};
+    bool written = false;
+    if (image_path.ends_with(".hdr")) {
+        written = stbi_write_hdr(path.c_str(), (int) width, (int) height, 4,
+                      rgba.data()) != 0;
+    } else if (image_path.ends_with(".exr")) {
+        std::vector<exr_channel> channels{
+            {"R", rgba, 0, 4},
+            {"G", rgba, 1, 4},
+            {"B", rgba, 2, 4},
+        };
+        for (image_layer const& layer : layers) {
+            uint32_t const stride = (uint32_t) layer.channels.size();
+            CHECK(layer.data.size() == (size_t) stride * width * height,
+                "Layer {} doesn't match {}x{}", layer.name, width, height);
+            for (uint32_t c = 0; c < stride; ++c) {
+                channels.push_back({layer.name + "." + layer.channels[c],
+                    layer.data, c, stride});
+            }
+        }
+        write_exr(path, width, height, std::move(channels));
+        written = true;
+    } else if (image_path.ends_with(".png")) {
+        std::vector<uint8_t> ldr(3ull * width * height);
+        for (uint32_t p = 0; p < width * height; ++p) {
+            ldr[3 * p + 0] = to_ldr(rgba[4 * p + 0]);
+            ldr[3 * p + 1] = to_ldr(rgba[4 * p + 1]);
+            ldr[3 * p + 2] = to_ldr(rgba[4 * p + 2]);
+        }
+        written = stbi_write_png(path.c_str(), (int) width, (int) height, 3,
+                      ldr.data(), 3 * (int) width) != 0;
+    } else {
+        CHECK(false, "Unsupported image format {}", image_path);
+    }
+    CHECK(written, "Can't write image {}", image_path);
+}
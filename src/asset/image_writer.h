@@ -0,0 +1,21 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+
+// Extra channels of an image, e.g. an AOV, written as <name>.<channel>.
+struct image_layer {
+    std::string name;
+    std::vector<std::string> channels;
+    std::vector<float> data;  // every channel of a pixel in turn
+};
+
+// Writes linear rgba radiance, the file format follows the extension. .hdr
+// and .exr keep the radiance as is, .png is tone mapped and gamma corrected
+// the same way as the preview. Only .exr holds layers, the other formats
+// leave them out.
+void write_image(std::string_view image_path, uint32_t width, uint32_t height,
+    std::span<float const> rgba, std::span<image_layer const> layers = {});
@@ -0,0 +1,62 @@
+#include "render_job.h"
+#include "check.h"
+
+#include <fstream>
+#include <filesystem>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#include "nlohmann/json.hpp"
+#pragma clang diagnostic pop
+
+std::vector<render_job> load_render_jobs(std::string_view file_path,
+    uint32_t default_samples_per_pixel, float default_time_limit_seconds) {
+    try {
+        std::ifstream ifs{file_path.data()};
+        nlohmann::json root_json = nlohmann::json::parse(ifs);
+        std::filesystem::path const cur_dir =
+            std::filesystem::path{file_path}.parent_path();
+        std::vector<render_job> jobs{};
+        for (auto const& val : root_json.at("/jobs"_json_pointer)) {
+            render_job job{};
+            std::string const scene_file = val.at("/scene"_json_pointer);
+            std::string const output_file = val.at("/output"_json_pointer);
+            job.scene_file = (cur_dir / scene_file).string();
+            job.output_file = (cur_dir / output_file).string();
+            if (val.contains("/camera"_json_pointer)) {
+                glm::vec3 const lookfrom{
+                    val.at("/camera/lookfrom/0"_json_pointer),
+                    val.at("/camera/lookfrom/1"_json_pointer),
+                    val.at("/camera/lookfrom/2"_json_pointer),
+                };
+                glm::vec3 const lookat{
+                    val.at("/camera/lookat/0"_json_pointer),
+                    val.at("/camera/lookat/1"_json_pointer),
+                    val.at("/camera/lookat/2"_json_pointer),
+                };
+                float const fov = val.at("/camera/fov"_json_pointer);
+                job.camera = create_camera(lookfrom, lookat, fov);
+            }
+            if (val.contains("/resolution"_json_pointer)) {
+                job.resolution = std::array<uint32_t, 2>{
+                    val.at("/resolution/0"_json_pointer),
+                    val.at("/resolution/1"_json_pointer),
+                };
+            }
+            if (val.contains("/seed"_json_pointer)) {
+                job.seed = val.at("/seed"_json_pointer).get<uint32_t>();
+            }
+            job.samples_per_pixel = val.value("/spp"_json_pointer, 0u);
+            job.time_limit_seconds =
+                val.value("/time_limit"_json_pointer, 0.0f);
+            if (job.samples_per_pixel == 0 && job.time_limit_seconds <= 0.0f) {
+                job.samples_per_pixel = default_samples_per_pixel;
+                job.time_limit_seconds = default_time_limit_seconds;
+            }
+            jobs.push_back(job);
+        }
+        return jobs;
+    } catch (std::exception& exp) {
+        CHECK(false, "{}", exp.what());
+    }
+}
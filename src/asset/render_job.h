@@ -0,0 +1,31 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#include "asset/camera.h"
+
+// One image of a batch, anything left unset falls back to the scene file.
+struct render_job {
+    std::string scene_file;
+    std::string output_file;
+    std::optional<struct camera> camera;
+    std::optional<std::array<uint32_t, 2>> resolution;
+    std::optional<uint32_t> seed;
+    // accumulation stops at whichever target is met first, 0 disables one
+    uint32_t samples_per_pixel = 0;
+    float time_limit_seconds = 0.0f;
+    // the accumulation is saved next to the output this often, 0 disables it
+    float checkpoint_interval_seconds = 0.0f;
+    // continue from the checkpoint next to the output if there is one
+    bool resume = false;
+};
+
+// Relative scene and output paths are resolved against the job file, jobs
+// without a sample target or time limit take the given defaults.
+std::vector<render_job> load_render_jobs(std::string_view file_path,
+    uint32_t default_samples_per_pixel, float default_time_limit_seconds);
@@ -3,6 +3,7 @@
 #include "asset/texture.h"
 
 #include <tuple>
+#include <cstdlib>
 #include <fstream>
 #include <unordered_map>
 #include <filesystem>
@@ -15,14 +16,6 @@
 
 #pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
 
-inline float luminance(float r, float g, float b) {
-    return 0.212671f * r + 0.715160f * g + 0.072169f * b;
-}
-
-inline float unorm_to_float(unsigned char c) {
-    return (float) c / 255.0f;
-}
-
 inline float triangle_area(vertex const& a, vertex const& b, vertex const& c) {
     glm::vec3 const e1 =
         glm::vec3{b.position_texu} - glm::vec3{a.position_texu};
@@ -31,8 +24,70 @@ inline float triangle_area(vertex const& a, vertex const& b, vertex const& c) {
     return 0.5f * glm::length(glm::cross(e1, e2));
 }
 
+static light_sampling_mode get_light_sampling_mode(std::string const& name) {
+    if (name == "uniform") {
+        return light_sampling_mode::uniform;
+    }
+    if (name == "power") {
+        return light_sampling_mode::power;
+    }
+    CHECK(name == "bvh", "Unknown light sampling {}", name);
+    return light_sampling_mode::bvh;
+}
+
+static sampler_type get_sampler_type(std::string const& name) {
+    if (name == "random") {
+        return sampler_type::random;
+    }
+    CHECK(name == "sobol", "Unknown sampler {}", name);
+    return sampler_type::sobol;
+}
+
+static uint32_t get_aovs(std::vector<std::string> const& names) {
+    uint32_t aovs = 0;
+    for (std::string const& name : names) {
+        if (name == "albedo") {
+            aovs |= AOV_ALBEDO;
+        } else if (name == "normal") {
+            aovs |= AOV_NORMAL;
+        } else if (name == "depth") {
+            aovs |= AOV_DEPTH;
+        } else if (name == "direct") {
+            aovs |= AOV_DIRECT;
+        } else if (name == "indirect") {
+            aovs |= AOV_INDIRECT;
+        } else if (name == "emission") {
+            aovs |= AOV_EMISSION;
+        } else {
+            CHECK(name == "sample_count", "Unknown AOV {}", name);
+            aovs |= AOV_SAMPLE_COUNT;
+        }
+    }
+    return aovs;
+}
+
+static mesh const& load_cached_mesh(
+    asset_cache& cache, std::string const& full_path) {
+    auto iter = cache.meshes.find(full_path);
+    if (iter == cache.meshes.end()) {
+        iter = cache.meshes.emplace(full_path, load_mesh(full_path)).first;
+    }
+    return iter->second;
+}
+
+static texture_data load_cached_texture(
+    asset_cache& cache, std::string const& full_path) {
+    auto iter = cache.textures.find(full_path);
+    if (iter == cache.textures.end()) {
+        iter = cache.textures
+                   .emplace(full_path, get_texture_data(full_path))
+                   .first;
+    }
+    return iter->second;
+}
+
 std::tuple<render_options, camera, scene> load_scene(
-    std::string_view file_path) {
+    std::string_view file_path, asset_cache* cache) {
     try {
         std::ifstream ifs{file_path.data()};
         nlohmann::json root_json = nlohmann::json::parse(ifs);
@@ -43,7 +98,31 @@ std::tuple<render_options, camera, scene> load_scene(
             .max_depth = root_json.at("/renderer/max_depth"_json_pointer),
             .tile_width = root_json.at("/renderer/tile/0"_json_pointer),
             .tile_height = root_json.at("/renderer/tile/1"_json_pointer),
+            .seed = root_json.value("/renderer/seed"_json_pointer, 0u),
+            .persistent_threads = root_json.value(
+                "/renderer/persistent_threads"_json_pointer, false),
+            .sort_materials = root_json.value(
+                "/renderer/sort_materials"_json_pointer, false),
+            .light_sampling = get_light_sampling_mode(
+                root_json.value("/renderer/light_sampling"_json_pointer,
+                    std::string{"uniform"})),
+            .sampler = get_sampler_type(root_json.value(
+                "/renderer/sampler"_json_pointer, std::string{"random"})),
+            .denoise =
+                root_json.value("/renderer/denoise"_json_pointer, false),
+            .aovs = get_aovs(root_json.value(
+                "/renderer/aovs"_json_pointer, std::vector<std::string>{})),
+            .adaptive_threshold = root_json.value(
+                "/renderer/adaptive_threshold"_json_pointer, 0.0f),
+            .preview_frame_time = root_json.value(
+                "/renderer/preview_frame_time"_json_pointer, 16.0f),
+            .tile_frame_time = root_json.value(
+                "/renderer/tile_frame_time"_json_pointer, 16.0f),
         };
+        CHECK(options.preview_frame_time > 0.0f,
+            "Preview frame time must be positive");
+        CHECK(options.tile_frame_time > 0.0f,
+            "Tile frame time must be positive");
         CHECK(options.resolution_x % options.tile_width == 0,
             "Window width isn't divisible by tile width");
         CHECK(options.resolution_y % options.tile_height == 0,
@@ -69,7 +148,7 @@ std::tuple<render_options, camera, scene> load_scene(
         std::unordered_map<std::string, int32_t> texture_indices{};
         std::unordered_map<std::string, int32_t> material_indices{};
         std::unordered_map<std::string, int32_t> medium_indices{};
-        auto const get_mesh = [&cur_dir, &mesh_indices, &scene](
+        auto const get_mesh = [&cur_dir, &mesh_indices, &scene, cache](
                                   std::string const& path) -> uint32_t {
             uint32_t id = 0;
             std::filesystem::path full_path =
@@ -78,7 +157,13 @@ std::tuple<render_options, camera, scene> load_scene(
                 iter != mesh_indices.end()) {
                 id = iter->second;
             } else {
-                mesh const mesh = load_mesh(full_path.string().c_str());
+                mesh loaded{};
+                if (!cache) {
+                    loaded = load_mesh(full_path.string().c_str());
+                }
+                mesh const& mesh =
+                    cache ? load_cached_mesh(*cache, full_path.string()) :
+                            loaded;
                 scene.mesh_vertex_start.push_back(
                     (uint32_t) scene.vertices.size());
                 scene.vertices.insert(scene.vertices.end(),
@@ -88,7 +173,7 @@ std::tuple<render_options, camera, scene> load_scene(
             }
             return id;
         };
-        auto const get_texture = [&cur_dir, &texture_indices, &scene](
+        auto const get_texture = [&cur_dir, &texture_indices, &scene, cache](
                                      std::string const& path) -> int32_t {
             int32_t id = -1;
             std::filesystem::path full_path =
@@ -98,7 +183,8 @@ std::tuple<render_options, camera, scene> load_scene(
                 id = iter->second;
             } else {
                 texture_data const data =
-                    get_texture_data(full_path.string().c_str());
+                    cache ? load_cached_texture(*cache, full_path.string()) :
+                            get_texture_data(full_path.string().c_str());
                 scene.textures.push_back(data);
                 id = (int32_t) scene.textures.size() - 1;
                 texture_indices[path] = id;
@@ -358,37 +444,19 @@ std::tuple<render_options, camera, scene> load_scene(
                 root_json.value<std::string>(
                     "/sky_light/environment_tex"_json_pointer, "");
             int32_t environment_tex = -1;
-            float total_luminance = 0.0f;
             uint32_t tex_width = 0;
             uint32_t tex_height = 0;
             if (!environment_map_file.empty()) {
                 environment_tex = get_texture(environment_map_file);
-                texture_data const& tex_data = scene.textures.back();
+                texture_data const& tex_data =
+                    scene.textures[(uint32_t) environment_tex];
                 tex_width = tex_data.width;
                 tex_height = tex_data.height;
-                if (tex_data.format == texture_format::sfloat) {
-                    float const* const p = (float const*) tex_data.data;
-                    for (uint32_t i = 0; i < tex_data.width * tex_data.height;
-                         i += (uint32_t) tex_data.channel) {
-                        total_luminance +=
-                            luminance(p[i + 0], p[i + 1], p[i + 2]);
-                    }
-                } else {
-                    unsigned char const* const p =
-                        (unsigned char const*) tex_data.data;
-                    for (uint32_t i = 0; i < tex_data.width * tex_data.height;
-                         i += (uint32_t) tex_data.channel) {
-                        float const r = unorm_to_float(p[i + 0]);
-                        float const g = unorm_to_float(p[i + 1]);
-                        float const b = unorm_to_float(p[i + 2]);
-                        total_luminance += luminance(r, g, b);
-                    }
-                }
             }
             light const sky{
                 .intensity = intensity,
                 .emission_tex = environment_tex,
-                .direction = glm::vec3{total_luminance, tex_width, tex_height},
+                .direction = glm::vec3{0.0f, tex_width, tex_height},
                 .type = light_type::sky,
             };
             scene.lights.push_back(sky);
@@ -398,3 +466,11 @@ std::tuple<render_options, camera, scene> load_scene(
         CHECK(false, "{}", exp.what());
     }
 }
+
+void free_asset_cache(asset_cache& cache) {
+    for (auto const& [path, texture] : cache.textures) {
+        free(texture.data);
+    }
+    cache.textures.clear();
+    cache.meshes.clear();
+}
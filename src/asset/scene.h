@@ -7,6 +7,9 @@
 #include "asset/camera.h"
 #include "renderer/render_options.h"
 
+#include <string>
+#include <unordered_map>
+
 struct scene {
     std::vector<vertex> vertices;
     std::vector<uint32_t> mesh_vertex_start;
@@ -21,5 +24,15 @@ struct scene {
     std::vector<light> lights;
 };
 
+// Meshes and textures keyed by their full path, scenes loaded through the same
+// cache share them instead of parsing the files again. The cache owns the
+// texture data of those scenes.
+struct asset_cache {
+    std::unordered_map<std::string, mesh> meshes;
+    std::unordered_map<std::string, texture_data> textures;
+};
+
 std::tuple<render_options, camera, scene> load_scene(
-    std::string_view file_path);
+    std::string_view file_path, asset_cache* cache = nullptr);
+
+void free_asset_cache(asset_cache& cache);
@@ -1,38 +1,144 @@
 #include "renderer/renderer.h"
 #include "renderer/render_context.h"
+#include "renderer/offline.h"
+#include "renderer/distributed.h"
+#include "renderer/render_thread.h"
+#include "renderer/gpu_profiler.h"
 #include "renderer/bvh.h"
 
+#include "window.h"
 #include "utils/file.h"
 #include "utils/high_resolution_clock.h"
+#include "utils/command_line.h"
 #include "asset/camera.h"
 #include "asset/scene.h"
+#include "asset/render_job.h"
+#include "asset/camera_path.h"
 
 #pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
+static void load_renderer(renderer& renderer, std::string const& name) {
+    if (name == "wavefront") {
+        load_wavefront_raytracer(renderer);
+    } else {
+        load_megakernel_raytracer(renderer);
+    }
+}
+
+// dumps once per press of F12, not every frame it is held
+static void dump_profile_on_key(std::string const& profile_file) {
+    static bool pressed = false;
+    bool const down = glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+    if (down && !pressed) {
+        dump_gpu_profile(profile_file);
+    }
+    pressed = down;
+}
+
 int main(int argc, char* argv[]) {
-    std::string_view const scene_file =
-        argc == 2 ? argv[1] : PATH_FROM_ROOT("assets/hyperion_rect_light.json");
-    auto [render_options, camera, scene] = load_scene(scene_file);
+    command_line const command_line = parse_command_line(argc, argv);
+    if (!command_line.render_file.empty() &&
+        (command_line.local_workers != 0 ||
+            !command_line.listen_address.empty())) {
+        run_coordinator(command_line);
+        return 0;
+    }
+    if (!command_line.coordinator_address.empty()) {
+        renderer renderer{};
+        load_renderer(renderer, command_line.renderer);
+        create_render_context(true);
+        run_worker(renderer, command_line);
+        renderer.destroy();
+        destroy_render_context();
+        return 0;
+    }
+    if (!command_line.render_file.empty() || !command_line.job_file.empty() ||
+        !command_line.sequence_file.empty()) {
+        render_job job{};
+        job.scene_file = command_line.scene_file;
+        job.output_file = command_line.sequence_file.empty() ?
+                              command_line.render_file :
+                              command_line.sequence_file;
+        job.seed = command_line.seed;
+        job.samples_per_pixel = command_line.samples_per_pixel;
+        job.time_limit_seconds = command_line.time_limit_seconds;
+        job.checkpoint_interval_seconds =
+            command_line.checkpoint_interval_seconds;
+        job.resume = command_line.resume;
+        renderer renderer{};
+        load_renderer(renderer, command_line.renderer);
+        create_render_context(true, !command_line.profile_file.empty());
+        if (!command_line.sequence_file.empty()) {
+            camera_path const path =
+                load_camera_path(command_line.camera_path_file.empty() ?
+                                     command_line.scene_file :
+                                     command_line.camera_path_file);
+            render_sequence(renderer, job, path);
+        } else if (!command_line.job_file.empty()) {
+            std::vector<render_job> jobs = load_render_jobs(
+                command_line.job_file, command_line.samples_per_pixel,
+                command_line.time_limit_seconds);
+            for (auto& batch_job : jobs) {
+                batch_job.checkpoint_interval_seconds =
+                    job.checkpoint_interval_seconds;
+                batch_job.resume = job.resume;
+            }
+            render_jobs(renderer, jobs);
+        } else {
+            render_jobs(renderer, std::span{&job, 1});
+        }
+        wait_vulkan();
+        collect_gpu_profile();
+        dump_gpu_profile(command_line.profile_file);
+        renderer.destroy();
+        destroy_render_context();
+        return 0;
+    }
+    auto [render_options, camera, scene] = load_scene(command_line.scene_file);
+    if (command_line.seed.has_value()) {
+        render_options.seed = command_line.seed.value();
+    }
     win_width = render_options.resolution_x;
     win_height = render_options.resolution_y;
     renderer renderer{};
-    load_megakernel_raytracer(renderer);
-    create_render_context();
+    load_renderer(renderer, command_line.renderer);
+    bool const profiling = !command_line.profile_file.empty();
+    create_render_context(false, profiling);
     renderer.initialize(render_options);
     renderer.prepare_data(scene);
     high_resolution_clock clock{};
     clock.tick();
+    // renderers without a render thread record both queues every frame
+    bool const render_thread = renderer.accumulate != nullptr;
+    if (render_thread) {
+        start_render_thread(renderer, scene, camera);
+        camera.dirty = false;
+    }
     while (!window_should_close()) {
         clock.tick();
         update_camera(window, camera, clock.get_delta_seconds());
-        renderer.update_data(scene);
+        if (render_thread) {
+            update_render_thread(camera);
+        } else {
+            renderer.update_data(scene);
+        }
         renderer.render(camera);
-        submit_command_buffer(vk::PipelineBindPoint::eCompute);
+        if (!render_thread) {
+            submit_command_buffer(vk::PipelineBindPoint::eCompute);
+        }
         submit_command_buffer(vk::PipelineBindPoint::eGraphics);
         renderer.present();
         poll_window_event();
+        if (profiling) {
+            dump_profile_on_key(command_line.profile_file);
+        }
         camera.dirty = false;
     }
+    if (render_thread) {
+        stop_render_thread();
+    }
     wait_vulkan();
+    collect_gpu_profile();
+    dump_gpu_profile(command_line.profile_file);
     renderer.destroy();
     destroy_render_context();
     for (auto const& t : scene.textures) {
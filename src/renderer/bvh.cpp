@@ -12,6 +12,11 @@ bvh_tree_node* build_bvh_recursive(std::vector<bvh_tree_node>& all_nodes,
 
 static uint32_t flatten_bvh(std::vector<bvh_linear_node>& linear_nodes,
     bvh_tree_node* node, uint32_t& offset);
+static uint32_t get_bvh_depth(bvh_tree_node const* node);
+
+// twice the fixed stack each level had before they shared one, a deeper scene
+// would spill too much of it to scratch memory
+static uint32_t constexpr MAX_TRAVERSAL_STACK_SIZE = 126;
 
 bvh create_bvh(scene const& scene) {
     CHECK(scene.vertices.size() % 3 == 0, "");
@@ -95,6 +100,8 @@ bvh create_bvh(scene const& scene) {
     tlas_linear_nodes.resize(tlas_nodes.size());
     uint32_t tlas_linear_node_offset = 0;
     flatten_bvh(tlas_linear_nodes, root, tlas_linear_node_offset);
+    uint32_t const tlas_depth = get_bvh_depth(root);
+    uint32_t blas_depth = 0;
     // BLAS
     std::vector<bvh_tree_node> blas_nodes{};
     std::vector<glsl_triangle> sorted_triangles{};
@@ -113,6 +120,7 @@ bvh create_bvh(scene const& scene) {
         uint32_t blas_linear_node_offset = blas_node_count_before;
         blas_linear_nodes.resize(blas_nodes.size());
         flatten_bvh(blas_linear_nodes, mesh_root, blas_linear_node_offset);
+        blas_depth = std::max(blas_depth, get_bvh_depth(mesh_root));
         meshes.push_back(glsl_mesh{
             .triangle_offset = scene.mesh_vertex_start[m] / 3,
             .triangle_count = mesh_vertex_count[m] / 3,
@@ -120,7 +128,17 @@ bvh create_bvh(scene const& scene) {
         });
     }
     return bvh{tlas_linear_nodes, blas_linear_nodes, meshes, sorted_instances,
-        sorted_triangles};
+        sorted_triangles, tlas_depth, blas_depth};
+}
+
+uint32_t get_traversal_stack_size(bvh const& bvh) {
+    uint32_t const size = bvh.tlas_depth + bvh.blas_depth;
+    CHECK(size <= MAX_TRAVERSAL_STACK_SIZE,
+        "The TLAS of depth {} and a BLAS of depth {} exceed the traversal "
+        "stack of {} entries",
+        bvh.tlas_depth, bvh.blas_depth, MAX_TRAVERSAL_STACK_SIZE);
+    // a scene of a single leaf pushes nothing
+    return std::max(size, 1u);
 }
 
 template <typename OBJ>
@@ -270,3 +288,10 @@ static uint32_t flatten_bvh(std::vector<bvh_linear_node>& linear_nodes,
     }
     return node_offset;
 }
+
+static uint32_t get_bvh_depth(bvh_tree_node const* node) {
+    if (node->obj_count > 0) {
+        return 0;
+    }
+    return 1 + std::max(get_bvh_depth(node->left), get_bvh_depth(node->right));
+}
@@ -62,6 +62,14 @@ struct bvh {
     std::vector<glsl_mesh> meshes{};
     std::vector<glsl_instance> instances{};
     std::vector<glsl_triangle> triangles{};
+    // interior nodes on the deepest path of the TLAS and of any BLAS, each of
+    // them pushes its farther child during traversal
+    uint32_t tlas_depth = 0;
+    uint32_t blas_depth = 0;
 };
 
 bvh create_bvh(scene const& scene);
+
+// Entries the traversal stack of scene.glsl needs for the TLAS and the deepest
+// BLAS below it, which specialize the raytracing kernels.
+uint32_t get_traversal_stack_size(bvh const& bvh);
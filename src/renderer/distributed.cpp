@@ -0,0 +1,447 @@
+#include "check.h"
+#include "asset/scene.h"
+#include "asset/checkpoint.h"
+#include "asset/image_writer.h"
+#include "renderer/distributed.h"
+#include "renderer/render_context.h"
+#include "utils/socket.h"
+#include "utils/high_resolution_clock.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <optional>
+#include <algorithm>
+#include <filesystem>
+
+#if !defined(_WIN32)
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
+
+enum class message_type : uint32_t {
+    hello,     // worker -> coordinator: protocol version
+    setup,     // coordinator -> worker: seed and scene file
+    job,       // coordinator -> worker: tile and sample range
+    result,    // worker -> coordinator: job and the sums of its tile
+    shutdown,  // coordinator -> worker
+};
+
+static uint32_t constexpr PROTOCOL_VERSION = 2;
+// samples of one job, small enough to balance workers and large enough to
+// hide the round trip
+static uint32_t constexpr SAMPLES_PER_JOB = 16;
+// jobs in flight per worker, so a worker never waits for its next job
+static uint32_t constexpr JOBS_PER_WORKER = 2;
+// the merged image is written out this often while jobs are running,
+// --checkpoint saves what --resume continues from
+static float constexpr INTERMEDIATE_IMAGE_SECONDS = 30.0f;
+
+struct distributed_job {
+    uint32_t id;
+    render_region region;
+    uint32_t sample_count;
+};
+
+struct setup_message {
+    uint32_t seed;
+    uint32_t scene_file_size;
+};
+
+// followed by the summed rgb of every pixel of the tile with its sample count
+// in alpha, converged pixels of adaptive sampling take fewer
+struct result_message {
+    uint32_t job_id;
+};
+
+template <typename T>
+static void append_bytes(std::vector<uint8_t>& bytes, T const& value) {
+    uint8_t const* const begin = (uint8_t const*) &value;
+    bytes.insert(bytes.end(), begin, begin + sizeof(T));
+}
+
+template <typename T>
+static T read_bytes(std::vector<uint8_t> const& bytes, size_t offset) {
+    CHECK(offset + sizeof(T) <= bytes.size(), "Truncated message");
+    T value{};
+    std::memcpy(&value, bytes.data() + offset, sizeof(T));
+    return value;
+}
+
+struct worker_connection {
+    int socket;
+    bool ready;
+    std::vector<uint32_t> jobs;  // in flight
+};
+
+static void spawn_local_workers(command_line const& command_line,
+    std::string const& address, std::vector<int>& children);
+static void wait_local_workers(std::vector<int> const& children);
+static void write_merged_image(command_line const& command_line,
+    render_options const& options, std::vector<float> const& sums);
+
+#if !defined(_WIN32)
+static void spawn_local_workers(command_line const& command_line,
+    std::string const& address, std::vector<int>& children) {
+    std::string const worker_option = "--worker";
+    std::string const renderer_option = "--renderer";
+    std::vector<char*> const argv{
+        const_cast<char*>(command_line.executable.c_str()),
+        const_cast<char*>(worker_option.c_str()),
+        const_cast<char*>(address.c_str()),
+        const_cast<char*>(renderer_option.c_str()),
+        const_cast<char*>(command_line.renderer.c_str()),
+        nullptr,
+    };
+    for (uint32_t w = 0; w < command_line.local_workers; ++w) {
+        pid_t child = 0;
+        int const result = posix_spawn(&child,
+            command_line.executable.c_str(), nullptr, nullptr, argv.data(),
+            environ);
+        CHECK(result == 0, "Can't spawn worker: {}", strerror(result));
+        children.push_back(child);
+    }
+}
+
+static void wait_local_workers(std::vector<int> const& children) {
+    for (int const child : children) {
+        waitpid(child, nullptr, 0);
+    }
+}
+#else
+static void spawn_local_workers(
+    command_line const& command_line, std::string const&, std::vector<int>&) {
+    CHECK(command_line.local_workers == 0,
+        "Local workers need posix process spawning");
+}
+
+static void wait_local_workers(std::vector<int> const&) {
+}
+#endif
+
+static void write_merged_image(command_line const& command_line,
+    render_options const& options, std::vector<float> const& sums) {
+    std::vector<float> pixels(sums.size());
+    for (size_t p = 0; p < pixels.size(); p += 4) {
+        float const scalar = sums[p + 3] > 0.0f ? 1.0f / sums[p + 3] : 0.0f;
+        pixels[p + 0] = scalar * sums[p + 0];
+        pixels[p + 1] = scalar * sums[p + 1];
+        pixels[p + 2] = scalar * sums[p + 2];
+        pixels[p + 3] = 1.0f;
+    }
+    write_image(command_line.render_file, options.resolution_x,
+        options.resolution_y, pixels);
+}
+
+void run_coordinator(command_line const& command_line) {
+    CHECK(command_line.samples_per_pixel != 0,
+        "A distributed render needs a sample target");
+    asset_cache cache{};
+    auto [options, camera, scene] = load_scene(command_line.scene_file, &cache);
+    free_asset_cache(cache);
+    uint32_t const seed = command_line.seed.value_or(options.seed);
+    // sample ranges are outermost, so every tile is refined evenly, the ids
+    // only depend on the options and the sample target
+    std::vector<distributed_job> jobs{};
+    for (uint32_t s = 0; s < command_line.samples_per_pixel;
+         s += SAMPLES_PER_JOB) {
+        for (uint32_t y = 0; y < options.resolution_y;
+             y += options.tile_height) {
+            for (uint32_t x = 0; x < options.resolution_x;
+                 x += options.tile_width) {
+                distributed_job const job{
+                    .id = (uint32_t) jobs.size(),
+                    .region =
+                        render_region{
+                            .x = x,
+                            .y = y,
+                            .width = options.tile_width,
+                            .height = options.tile_height,
+                            .first_sample = s,
+                        },
+                    .sample_count = std::min(SAMPLES_PER_JOB,
+                        command_line.samples_per_pixel - s),
+                };
+                jobs.push_back(job);
+            }
+        }
+    }
+    uint32_t const pixel_count = options.resolution_x * options.resolution_y;
+    // summed rgb with the sample count in alpha
+    std::vector<float> sums(4 * (size_t) pixel_count, 0.0f);
+    std::vector<bool> finished(jobs.size(), false);
+    std::vector<uint32_t> finished_ids{};
+    bool const checkpointing = command_line.checkpoint_interval_seconds > 0.0f;
+    std::string const checkpoint_file =
+        command_line.render_file + ".checkpoint";
+    uint64_t const setup_hash =
+        checkpointing || command_line.resume ?
+            hash_render_setup(command_line.scene_file, options, camera,
+                command_line.samples_per_pixel) :
+            0;
+    if (command_line.resume) {
+        std::optional<checkpoint> resumed = read_checkpoint(checkpoint_file,
+            setup_hash, options.resolution_x, options.resolution_y, seed);
+        if (resumed.has_value()) {
+            sums = std::move(resumed->accumulation.sums);
+            for (uint32_t const id : resumed->finished_jobs) {
+                if (id < jobs.size() && !finished[id]) {
+                    finished[id] = true;
+                    finished_ids.push_back(id);
+                }
+            }
+            fmt::println("Resumed {} with {}/{} jobs done",
+                command_line.render_file, finished_ids.size(), jobs.size());
+        }
+    }
+    std::deque<distributed_job> queue{};
+    for (distributed_job const& job : jobs) {
+        if (!finished[job.id]) {
+            queue.push_back(job);
+        }
+    }
+    std::string const address = command_line.listen_address.empty() ?
+                                    get_private_socket_address() :
+                                    command_line.listen_address;
+    int const listener = listen_socket(address);
+    std::vector<int> children{};
+    spawn_local_workers(command_line, address, children);
+    fmt::println("Coordinating {} jobs on {}", queue.size(), address);
+    std::vector<uint8_t> setup{};
+    append_bytes(setup, setup_message{
+                            .seed = seed,
+                            .scene_file_size =
+                                (uint32_t) command_line.scene_file.size(),
+                        });
+    setup.insert(setup.end(), command_line.scene_file.begin(),
+        command_line.scene_file.end());
+    std::vector<worker_connection> workers{};
+    high_resolution_clock clock{};
+    float last_intermediate_image = 0.0f;
+    float last_checkpoint = 0.0f;
+    float merged_samples = 0.0f;
+    auto const dispatch = [&](worker_connection& worker) {
+        while (worker.ready && worker.jobs.size() < JOBS_PER_WORKER &&
+               !queue.empty()) {
+            distributed_job const job = queue.front();
+            queue.pop_front();
+            std::vector<uint8_t> bytes{};
+            append_bytes(bytes, job);
+            if (!send_message(worker.socket, (uint32_t) message_type::job,
+                    bytes)) {
+                queue.push_front(job);
+                return;
+            }
+            worker.jobs.push_back(job.id);
+        }
+    };
+    // hands the jobs of a lost or rejected worker to the others
+    auto const drop = [&](worker_connection& worker) {
+        for (uint32_t const id : worker.jobs) {
+            queue.push_front(jobs[id]);
+        }
+        close_socket(worker.socket);
+        worker.socket = -1;
+    };
+    // only the jobs in flight on the worker are merged, a result of another
+    // job or of a wrong size rejects the worker instead
+    auto const merge = [&](worker_connection const& worker,
+                           std::vector<uint8_t> const& bytes)
+        -> std::optional<uint32_t> {
+        if (bytes.size() < sizeof(result_message)) {
+            fmt::println("Rejected a worker sending a truncated result");
+            return std::nullopt;
+        }
+        result_message const result = read_bytes<result_message>(bytes, 0);
+        if (std::find(worker.jobs.begin(), worker.jobs.end(), result.job_id) ==
+            worker.jobs.end()) {
+            fmt::println("Rejected a worker sending job {}, which it wasn't "
+                         "given",
+                result.job_id);
+            return std::nullopt;
+        }
+        render_region const& region = jobs[result.job_id].region;
+        if (bytes.size() != sizeof(result_message) + 4 * sizeof(float) *
+                                                         region.width *
+                                                         region.height) {
+            fmt::println("Rejected a worker sending job {} of a wrong size",
+                result.job_id);
+            return std::nullopt;
+        }
+        float const* const tile =
+            (float const*) (bytes.data() + sizeof(result_message));
+        for (uint32_t y = 0; y < region.height; ++y) {
+            for (uint32_t x = 0; x < region.width; ++x) {
+                size_t const src = (size_t) y * region.width + x;
+                size_t const dst = (size_t) (region.y + y) *
+                                       options.resolution_x +
+                                   region.x + x;
+                for (uint32_t c = 0; c < 4; ++c) {
+                    sums[4 * dst + c] += tile[4 * src + c];
+                }
+            }
+        }
+        merged_samples += (float) jobs[result.job_id].sample_count *
+                          (float) region.width * (float) region.height;
+        finished[result.job_id] = true;
+        finished_ids.push_back(result.job_id);
+        return std::optional<uint32_t>{result.job_id};
+    };
+    while (finished_ids.size() < jobs.size()) {
+        std::vector<int> sockets{listener};
+        for (auto const& worker : workers) {
+            sockets.push_back(worker.socket);
+        }
+        std::vector<bool> const readable = wait_readable(sockets);
+        if (readable[0]) {
+            workers.push_back(worker_connection{
+                .socket = accept_socket(listener),
+                .ready = false,
+                .jobs = {},
+            });
+        }
+        for (size_t w = 0; w + 1 < readable.size(); ++w) {
+            if (!readable[w + 1]) {
+                continue;
+            }
+            worker_connection& worker = workers[w];
+            uint32_t type = 0;
+            std::vector<uint8_t> bytes{};
+            if (!receive_message(worker.socket, type, bytes)) {
+                drop(worker);
+                continue;
+            }
+            if (type == (uint32_t) message_type::hello) {
+                uint32_t const version = bytes.size() < sizeof(uint32_t) ?
+                                             0 :
+                                             read_bytes<uint32_t>(bytes, 0);
+                if (version != PROTOCOL_VERSION) {
+                    fmt::println("Rejected a worker of protocol version {}",
+                        version);
+                    drop(worker);
+                    continue;
+                }
+                worker.ready = send_message(
+                    worker.socket, (uint32_t) message_type::setup, setup);
+            } else if (type == (uint32_t) message_type::result) {
+                std::optional<uint32_t> const id = merge(worker, bytes);
+                if (!id.has_value()) {
+                    drop(worker);
+                    continue;
+                }
+                std::erase(worker.jobs, id.value());
+            }
+        }
+        std::erase_if(workers,
+            [](worker_connection const& worker) { return worker.socket < 0; });
+        for (auto& worker : workers) {
+            dispatch(worker);
+        }
+        clock.tick();
+        if (clock.get_total_seconds() - last_intermediate_image >=
+            INTERMEDIATE_IMAGE_SECONDS) {
+            last_intermediate_image = clock.get_total_seconds();
+            write_merged_image(command_line, options, sums);
+            fmt::println("{}/{} jobs done, wrote intermediate image {}",
+                finished_ids.size(), jobs.size(), command_line.render_file);
+        }
+        // the counts of the pixels are in the alpha of the sums, the finished
+        // jobs are saved alongside so a resume only requeues the others
+        if (checkpointing && clock.get_total_seconds() - last_checkpoint >=
+                                 command_line.checkpoint_interval_seconds) {
+            last_checkpoint = clock.get_total_seconds();
+            write_checkpoint(checkpoint_file,
+                checkpoint{
+                    .setup_hash = setup_hash,
+                    .width = options.resolution_x,
+                    .height = options.resolution_y,
+                    .seed = seed,
+                    .accumulation =
+                        accumulation{
+                            .sums = sums,
+                            .sample_count = 0,
+                            .traced_rays = 0,
+                        },
+                    .finished_jobs = finished_ids,
+                });
+        }
+    }
+    for (auto const& worker : workers) {
+        send_message(worker.socket, (uint32_t) message_type::shutdown, {});
+        close_socket(worker.socket);
+    }
+    close_listener(listener, address);
+    wait_local_workers(children);
+    clock.tick();
+    write_merged_image(command_line, options, sums);
+    if (checkpointing) {
+        // the image is complete, a later resume starts over
+        std::filesystem::remove(checkpoint_file);
+    }
+    float const seconds = clock.get_total_seconds();
+    fmt::println("Rendered {}x{} at {} spp in {:.3f} s, {:.2f} Msamples/s",
+        options.resolution_x, options.resolution_y,
+        command_line.samples_per_pixel, seconds,
+        1e-6f * merged_samples / seconds);
+}
+
+void run_worker(renderer const& renderer, command_line const& command_line) {
+    CHECK(renderer.set_region && renderer.request_read_back &&
+              renderer.fetch_accumulation,
+        "The renderer can't render jobs");
+    int const socket = connect_socket(command_line.coordinator_address);
+    std::vector<uint8_t> hello{};
+    append_bytes(hello, PROTOCOL_VERSION);
+    CHECK(send_message(socket, (uint32_t) message_type::hello, hello),
+        "Coordinator hung up");
+    asset_cache cache{};
+    struct camera camera{};
+    uint32_t type = 0;
+    std::vector<uint8_t> bytes{};
+    while (receive_message(socket, type, bytes)) {
+        if (type == (uint32_t) message_type::setup) {
+            setup_message const setup = read_bytes<setup_message>(bytes, 0);
+            CHECK(bytes.size() == sizeof(setup) + setup.scene_file_size,
+                "Truncated setup message");
+            std::string const scene_file{
+                (char const*) bytes.data() + sizeof(setup),
+                setup.scene_file_size};
+            auto [options, scene_camera, scene] =
+                load_scene(scene_file, &cache);
+            options.seed = setup.seed;
+            camera = scene_camera;
+            renderer.initialize(options);
+            renderer.prepare_data(scene);
+        } else if (type == (uint32_t) message_type::job) {
+            distributed_job const job = read_bytes<distributed_job>(bytes, 0);
+            renderer.set_region(job.region);
+            camera.dirty = true;
+            for (uint32_t s = 0; s < job.sample_count; ++s) {
+                renderer.render(camera);
+                submit_command_buffer(vk::PipelineBindPoint::eCompute);
+                camera.dirty = false;
+            }
+            std::vector<float> const tile =
+                renderer.fetch_accumulation(renderer.request_read_back()).sums;
+            std::vector<uint8_t> result{};
+            result.reserve(
+                sizeof(result_message) + tile.size() * sizeof(float));
+            append_bytes(result, result_message{.job_id = job.id});
+            uint8_t const* const tile_bytes = (uint8_t const*) tile.data();
+            result.insert(result.end(), tile_bytes,
+                tile_bytes + tile.size() * sizeof(float));
+            if (!send_message(
+                    socket, (uint32_t) message_type::result, result)) {
+                break;
+            }
+        } else if (type == (uint32_t) message_type::shutdown) {
+            break;
+        }
+    }
+    close_socket(socket);
+    free_asset_cache(cache);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "renderer/renderer.h"
+#include "utils/command_line.h"
+
+// The coordinator splits the render of --render into jobs of one tile and a
+// range of samples, hands them to worker processes and merges the returned
+// accumulation tiles. It loads the scene for its options only and needs no
+// device, workers render on a headless render context.
+void run_coordinator(command_line const& command_line);
+
+void run_worker(renderer const& renderer, command_line const& command_line);
@@ -0,0 +1,412 @@
+#include "renderer/gpu_profiler.h"
+
+#include <map>
+#include <array>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <string_view>
+#include <numeric>
+#include <fstream>
+#include <optional>
+#include <algorithm>
+
+#include "check.h"
+#include "renderer/render_context.h"
+#include "utils/to_span.h"
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#include "nlohmann/json.hpp"
+#pragma clang diagnostic pop
+
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+#pragma clang diagnostic ignored "-Wglobal-constructors"
+
+static uint32_t constexpr MAX_GPU_SCOPE = 256;  // per command buffer
+static uint32_t constexpr ROLLING_SAMPLE = 240;  // per scope
+static size_t constexpr MAX_TRACE_EVENT = 1 << 16;
+
+// The scopes recorded into the command buffers in flight of a queue, only
+// touched by the thread recording the queue.
+struct profiled_queue {
+    vk::QueryPool timestamps;  // two per scope
+    vk::QueryPool statistics;  // one per scope, if counting
+    uint64_t timestamp_mask = 0;
+    uint32_t index = 0;  // of the command buffer being recorded
+    std::array<std::vector<char const*>, FRAME_IN_FLIGHT> scopes;
+    std::array<uint64_t, FRAME_IN_FLIGHT> serials{};
+    bool open = false;
+    bool dropped = false;  // the open scope has no queries
+    // milliseconds of the scopes the latest collection read
+    std::vector<std::pair<char const*, float>> collected;
+};
+
+struct scope_statistics {
+    std::deque<float> milliseconds;  // the last ROLLING_SAMPLE samples
+    std::deque<uint64_t> invocations;
+    uint64_t count = 0;
+};
+
+struct trace_event {
+    char const* name;
+    uint32_t queue;
+    uint64_t serial;
+    uint64_t begin;  // in timestamp ticks
+    float milliseconds;
+    uint64_t invocations;
+};
+
+static uint32_t get_queue_idx(vk::PipelineBindPoint bind_point);
+static void collect_command_buffer(uint32_t queue_idx, uint32_t sync_idx);
+static std::string get_chrome_trace();
+static std::string get_statistics_csv();
+
+static std::array<char const*, 2> constexpr QUEUE_NAMES{"graphics", "compute"};
+
+// both queues have timestamps, the scopes are timed
+static bool timing = false;
+// the timed scopes are kept for dumps
+static bool profiling = false;
+// the profile counts invocations with pipeline statistics queries
+static bool counting = false;
+static float timestamp_period = 0.0f;  // nanoseconds per tick
+static std::array<profiled_queue, 2> profiled_queues{};
+static std::atomic<uint64_t> dropped_scopes = 0;
+// the collected results of both queues, guarded by statistics_mutex
+static std::mutex statistics_mutex{};
+static std::map<std::pair<uint32_t, std::string>, scope_statistics>
+    statistics{};
+static std::deque<trace_event> trace_events{};
+static std::optional<uint64_t> first_timestamp{};
+
+void create_gpu_profiler(bool profile) {
+    vk::Result result;
+    std::vector<vk::QueueFamilyProperties> const families =
+        physical_device.getQueueFamilyProperties();
+    std::array const family_indices{
+        command_queues.graphics_queue_idx,
+        command_queues.compute_queue_idx,
+    };
+    std::array<vk::QueryPipelineStatisticFlags, 2> const statistic_flags{
+        vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations,
+        vk::QueryPipelineStatisticFlagBits::eComputeShaderInvocations,
+    };
+    for (uint32_t q = 0; q < profiled_queues.size(); ++q) {
+        if (families[family_indices[q]].timestampValidBits == 0) {
+            fmt::println("The {} queue has no timestamps, the GPU work is "
+                         "neither budgeted nor profiled",
+                QUEUE_NAMES[q]);
+            return;
+        }
+    }
+    timestamp_period = physical_device.getProperties().limits.timestampPeriod;
+    // the render context asked for the feature of a profile where the device
+    // has it
+    counting = profile && physical_device.getFeatures()
+                                  .pipelineStatisticsQuery == vk::True;
+    if (profile && !counting) {
+        fmt::println("The device has no pipeline statistics queries, the GPU "
+                     "profile has timestamps only");
+    }
+    for (uint32_t q = 0; q < profiled_queues.size(); ++q) {
+        uint32_t const valid_bits =
+            families[family_indices[q]].timestampValidBits;
+        profiled_queue& queue = profiled_queues[q];
+        queue.timestamp_mask = valid_bits == 64 ?
+                                   ~uint64_t{0} :
+                                   (uint64_t{1} << valid_bits) - 1;
+        vk::QueryPoolCreateInfo const timestamp_pool_info{
+            .queryType = vk::QueryType::eTimestamp,
+            .queryCount = 2 * MAX_GPU_SCOPE * FRAME_IN_FLIGHT,
+        };
+        VK_CHECK_CREATE(result, queue.timestamps,
+            device.createQueryPool(timestamp_pool_info));
+        if (!counting) {
+            continue;
+        }
+        vk::QueryPoolCreateInfo const statistic_pool_info{
+            .queryType = vk::QueryType::ePipelineStatistics,
+            .queryCount = MAX_GPU_SCOPE * FRAME_IN_FLIGHT,
+            .pipelineStatistics = statistic_flags[q],
+        };
+        VK_CHECK_CREATE(result, queue.statistics,
+            device.createQueryPool(statistic_pool_info));
+    }
+    timing = true;
+    profiling = profile;
+}
+
+void destroy_gpu_profiler() {
+    if (!timing) {
+        return;
+    }
+    for (profiled_queue& queue : profiled_queues) {
+        device.destroyQueryPool(queue.timestamps);
+        if (queue.statistics) {
+            device.destroyQueryPool(queue.statistics);
+        }
+        queue = profiled_queue{};
+    }
+    timing = false;
+    profiling = false;
+    counting = false;
+}
+
+bool is_gpu_timing() {
+    return timing;
+}
+
+void begin_gpu_profile(vk::PipelineBindPoint bind_point, uint32_t sync_idx,
+    uint64_t serial, vk::CommandBuffer command_buffer) {
+    uint32_t const queue_idx = get_queue_idx(bind_point);
+    profiled_queue& queue = profiled_queues[queue_idx];
+    CHECK(!queue.open, "A GPU scope of the {} queue is still open",
+        QUEUE_NAMES[queue_idx]);
+    queue.collected.clear();
+    collect_command_buffer(queue_idx, sync_idx);
+    queue.index = sync_idx;
+    queue.serials[sync_idx] = serial;
+    command_buffer.resetQueryPool(queue.timestamps,
+        2 * MAX_GPU_SCOPE * sync_idx, 2 * MAX_GPU_SCOPE);
+    if (counting) {
+        command_buffer.resetQueryPool(
+            queue.statistics, MAX_GPU_SCOPE * sync_idx, MAX_GPU_SCOPE);
+    }
+}
+
+void begin_gpu_scope(vk::CommandBuffer command_buffer,
+    vk::PipelineBindPoint bind_point, char const* name) {
+    if (!timing) {
+        return;
+    }
+    profiled_queue& queue = profiled_queues[get_queue_idx(bind_point)];
+    CHECK(!queue.open, "GPU scope {} begins inside another scope", name);
+    queue.open = true;
+    std::vector<char const*>& scopes = queue.scopes[queue.index];
+    queue.dropped = scopes.size() == MAX_GPU_SCOPE;
+    if (queue.dropped) {
+        ++dropped_scopes;
+        return;
+    }
+    uint32_t const query =
+        MAX_GPU_SCOPE * queue.index + (uint32_t) scopes.size();
+    scopes.push_back(name);
+    command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe,
+        queue.timestamps, 2 * query);
+    if (counting) {
+        command_buffer.beginQuery(queue.statistics, query, {});
+    }
+}
+
+void end_gpu_scope(
+    vk::CommandBuffer command_buffer, vk::PipelineBindPoint bind_point) {
+    if (!timing) {
+        return;
+    }
+    profiled_queue& queue = profiled_queues[get_queue_idx(bind_point)];
+    CHECK(queue.open, "A GPU scope ends without beginning");
+    queue.open = false;
+    if (queue.dropped) {
+        return;
+    }
+    uint32_t const query = MAX_GPU_SCOPE * queue.index +
+                           (uint32_t) queue.scopes[queue.index].size() - 1;
+    if (counting) {
+        command_buffer.endQuery(queue.statistics, query);
+    }
+    command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+        queue.timestamps, 2 * query + 1);
+}
+
+void collect_gpu_profile() {
+    if (!timing) {
+        return;
+    }
+    std::array const bind_points{
+        vk::PipelineBindPoint::eGraphics,
+        vk::PipelineBindPoint::eCompute,
+    };
+    for (uint32_t q = 0; q < profiled_queues.size(); ++q) {
+        profiled_queue& queue = profiled_queues[q];
+        queue.collected.clear();
+        uint64_t const submitted = get_submission_serial(bind_points[q]);
+        // oldest first, so the trace stays in submission order
+        std::array<uint32_t, FRAME_IN_FLIGHT> order{};
+        std::iota(order.begin(), order.end(), 0u);
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return queue.serials[a] < queue.serials[b];
+        });
+        for (uint32_t const sync_idx : order) {
+            // the command buffer being recorded has nothing to collect yet
+            if (queue.serials[sync_idx] <= submitted) {
+                collect_command_buffer(q, sync_idx);
+            }
+        }
+    }
+}
+
+std::vector<float> get_collected_gpu_times(
+    vk::PipelineBindPoint bind_point, std::string_view name) {
+    std::vector<float> times{};
+    for (auto const& [scope, milliseconds] :
+        profiled_queues[get_queue_idx(bind_point)].collected) {
+        if (scope == name) {
+            times.push_back(milliseconds);
+        }
+    }
+    return times;
+}
+
+void dump_gpu_profile(std::string const& file) {
+    if (!profiling) {
+        return;
+    }
+    std::string text{};
+    {
+        std::lock_guard const lock{statistics_mutex};
+        text = file.ends_with(".json") ? get_chrome_trace() :
+                                         get_statistics_csv();
+    }
+    std::ofstream ofs{file};
+    if (!ofs) {
+        fmt::println("Can't write {}", file);
+        return;
+    }
+    ofs << text;
+    fmt::println("Wrote the GPU profile to {}", file);
+    if (dropped_scopes != 0) {
+        fmt::println("{} GPU scopes beyond {} per command buffer were dropped",
+            dropped_scopes.load(), MAX_GPU_SCOPE);
+    }
+}
+
+static uint32_t get_queue_idx(vk::PipelineBindPoint bind_point) {
+    return bind_point == vk::PipelineBindPoint::eGraphics ? 0 : 1;
+}
+
+// The submission of the command buffer has been made, it has usually finished
+// and its queries are available without waiting.
+static void collect_command_buffer(uint32_t queue_idx, uint32_t sync_idx) {
+    profiled_queue& queue = profiled_queues[queue_idx];
+    std::vector<char const*>& scopes = queue.scopes[sync_idx];
+    if (scopes.empty()) {
+        return;
+    }
+    vk::Result result;
+    uint32_t const count = (uint32_t) scopes.size();
+    std::vector<uint64_t> timestamps(2 * count);
+    std::vector<uint64_t> invocations(count);
+    vk::QueryResultFlags const flags =
+        vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait;
+    VK_CHECK(result,
+        device.getQueryPoolResults(queue.timestamps,
+            2 * MAX_GPU_SCOPE * sync_idx, 2 * count, size_in_byte(timestamps),
+            timestamps.data(), sizeof(uint64_t), flags));
+    if (counting) {
+        VK_CHECK(result,
+            device.getQueryPoolResults(queue.statistics,
+                MAX_GPU_SCOPE * sync_idx, count, size_in_byte(invocations),
+                invocations.data(), sizeof(uint64_t), flags));
+    }
+    std::vector<float> milliseconds(count);
+    for (uint32_t s = 0; s < count; ++s) {
+        uint64_t const ticks =
+            (timestamps[2 * s + 1] - timestamps[2 * s]) & queue.timestamp_mask;
+        milliseconds[s] = 1e-6f * timestamp_period * (float) ticks;
+        queue.collected.emplace_back(scopes[s], milliseconds[s]);
+    }
+    if (!profiling) {
+        scopes.clear();
+        return;
+    }
+    std::lock_guard const lock{statistics_mutex};
+    if (!first_timestamp.has_value()) {
+        first_timestamp = timestamps[0];
+    }
+    for (uint32_t s = 0; s < count; ++s) {
+        scope_statistics& scope = statistics[{queue_idx, scopes[s]}];
+        scope.milliseconds.push_back(milliseconds[s]);
+        scope.invocations.push_back(invocations[s]);
+        if (scope.milliseconds.size() > ROLLING_SAMPLE) {
+            scope.milliseconds.pop_front();
+            scope.invocations.pop_front();
+        }
+        ++scope.count;
+        trace_events.push_back(trace_event{
+            .name = scopes[s],
+            .queue = queue_idx,
+            .serial = queue.serials[sync_idx],
+            .begin = timestamps[2 * s],
+            .milliseconds = milliseconds[s],
+            .invocations = invocations[s],
+        });
+        if (trace_events.size() > MAX_TRACE_EVENT) {
+            trace_events.pop_front();
+        }
+    }
+    scopes.clear();
+}
+
+// One trace thread per queue, the timestamps of both queues share the time
+// domain of the device.
+static std::string get_chrome_trace() {
+    nlohmann::json events = nlohmann::json::array();
+    for (uint32_t q = 0; q < QUEUE_NAMES.size(); ++q) {
+        events.push_back({
+            {"name", "thread_name"},
+            {"ph", "M"},
+            {"pid", 0},
+            {"tid", q},
+            {"args", {{"name", fmt::format("{} queue", QUEUE_NAMES[q])}}},
+        });
+    }
+    for (trace_event const& event : trace_events) {
+        uint64_t const ticks = (event.begin - first_timestamp.value()) &
+                               profiled_queues[event.queue].timestamp_mask;
+        events.push_back({
+            {"name", event.name},
+            {"cat", "gpu"},
+            {"ph", "X"},
+            {"pid", 0},
+            {"tid", event.queue},
+            {"ts", 1e-3 * (double) timestamp_period * (double) ticks},
+            {"dur", 1e3 * (double) event.milliseconds},
+            {"args", {{"serial", event.serial}}},
+        });
+        if (counting) {
+            events.back()["args"]["invocations"] = event.invocations;
+        }
+    }
+    nlohmann::json const trace{
+        {"traceEvents", events},
+        {"displayTimeUnit", "ms"},
+    };
+    return trace.dump();
+}
+
+static std::string get_statistics_csv() {
+    std::string csv =
+        "queue,scope,count,samples,mean_ms,min_ms,max_ms,last_ms,"
+        "mean_invocations\n";
+    for (auto const& [key, scope] : statistics) {
+        std::deque<float> const& milliseconds = scope.milliseconds;
+        auto const samples = (float) milliseconds.size();
+        float const sum =
+            std::accumulate(milliseconds.begin(), milliseconds.end(), 0.0f);
+        auto const [min, max] =
+            std::minmax_element(milliseconds.begin(), milliseconds.end());
+        uint64_t const invocations = std::accumulate(
+            scope.invocations.begin(), scope.invocations.end(), uint64_t{0});
+        // the invocations stay empty without pipeline statistics queries
+        csv += fmt::format("{},{},{},{},{:.4f},{:.4f},{:.4f},{:.4f},{}\n",
+            QUEUE_NAMES[key.first], key.second, scope.count,
+            milliseconds.size(), sum / samples, *min, *max,
+            milliseconds.back(),
+            counting ? fmt::format("{:.0f}", (float) invocations / samples) :
+                       std::string{});
+    }
+    return csv;
+}
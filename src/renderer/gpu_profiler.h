@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <string_view>
+
+#include "vulkan/vulkan_header.h"
+
+// Times and counts the GPU work of named scopes, with a timestamp and a
+// pipeline statistics query pool per queue holding the scopes of every
+// command buffer in flight. The results of a command buffer are collected when
+// it is recorded again, its submission has finished by then. Every scope keeps
+// rolling statistics over its last samples and the last scopes are kept for a
+// trace. Where the device has pipeline statistics queries, they count the
+// compute shader invocations on the compute queue and the fragment shader
+// invocations on the graphics queue. The scopes are timed whenever the queues
+// have timestamps, for the budgets of the renderers, only a profile keeps them
+// and counts invocations.
+void create_gpu_profiler(bool profile);
+
+void destroy_gpu_profiler();
+
+bool is_gpu_timing();
+
+// Collects the previous scopes of a command buffer that was just begun and
+// resets its queries, the serial is the one its submission gets.
+void begin_gpu_profile(vk::PipelineBindPoint bind_point, uint32_t sync_idx,
+    uint64_t serial, vk::CommandBuffer command_buffer);
+
+// Scopes don't nest and stay outside render passes. The name has to outlive
+// the profiler, scopes beyond the queries of a command buffer are dropped.
+void begin_gpu_scope(vk::CommandBuffer command_buffer,
+    vk::PipelineBindPoint bind_point, char const* name);
+
+void end_gpu_scope(
+    vk::CommandBuffer command_buffer, vk::PipelineBindPoint bind_point);
+
+// Collects the scopes of every submission made, which the reuse of their
+// command buffers would collect otherwise. Waits for the submissions that are
+// still running, only while no other thread records.
+void collect_gpu_profile();
+
+// Milliseconds of the scopes of a name that the latest collection of the queue
+// read, the previous use of the command buffer just begun or the submissions
+// collect_gpu_profile collected. Empty without timestamps.
+std::vector<float> get_collected_gpu_times(
+    vk::PipelineBindPoint bind_point, std::string_view name);
+
+// Does nothing without a profile. A .json file gets a Chrome trace of the kept
+// scopes, any other file the rolling statistics of every scope as CSV.
+void dump_gpu_profile(std::string const& file);
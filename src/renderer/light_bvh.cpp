@@ -0,0 +1,307 @@
+#include "check.h"
+#include "light_bvh.h"
+#include "utils/to_span.h"
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#include "glm/geometric.hpp"
+#include "glm/mat3x3.hpp"
+#include "glm/matrix.hpp"
+#pragma clang diagnostic pop
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numbers>
+
+struct light_bounds {
+    aabb aabb{};
+    glm::vec3 axis{0.0f, 0.0f, 1.0f};
+    float phi = 0.0f;
+    float cos_theta_o = 1.0f;
+    float cos_theta_e = 1.0f;
+    bool two_sided = false;
+};
+
+struct light_emitter {
+    light_bounds bounds{};
+    glm::vec3 centroid{0.0f};
+    uint32_t light = 0;
+    uint32_t triangle = 0;
+};
+
+static light_bounds combine_light_bounds(
+    light_bounds const& a, light_bounds const& b);
+
+static float get_light_bounds_cost(light_bounds const& bounds);
+
+static uint32_t get_light_bucket(light_emitter const& emitter,
+    glm::vec3 const& centroid_min, glm::vec3 const& centroid_extent,
+    uint32_t dim);
+
+static glsl_light_bvh_node create_light_bvh_node(light_bounds const& bounds);
+
+static uint32_t build_light_bvh_recursive(
+    std::vector<glsl_light_bvh_node>& nodes,
+    std::span<light_emitter> emitters);
+
+std::vector<glsl_light_bvh_node> create_light_bvh(
+    scene const& scene, bvh const& bvh) {
+    std::vector<light_emitter> emitters{};
+    for (uint32_t l = 0; l < scene.lights.size(); ++l) {
+        light const& light = scene.lights[l];
+        if (light.type != light_type::area_single_sided &&
+            light.type != light_type::area_double_sided) {
+            continue;
+        }
+        bool const two_sided = light.type == light_type::area_double_sided;
+        // the same weights as luminance in the shaders
+        float const radiance = glm::dot(
+            light.intensity, glm::vec3{0.212671f, 0.715160f, 0.072169f});
+        glm::mat4 const transform =
+            light.transform >= 0 ?
+                scene.transformation[(uint32_t) light.transform] :
+                glm::mat4{1.0f};
+        glm::mat3 const normal_transform =
+            glm::transpose(glm::inverse(glm::mat3{transform}));
+        glsl_mesh const& mesh = bvh.meshes[light.mesh];
+        for (uint32_t t = mesh.triangle_offset;
+             t < mesh.triangle_offset + mesh.triangle_count; ++t) {
+            glsl_triangle const& triangle = bvh.triangles[t];
+            std::array const vertices{triangle.a, triangle.b, triangle.c};
+            std::array<glm::vec3, 3> positions{};
+            std::array<glm::vec3, 3> normals{};
+            for (uint32_t v = 0; v < 3; ++v) {
+                positions[v] = glm::vec3{
+                    transform * glm::vec4{glm::vec3{vertices[v].position_texu},
+                                    1.0f}};
+                normals[v] = normal_transform *
+                             glm::vec3{vertices[v].normal_texv};
+            }
+            glm::vec3 const face = glm::cross(
+                positions[1] - positions[0], positions[2] - positions[0]);
+            float const area = 0.5f * glm::length(face);
+            float const phi = (two_sided ? 2.0f : 1.0f) * radiance * area;
+            if (!(phi > 0.0f)) {
+                continue;
+            }
+            // the shaders interpolate the vertex normals, a cone around
+            // their sum bounds every normal of the triangle
+            glm::vec3 axis = normals[0] + normals[1] + normals[2];
+            axis = glm::length(axis) > 0.0f ? glm::normalize(axis) :
+                                              glm::normalize(face);
+            float cos_theta_o = 1.0f;
+            for (glm::vec3 const& normal : normals) {
+                if (glm::length(normal) > 0.0f) {
+                    cos_theta_o = std::min(cos_theta_o,
+                        glm::dot(axis, glm::normalize(normal)));
+                }
+            }
+            aabb box{};
+            for (glm::vec3 const& position : positions) {
+                box = combine_aabb(box, position);
+            }
+            // area lights emit over the hemisphere around every normal
+            light_bounds const bounds{
+                .aabb = box,
+                .axis = axis,
+                .phi = phi,
+                .cos_theta_o = std::max(cos_theta_o, -1.0f),
+                .cos_theta_e = 0.0f,
+                .two_sided = two_sided,
+            };
+            emitters.push_back(light_emitter{
+                .bounds = bounds,
+                .centroid = get_aabb_centroid(box),
+                .light = l,
+                .triangle = t,
+            });
+        }
+    }
+    std::vector<glsl_light_bvh_node> nodes{};
+    if (emitters.empty()) {
+        glsl_light_bvh_node empty{};
+        empty.flags = LIGHT_BVH_LEAF;
+        nodes.push_back(empty);
+        return nodes;
+    }
+    nodes.reserve(2 * emitters.size() - 1);
+    build_light_bvh_recursive(nodes, to_span(emitters));
+    return nodes;
+}
+
+// Smallest cone holding both cones, as in pbrt's DirectionCone::Union.
+static light_bounds combine_light_bounds(
+    light_bounds const& a, light_bounds const& b) {
+    if (!(a.phi > 0.0f)) {
+        return b;
+    }
+    if (!(b.phi > 0.0f)) {
+        return a;
+    }
+    float constexpr PI = std::numbers::pi_v<float>;
+    light_bounds combined{
+        .aabb = combine_aabb(a.aabb, b.aabb),
+        .axis = a.axis,
+        .phi = a.phi + b.phi,
+        .cos_theta_o = a.cos_theta_o,
+        .cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e),
+        .two_sided = a.two_sided || b.two_sided,
+    };
+    float const theta_a = std::acos(std::clamp(a.cos_theta_o, -1.0f, 1.0f));
+    float const theta_b = std::acos(std::clamp(b.cos_theta_o, -1.0f, 1.0f));
+    float const theta_d =
+        std::acos(std::clamp(glm::dot(a.axis, b.axis), -1.0f, 1.0f));
+    if (std::min(theta_d + theta_b, PI) <= theta_a) {
+        return combined;
+    }
+    if (std::min(theta_d + theta_a, PI) <= theta_b) {
+        combined.axis = b.axis;
+        combined.cos_theta_o = b.cos_theta_o;
+        return combined;
+    }
+    float const theta_o = 0.5f * (theta_a + theta_d + theta_b);
+    glm::vec3 const rotation_axis = glm::cross(a.axis, b.axis);
+    if (theta_o >= PI || !(glm::length(rotation_axis) > 0.0f)) {
+        combined.cos_theta_o = -1.0f;
+        return combined;
+    }
+    // rotates the axis of a towards the one of b, the rotation axis is
+    // perpendicular to it
+    float const theta_r = theta_o - theta_a;
+    glm::vec3 const k = glm::normalize(rotation_axis);
+    combined.axis = glm::normalize(a.axis * std::cos(theta_r) +
+                                   glm::cross(k, a.axis) * std::sin(theta_r));
+    combined.cos_theta_o = std::cos(theta_o);
+    return combined;
+}
+
+// Surface area orientation heuristic of pbrt, the power times the solid
+// angle measure of the cones times the surface area.
+static float get_light_bounds_cost(light_bounds const& bounds) {
+    if (!(bounds.phi > 0.0f)) {
+        return 0.0f;
+    }
+    float constexpr PI = std::numbers::pi_v<float>;
+    float const theta_o =
+        std::acos(std::clamp(bounds.cos_theta_o, -1.0f, 1.0f));
+    float const theta_e =
+        std::acos(std::clamp(bounds.cos_theta_e, -1.0f, 1.0f));
+    float const theta_w = std::min(theta_o + theta_e, PI);
+    float const sin_theta_o = std::sqrt(
+        std::max(0.0f, 1.0f - bounds.cos_theta_o * bounds.cos_theta_o));
+    float const m_omega =
+        2.0f * PI * (1.0f - bounds.cos_theta_o) +
+        0.5f * PI *
+            (2.0f * theta_w * sin_theta_o - std::cos(theta_o - 2.0f * theta_w) -
+                2.0f * theta_o * sin_theta_o + bounds.cos_theta_o);
+    return bounds.phi * m_omega * get_aabb_surface_area(bounds.aabb);
+}
+
+static uint32_t get_light_bucket(light_emitter const& emitter,
+    glm::vec3 const& centroid_min, glm::vec3 const& centroid_extent,
+    uint32_t dim) {
+    uint32_t constexpr NBUCKET = 12;
+    float const offset =
+        (emitter.centroid[(int32_t) dim] - centroid_min[(int32_t) dim]) /
+        centroid_extent[(int32_t) dim];
+    return std::min((uint32_t) (NBUCKET * offset), NBUCKET - 1);
+}
+
+static glsl_light_bvh_node create_light_bvh_node(light_bounds const& bounds) {
+    return glsl_light_bvh_node{
+        .bounds_min = get_aabb_min(bounds.aabb),
+        .phi = bounds.phi,
+        .bounds_max = get_aabb_max(bounds.aabb),
+        .cos_theta_o = bounds.cos_theta_o,
+        .axis = bounds.axis,
+        .cos_theta_e = bounds.cos_theta_e,
+        .right = 0,
+        .light = 0,
+        .triangle = 0,
+        .flags = bounds.two_sided ? LIGHT_BVH_TWO_SIDED : 0,
+    };
+}
+
+static uint32_t build_light_bvh_recursive(
+    std::vector<glsl_light_bvh_node>& nodes,
+    std::span<light_emitter> emitters) {
+    CHECK(emitters.size() > 0, "");
+    uint32_t const node_idx = (uint32_t) nodes.size();
+    nodes.push_back(glsl_light_bvh_node{});
+    if (emitters.size() == 1) {
+        glsl_light_bvh_node leaf = create_light_bvh_node(emitters[0].bounds);
+        leaf.light = emitters[0].light;
+        leaf.triangle = emitters[0].triangle;
+        leaf.flags |= LIGHT_BVH_LEAF;
+        nodes[node_idx] = leaf;
+        return node_idx;
+    }
+    light_bounds node_bounds{};
+    aabb centroid_aabb{};
+    for (auto const& emitter : emitters) {
+        node_bounds = combine_light_bounds(node_bounds, emitter.bounds);
+        centroid_aabb = combine_aabb(centroid_aabb, emitter.centroid);
+    }
+    glm::vec3 const centroid_min = get_aabb_min(centroid_aabb);
+    glm::vec3 const centroid_extent = get_aabb_extent(centroid_aabb);
+    glm::vec3 const bounds_extent = get_aabb_extent(node_bounds.aabb);
+    float const max_extent =
+        std::max({bounds_extent.x, bounds_extent.y, bounds_extent.z});
+    uint32_t constexpr NBUCKET = 12;
+    uint32_t constexpr NSPLIT = NBUCKET - 1;
+    float min_cost = std::numeric_limits<float>::max();
+    uint32_t min_cost_dim = 0;
+    uint32_t min_cost_split = 0;
+    for (uint32_t dim = 0; dim < 3; ++dim) {
+        if (!(centroid_extent[(int32_t) dim] > 0.0f)) {
+            continue;
+        }
+        std::array<light_bounds, NBUCKET> buckets{};
+        for (auto const& emitter : emitters) {
+            uint32_t const b = get_light_bucket(
+                emitter, centroid_min, centroid_extent, dim);
+            buckets[b] = combine_light_bounds(buckets[b], emitter.bounds);
+        }
+        // penalizes splitting thin boxes along their short side
+        float const kr = max_extent / bounds_extent[(int32_t) dim];
+        for (uint32_t i = 0; i < NSPLIT; ++i) {
+            light_bounds below{};
+            light_bounds above{};
+            for (uint32_t b = 0; b <= i; ++b) {
+                below = combine_light_bounds(below, buckets[b]);
+            }
+            for (uint32_t b = i + 1; b < NBUCKET; ++b) {
+                above = combine_light_bounds(above, buckets[b]);
+            }
+            float const cost = kr * (get_light_bounds_cost(below) +
+                                        get_light_bounds_cost(above));
+            if (cost < min_cost) {
+                min_cost = cost;
+                min_cost_dim = dim;
+                min_cost_split = i;
+            }
+        }
+    }
+    uint32_t mid = (uint32_t) emitters.size() / 2;
+    if (min_cost < std::numeric_limits<float>::max()) {
+        auto iter = std::partition(emitters.begin(), emitters.end(),
+            [=](light_emitter const& emitter) -> bool {
+                return get_light_bucket(emitter, centroid_min,
+                           centroid_extent, min_cost_dim) <= min_cost_split;
+            });
+        mid = (uint32_t) (iter - emitters.begin());
+        if (mid == 0 || mid == emitters.size()) {
+            mid = (uint32_t) emitters.size() / 2;
+        }
+    }
+    // the first child is laid out right after the node
+    build_light_bvh_recursive(nodes, emitters.subspan(0, mid));
+    uint32_t const right = build_light_bvh_recursive(
+        nodes, emitters.subspan(mid, emitters.size() - mid));
+    glsl_light_bvh_node node = create_light_bvh_node(node_bounds);
+    node.right = right;
+    nodes[node_idx] = node;
+    return node_idx;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "bvh.h"
+
+#include <vector>
+
+uint32_t constexpr LIGHT_BVH_LEAF = 1;
+uint32_t constexpr LIGHT_BVH_TWO_SIDED = 2;
+// leaf of an emitting triangle without power, which the BVH leaves out
+uint32_t constexpr LIGHT_BVH_NO_LEAF = 0xffffffff;
+
+// The first child of an interior node follows it and the second one is at
+// right, a leaf holds one emitting triangle of an area light. phi bounds the
+// power below the node and the cone around axis bounds the normals of its
+// emitters, cos_theta_e is the spread of the emission around every normal.
+struct glsl_light_bvh_node {
+    glm::vec3 bounds_min;
+    float phi;
+    glm::vec3 bounds_max;
+    float cos_theta_o;
+    glm::vec3 axis;
+    float cos_theta_e;
+    uint32_t right;
+    uint32_t light;
+    uint32_t triangle;  // index into the triangles of the BVH
+    uint32_t flags;
+};
+
+// Built over the world space triangles of the area lights, the root has zero
+// power when the scene has none.
+std::vector<glsl_light_bvh_node> create_light_bvh(
+    scene const& scene, bvh const& bvh);
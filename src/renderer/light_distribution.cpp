@@ -0,0 +1,214 @@
+#include "light_distribution.h"
+#include "utils/to_span.h"
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#include "glm/geometric.hpp"
+#include "glm/mat3x3.hpp"
+#pragma clang diagnostic pop
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <thread>
+
+#pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
+
+static float luminance(glm::vec3 const& color);
+
+static float get_texel_luminance(
+    texture_data const& texture, uint32_t x, uint32_t y);
+
+static void normalize_cdf(std::span<float> cdf);
+
+static void append_alias_table(
+    std::vector<glsl_alias_entry>& table, std::span<float const> weights);
+
+std::vector<float> create_sky_distribution(scene const& scene) {
+    if (scene.lights.empty() || scene.lights.back().type != light_type::sky ||
+        scene.lights.back().emission_tex < 0) {
+        return {};
+    }
+    texture_data const& texture =
+        scene.textures[(uint32_t) scene.lights.back().emission_tex];
+    uint32_t const width = texture.width;
+    uint32_t const height = texture.height;
+    std::vector<float> distribution(
+        (height + 1) + (size_t) height * (width + 1), 0.0f);
+    std::span<float> const marginal = to_span(distribution).first(height + 1);
+    std::span<float> const conditional =
+        to_span(distribution).subspan(height + 1);
+    std::vector<float> row_sums(height, 0.0f);
+    // rows are independent, every worker builds the CDFs of a band of them
+    auto const build_rows = [&](uint32_t first_row, uint32_t last_row) {
+        for (uint32_t y = first_row; y < last_row; ++y) {
+            float const sin_theta = std::sin(std::numbers::pi_v<float> *
+                                             ((float) y + 0.5f) /
+                                             (float) height);
+            std::span<float> const cdf =
+                conditional.subspan((size_t) y * (width + 1), width + 1);
+            for (uint32_t x = 0; x < width; ++x) {
+                cdf[x + 1] =
+                    cdf[x] + sin_theta * get_texel_luminance(texture, x, y);
+            }
+            row_sums[y] = cdf[width];
+            normalize_cdf(cdf);
+        }
+    };
+    uint32_t const worker_count =
+        std::clamp(std::thread::hardware_concurrency(), 1u, height);
+    uint32_t const rows_per_worker =
+        (height + worker_count - 1) / worker_count;
+    std::vector<std::thread> workers{};
+    workers.reserve(worker_count);
+    for (uint32_t first_row = 0; first_row < height;
+         first_row += rows_per_worker) {
+        workers.emplace_back(build_rows, first_row,
+            std::min(first_row + rows_per_worker, height));
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    for (uint32_t y = 0; y < height; ++y) {
+        marginal[y + 1] = marginal[y] + row_sums[y];
+    }
+    normalize_cdf(marginal);
+    return distribution;
+}
+
+std::vector<glsl_alias_entry> create_light_alias_tables(scene const& scene,
+    bvh const& bvh, std::span<glsl_light_bvh_node const> light_bvh) {
+    std::vector<float> powers(scene.lights.size(), 0.0f);
+    std::vector<std::vector<float>> triangle_areas(scene.lights.size());
+    for (uint32_t l = 0; l < scene.lights.size(); ++l) {
+        light const& light = scene.lights[l];
+        if (light.type != light_type::area_single_sided &&
+            light.type != light_type::area_double_sided) {
+            continue;
+        }
+        glm::mat3 const transform =
+            light.transform >= 0 ?
+                glm::mat3{scene.transformation[(uint32_t) light.transform]} :
+                glm::mat3{1.0f};
+        glsl_mesh const& mesh = bvh.meshes[light.mesh];
+        std::vector<float>& areas = triangle_areas[l];
+        areas.reserve(mesh.triangle_count);
+        float total_area = 0.0f;
+        for (uint32_t t = mesh.triangle_offset;
+             t < mesh.triangle_offset + mesh.triangle_count; ++t) {
+            glsl_triangle const& triangle = bvh.triangles[t];
+            glm::vec3 const a{triangle.a.position_texu};
+            glm::vec3 const edge_1 =
+                transform * (glm::vec3{triangle.b.position_texu} - a);
+            glm::vec3 const edge_2 =
+                transform * (glm::vec3{triangle.c.position_texu} - a);
+            areas.push_back(0.5f * glm::length(glm::cross(edge_1, edge_2)));
+            total_area += areas.back();
+        }
+        float const sides =
+            light.type == light_type::area_double_sided ? 2.0f : 1.0f;
+        powers[l] = sides * luminance(light.intensity) * total_area;
+    }
+    std::vector<glsl_alias_entry> table{};
+    append_alias_table(table, powers);
+    for (uint32_t l = 0; l < scene.lights.size(); ++l) {
+        if (!triangle_areas[l].empty()) {
+            table[l].link = (uint32_t) table.size();
+            append_alias_table(table, triangle_areas[l]);
+            for (size_t t = table[l].link; t < table.size(); ++t) {
+                table[t].link = LIGHT_BVH_NO_LEAF;
+            }
+        }
+    }
+    for (uint32_t n = 0; n < light_bvh.size(); ++n) {
+        glsl_light_bvh_node const& node = light_bvh[n];
+        // the leaf of a BVH without emitters has no power
+        if ((node.flags & LIGHT_BVH_LEAF) == 0 || !(node.phi > 0.0f)) {
+            continue;
+        }
+        uint32_t const first_triangle =
+            bvh.meshes[scene.lights[node.light].mesh].triangle_offset;
+        table[table[node.light].link + node.triangle - first_triangle].link =
+            n;
+    }
+    return table;
+}
+
+// The same weights as luminance in the shaders.
+static float luminance(glm::vec3 const& color) {
+    return glm::dot(color, glm::vec3{0.212671f, 0.715160f, 0.072169f});
+}
+
+// The shaders tone map the texels of the sky before scaling them by its
+// intensity.
+static float get_texel_luminance(
+    texture_data const& texture, uint32_t x, uint32_t y) {
+    size_t const i =
+        ((size_t) y * texture.width + x) * (uint32_t) texture.channel;
+    glm::vec3 color{0.0f};
+    if (texture.format == texture_format::sfloat) {
+        float const* const p = static_cast<float const*>(texture.data);
+        color = glm::vec3{p[i + 0], p[i + 1], p[i + 2]};
+    } else {
+        unsigned char const* const p =
+            static_cast<unsigned char const*>(texture.data);
+        color = glm::vec3{(float) p[i + 0], (float) p[i + 1],
+                    (float) p[i + 2]} /
+                255.0f;
+    }
+    color = glm::max(color, glm::vec3{0.0f});
+    color = color / (color + glm::vec3{1.0f});
+    return luminance(color);
+}
+
+// Scales the CDF to end at 1, a CDF without weight becomes uniform.
+static void normalize_cdf(std::span<float> cdf) {
+    float const total = cdf.back();
+    uint32_t const count = (uint32_t) cdf.size() - 1;
+    for (uint32_t i = 1; i <= count; ++i) {
+        cdf[i] = total > 0.0f ? cdf[i] / total : (float) i / (float) count;
+    }
+}
+
+// Vose's method, entries without weight get a pmf of 0 and are never picked
+// unless the whole table has none.
+static void append_alias_table(
+    std::vector<glsl_alias_entry>& table, std::span<float const> weights) {
+    uint32_t const offset = (uint32_t) table.size();
+    uint32_t const count = (uint32_t) weights.size();
+    double total = 0.0;
+    for (float const weight : weights) {
+        total += (double) weight;
+    }
+    table.resize(offset + count);
+    std::vector<float> scaled(count, 1.0f);
+    std::vector<uint32_t> small{};
+    std::vector<uint32_t> large{};
+    for (uint32_t i = 0; i < count; ++i) {
+        float const pmf =
+            total > 0.0 ? (float) ((double) weights[i] / total) : 0.0f;
+        table[offset + i] = glsl_alias_entry{
+            .threshold = 1.0f,
+            .alias = i,
+            .pmf = pmf,
+            .link = 0,
+        };
+        if (total > 0.0) {
+            scaled[i] = pmf * (float) count;
+            (scaled[i] < 1.0f ? small : large).push_back(i);
+        }
+    }
+    while (!small.empty() && !large.empty()) {
+        uint32_t const s = small.back();
+        small.pop_back();
+        uint32_t const l = large.back();
+        table[offset + s].threshold = scaled[s];
+        table[offset + s].alias = l;
+        scaled[l] += scaled[s] - 1.0f;
+        if (scaled[l] < 1.0f) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // whatever is left is 1 up to rounding and keeps its own index
+}
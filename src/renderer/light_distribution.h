@@ -0,0 +1,34 @@
+#pragma once
+
+#include "asset/scene.h"
+#include "renderer/bvh.h"
+#include "renderer/light_bvh.h"
+
+#include <span>
+#include <vector>
+
+// Piecewise constant distribution over the texels of the environment map in
+// proportion to the radiance the shaders read from them, weighted by sin theta
+// of their row. The marginal CDF over the rows comes first, then the CDF over
+// the columns of every row, each one entry longer than its bucket count. It is
+// empty without an environment map.
+std::vector<float> create_sky_distribution(scene const& scene);
+
+// An alias table entry keeps its own index with probability threshold and
+// gives its alias otherwise, pmf is the probability of picking its index.
+struct glsl_alias_entry {
+    float threshold;
+    uint32_t alias;
+    float pmf;
+    // in the light table the start of the table over the light triangles, in
+    // a triangle table the leaf of the triangle in the light BVH
+    uint32_t link;
+};
+
+// The table over the lights by emitted power comes first, the sky and the
+// distant lights have no weight in it. The tables over the triangles of every
+// area light by world space area follow, ordered like the triangles of its
+// mesh in the BVH. The shaders find the light BVH leaf of an emitter they hit
+// through them.
+std::vector<glsl_alias_entry> create_light_alias_tables(scene const& scene,
+    bvh const& bvh, std::span<glsl_light_bvh_node const> light_bvh);
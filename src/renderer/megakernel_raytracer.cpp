@@ -1,9 +1,12 @@
-#include <random>
+#include <bit>
+#include <limits>
+#include <cstddef>
+#include <optional>
+#include <cmath>
+#include <mutex>
+#include <algorithm>
 
 #include "check.h"
-#include "vulkan/vulkan_swapchain.h"
-#include "vulkan/vulkan_render_pass.h"
-#include "vulkan/vulkan_framebuffer.h"
 #include "vulkan/vulkan_descriptor.h"
 #include "vulkan/vulkan_pipeline.h"
 #include "vulkan/vulkan_buffer.h"
@@ -15,7 +18,12 @@
 
 #include "renderer/renderer.h"
 #include "renderer/render_context.h"
+#include "renderer/gpu_profiler.h"
+#include "renderer/raytracer_common.h"
 #include "renderer/bvh.h"
+#include "renderer/light_bvh.h"
+#include "renderer/light_distribution.h"
+#include "renderer/workgroup_size.h"
 
 #include "utils/to_span.h"
 #include "utils/file.h"
@@ -25,23 +33,61 @@
 
 void megakernel_raytracer_initialize(render_options const& options);
 void megakernel_raytracer_prepare_data(scene const& scene);
+void megakernel_raytracer_set_options(render_options const& options);
+void megakernel_raytracer_set_region(render_region const& new_region);
 void megakernel_raytracer_update_data(scene const& scene);
 void megakernel_raytracer_render(camera const& camera);
+void megakernel_raytracer_accumulate(camera const& camera);
 void megakernel_raytracer_present();
 void megakernel_raytracer_destroy();
+std::vector<float> megakernel_raytracer_read_back();
+std::vector<image_layer> megakernel_raytracer_read_back_aovs();
+uint32_t megakernel_raytracer_request_read_back();
+std::vector<float> megakernel_raytracer_fetch_read_back(uint32_t ticket);
+accumulation megakernel_raytracer_fetch_accumulation(uint32_t ticket);
+void megakernel_raytracer_restore_accumulation(accumulation const& state);
+uint64_t megakernel_raytracer_traced_rays();
 
 void load_megakernel_raytracer(renderer& renderer);
 
-static void create_frame_objects();
-static void destroy_frame_objects();
-static void refresh_frame_objects();
 static void create_megakernel_raytracer_pipeline();
+static vk::Pipeline create_megakernel_raytracer_variant(
+    glm::uvec2 workgroup, uint32_t shared_stack);
+static void tune_workgroup_size(camera const& camera);
 static void destroy_megakernel_raytracer_pipeline();
 static void prepare_megakernel_raytracer_resources(scene const& scene);
 static void clean_megakernel_raytracer_resources();
-static void create_rect_pipeline();
-static void destroy_rect_pipeline();
+static void prepare_accumulation_images(
+    vk::CommandBuffer compute_command_buffer,
+    vk::CommandBuffer graphics_command_buffer);
+static void clean_accumulation_images();
+static void apply_render_options(render_options const& options);
+static uint32_t get_aov_images(render_options const& options);
 static void prepare_rect_resources();
+static void bind_megakernel_raytracer(
+    vk::CommandBuffer command_buffer, uint32_t sync_idx);
+static void dispatch_pixels(vk::CommandBuffer command_buffer,
+    glm::uvec2 offset, glm::uvec2 extent);
+static glm::uvec2 get_preview_extent();
+static void update_preview_history(vk::CommandBuffer command_buffer,
+    glsl_raytracer_camera const& camera, glm::uvec2 extent);
+static std::optional<float> get_previous_gpu_time(
+    std::span<char const* const> scopes);
+static void scale_preview(float milliseconds);
+static void scale_tiles(float milliseconds);
+static void create_upscaler_pipeline();
+static void destroy_upscaler_pipeline();
+static void upscale_preview(vk::CommandBuffer command_buffer,
+    uint32_t sync_idx, glm::uvec2 extent);
+static void clear_accumulation(vk::CommandBuffer command_buffer);
+static void accumulate_offscreen(camera const& camera);
+static void copy_accumulation(vk::CommandBuffer command_buffer);
+static void publish_display_image(
+    vk::CommandBuffer command_buffer, vk_image const& source);
+static void create_denoiser_pipeline();
+static void destroy_denoiser_pipeline();
+static void denoise_accumulation(
+    vk::CommandBuffer command_buffer, uint32_t sync_idx);
 
 static bool initialized = false;
 
@@ -51,9 +97,25 @@ static struct {
     glm::uvec2 current{0};
 } tiles;
 
-uint32_t constexpr PREVIEW_RATIO = 10;
-static uint32_t preview_width;
-static uint32_t preview_height;
+// The preview renders a fraction of the pixels and upscales them, scaled to
+// keep its GPU time within the budget. The resolution grows first and once it
+// is full, the samples of every preview pixel.
+static uint32_t constexpr PREVIEW_RATIO = 10;  // of the first preview
+static float constexpr MIN_PREVIEW_SCALE = 1.0f / 16.0f;
+static uint32_t constexpr MAX_PREVIEW_SAMPLE = 4;
+static float preview_scale = 1.0f / (float) PREVIEW_RATIO;
+static uint32_t preview_samples = 1;
+static float preview_frame_time = 0.0f;  // budget in milliseconds
+
+// Progressive rendering records as many tiles per frame as fit its budget.
+static float tile_frame_time = 0.0f;  // budget in milliseconds
+static float tiles_per_frame = 1.0f;
+
+// GPU scopes the budgets time, of the preview and of the tiles
+static std::array<char const*, 3> constexpr PREVIEW_SCOPES{
+    "preview history upload", "preview", "preview upscale"};
+static std::array<char const*, 4> constexpr TILE_SCOPES{
+    "clear", "tile", "denoise", "accumulation copy"};
 
 static bool next_tile() {
     if (tiles.current.x != tiles.count.x - 1) {
@@ -77,30 +139,13 @@ static glm::uvec2 current_viewport() {
     return glm::uvec2{offset_x, offset_y};
 }
 
-static uint32_t rand_uint() {
-    static std::random_device rand_dev{};
-    static std::mt19937 rand_gen{rand_dev()};
-    static std::uniform_int_distribution<uint32_t> uni_dist{
-        0, std::numeric_limits<uint32_t>::max()};
-    return uni_dist(rand_gen);
-}
+static uint32_t base_seed = 0;
+static sampler_type sampler = sampler_type::random;
+static uint32_t preview_counter = 0;
 
 static vk::DescriptorPool primary_descriptor_pool{};
 static vk::DescriptorPool indexing_descriptor_pool{};
 static vk::Sampler primary_sampler{};
-static vk::Sampler blocky_sampler{};
-static std::array<vk::Semaphore, FRAME_IN_FLIGHT> compute_semaphores{};
-static std::array<vk::Semaphore, FRAME_IN_FLIGHT> graphics_semaphores{};
-static std::array<vk::Semaphore, FRAME_IN_FLIGHT> present_semaphores{};
-
-static struct {
-    vk::SwapchainKHR swapchain;
-    std::vector<vk::Image> swapchain_image;
-    std::vector<vk::ImageView> presents;
-    vk::RenderPass render_pass;
-    std::vector<vk::Framebuffer> framebuffers;
-    uint32_t swapchain_image_idx;
-} frame_objects{};
 
 static uint32_t constexpr MEGAKERNAL_RAYTRACER_SET = 4;
 
@@ -108,6 +153,49 @@ static uint32_t constexpr MAX_TEXTURE = 50;
 
 static uint32_t accumulation_counter = 0;
 
+// The render thread publishes every finished preview and sweep into one of
+// the display images, window frames sample the latest one once the compute
+// submission carrying it has finished. An image is only written again after
+// the graphics submissions of the window frames sampling it.
+static uint32_t constexpr DISPLAY_IMAGE = 2;
+
+struct publication {
+    uint64_t submission = 0;  // nothing has been published at 0
+    uint32_t image = 0;
+};
+
+static std::mutex display_mutex{};
+static publication latest_publication{};
+// graphics submission of the last window frame sampling every display image
+static std::array<uint64_t, DISPLAY_IMAGE> display_reads{};
+// display image written by the compute submission being recorded
+static std::optional<uint32_t> pending_publication{};
+
+// images accumulated next to the color, the bits of the aovs push constant
+// match the AOV_IMAGE defines of the shader
+static uint32_t constexpr AOV_IMAGE = 6;
+static uint32_t constexpr AOV_IMAGE_ALBEDO = 1;  // the sample count in alpha
+static uint32_t constexpr AOV_IMAGE_NORMAL_DEPTH = 2;
+static uint32_t constexpr AOV_IMAGE_DIRECT = 4;
+static uint32_t constexpr AOV_IMAGE_INDIRECT = 8;
+static uint32_t constexpr AOV_IMAGE_EMISSION = 16;
+// Welford mean and M2 of the luminance with the sample count
+static uint32_t constexpr AOV_IMAGE_VARIANCE = 32;
+
+// extent of the accumulation, the swapchain extent unless rendering headless
+static vk::Extent2D render_extent{};
+
+// rendered and read back part of a headless accumulation
+static render_region region{};
+
+static vk::ImageSubresourceRange constexpr whole_range{
+    .aspectMask = vk::ImageAspectFlagBits::eColor,
+    .baseMipLevel = 0,
+    .levelCount = 1,
+    .baseArrayLayer = 0,
+    .layerCount = 1,
+};
+
 static struct {
     // descriptors
     std::array<vk::DescriptorSetLayout, MEGAKERNAL_RAYTRACER_SET>
@@ -132,18 +220,55 @@ static struct {
     vk_buffer material_buffer;
     vk_buffer medium_buffer;
     vk_buffer light_buffer;
+    vk_buffer light_bvh_buffer;
+    vk_buffer sky_distribution_buffer;
+    vk_buffer light_alias_buffer;
     // set 3
     vk_image accumulation_image;  // rendered by tiles for accumulation
-    vk_image preview_image;       // low resolution for preview
+    vk_image preview_image;  // the preview upscaled to the full resolution
     std::vector<vk_image> texture_array;
+    // preview frames blended so far and the normal and depth of their first
+    // hit, the previews write them in turn
+    std::array<vk_image, 2> history_images;
+    std::array<vk_image, 2> history_guide_images;
+    vk_buffer preview_history_buffer;  // the previous preview camera
     // others
     vk_image output_image;  // color from scratch image would be copied to
                             // this image after all tiles get rendered
+    // published previews and sweeps the window frames sample
+    std::array<vk_image, DISPLAY_IMAGE> display_images;
+    vk_buffer ray_counter_buffer;  // rays traced since the last clear
+    vk_buffer work_counter_buffer;  // pixels claimed by persistent threads
+    // sums of the AOVs next to the color, 1x1 when not in use
+    std::array<vk_image, AOV_IMAGE> aov_images;
+    // the denoiser passes write them in turn and the last one the output
+    std::array<vk_image, 2> filtered_images;
 } megakernel_raytracer;
 
+static glm::uvec2 workgroup_size{8, 8};
+// workgroups of a persistent dispatch, enough to fill the largest devices,
+// the surplus exits after its first claim
+static uint32_t constexpr PERSISTENT_WORKGROUPS = 1024;
+static bool persistent_threads = false;
+static uint32_t shared_stack_size = 0;
+// entries of the traversal stack the bvh of the scene needs
+static uint32_t traversal_stack_size = 1;
+static bool workgroup_size_tuned = false;
+static uint32_t constexpr TUNING_ROUND = 4;  // the first one warms up
+// the scene has no camera before its first render, the tuning looks at all of
+// it
+static camera tuning_camera{};
+static char const* const WORKGROUP_SIZE_CACHE =
+    PATH_FROM_BINARY("workgroup_sizes.json");
+
 static uint32_t max_tracing_depth = 0;
 static uint32_t light_count = 0;
 static int32_t sky_light_idx = -1;
+static light_sampling_mode light_sampling = light_sampling_mode::uniform;
+static bool denoise = false;
+static uint32_t aovs = 0;
+static uint32_t aov_images = 0;  // AOV_IMAGE bits in use
+static float adaptive_threshold = 0.0f;
 
 struct megakernel_raytracer_pc {
     glsl_raytracer_camera camera;
@@ -152,8 +277,34 @@ struct megakernel_raytracer_pc {
     uint32_t max_depth;
     uint32_t light_count;
     int32_t sky_light;
+    uint32_t light_sampling;
+    uint32_t sampler;
+    uint32_t sample_index;
+    uint32_t count_rays;
+    uint32_t aovs = 0;
+    float adaptive_threshold = 0.0f;
+    glm::uvec2 rect_min{0};
+    glm::uvec2 rect_max{0};
+    uint32_t persistent = 0;
 };
 
+// camera of the previous preview frame, the next one reprojects its history
+struct glsl_preview_history {
+    glsl_raytracer_camera previous_camera;
+    glm::uvec2 previous_extent;
+    uint32_t history_index;
+    uint32_t history_valid;
+};
+
+struct preview_frame {
+    glsl_raytracer_camera camera;
+    glm::uvec2 extent;
+};
+
+// the history is dropped whenever the scene or the options change
+static std::optional<preview_frame> previous_preview{};
+static uint32_t history_index = 0;
+
 static struct {
     // descriptors
     vk::DescriptorSetLayout descriptor_layout;
@@ -161,48 +312,29 @@ static struct {
     // pipeline
     vk::PipelineLayout pipeline_layout;
     vk::Pipeline pipeline;
-} rect;
+} upscaler;
 
-struct rect_pc {
-    float frame_scalar;
-    uint32_t preview;
+struct upscaler_pc {
+    glm::uvec2 preview_extent;
+    uint32_t history_index;
 };
 
-static void create_frame_objects() {
-    std::tie(frame_objects.swapchain, frame_objects.swapchain_image,
-        frame_objects.presents) =
-        create_swapchain(device, surface, command_queues);
-    frame_objects.render_pass = create_render_pass(device);
-    frame_objects.framebuffers = create_framebuffers(
-        device, frame_objects.render_pass, frame_objects.presents);
-}
+// a-trous passes, the taps of the last one are 16 pixels apart
+static uint32_t constexpr DENOISE_ITERATION = 5;
 
-static void destroy_frame_objects() {
-    for (auto const framebuffer : frame_objects.framebuffers) {
-        device.destroyFramebuffer(framebuffer);
-    }
-    device.destroyRenderPass(frame_objects.render_pass);
-    for (auto const view : frame_objects.presents) {
-        device.destroyImageView(view);
-    }
-    device.destroySwapchainKHR(frame_objects.swapchain);
-}
+static struct {
+    // descriptors
+    vk::DescriptorSetLayout descriptor_layout;
+    std::array<vk::DescriptorSet, FRAME_IN_FLIGHT> descriptor_sets;
+    // pipeline
+    vk::PipelineLayout pipeline_layout;
+    vk::Pipeline pipeline;
+} denoiser;
 
-static void refresh_frame_objects() {
-    wait_window(device, physical_device, surface, window);
-    for (auto const framebuffer : frame_objects.framebuffers) {
-        device.destroyFramebuffer(framebuffer);
-    }
-    for (auto const view : frame_objects.presents) {
-        device.destroyImageView(view);
-    }
-    device.destroySwapchainKHR(frame_objects.swapchain);
-    std::tie(frame_objects.swapchain, frame_objects.swapchain_image,
-        frame_objects.presents) =
-        create_swapchain(device, surface, command_queues);
-    frame_objects.framebuffers = create_framebuffers(
-        device, frame_objects.render_pass, frame_objects.presents);
-}
+struct denoiser_pc {
+    uint32_t iteration;
+    uint32_t iteration_count;
+};
 
 static void create_megakernel_raytracer_pipeline() {
     VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptor_indexing_properties{
@@ -226,13 +358,22 @@ static void create_megakernel_raytracer_pipeline() {
                                                {vk::DescriptorType::eStorageBuffer, 1},
                                                {vk::DescriptorType::eStorageBuffer, 1}},
         std::vector<vk_descriptor_set_binding>{
+                                               {vk::DescriptorType::eStorageBuffer, 1},
+                                               {vk::DescriptorType::eStorageBuffer, 1},
+                                               {vk::DescriptorType::eStorageBuffer, 1},
                                                {vk::DescriptorType::eStorageBuffer, 1},
                                                {vk::DescriptorType::eStorageBuffer, 1},
                                                {vk::DescriptorType::eStorageBuffer, 1}},
     };
     std::vector<vk_descriptor_set_binding> const set_3_binding{
         {        vk::DescriptorType::eStorageImage,           2},
-        {vk::DescriptorType::eCombinedImageSampler, MAX_TEXTURE}
+        {vk::DescriptorType::eCombinedImageSampler, MAX_TEXTURE},
+        {       vk::DescriptorType::eStorageBuffer,           1},
+        {       vk::DescriptorType::eStorageBuffer,           1},
+        {        vk::DescriptorType::eStorageImage,   AOV_IMAGE},
+        {        vk::DescriptorType::eStorageImage,           2},
+        {        vk::DescriptorType::eStorageImage,           2},
+        {       vk::DescriptorType::eStorageBuffer,           1},
     };
     for (uint32_t s = 0; s < MEGAKERNAL_RAYTRACER_SET - 1; ++s) {
         megakernel_raytracer.descriptor_layouts[s] =
@@ -251,12 +392,153 @@ static void create_megakernel_raytracer_pipeline() {
     std::array pc_stages{vk::ShaderStageFlagBits::eCompute};
     megakernel_raytracer.pipeline_layout = create_pipeline_layout(
         device, pc_sizes, pc_stages, megakernel_raytracer.descriptor_layouts);
-    megakernel_raytracer.pipeline = create_compute_pipeline(device,
+    std::optional<kernel_tuning> const cached_tuning =
+        load_kernel_tuning(WORKGROUP_SIZE_CACHE,
+            get_device_key(physical_device), "megakernel_raytracer");
+    if (cached_tuning.has_value()) {
+        workgroup_size = cached_tuning->workgroup_size;
+        shared_stack_size = cached_tuning->shared_stack_size;
+        workgroup_size_tuned = true;
+    }
+    megakernel_raytracer.pipeline = create_megakernel_raytracer_variant(
+        workgroup_size, shared_stack_size);
+}
+
+static vk::Pipeline create_megakernel_raytracer_variant(
+    glm::uvec2 workgroup, uint32_t shared_stack) {
+    return create_compute_pipeline(device,
         PATH_FROM_BINARY("shaders/megakernel_raytracer.comp.spv"),
-        megakernel_raytracer.pipeline_layout, {},
+        megakernel_raytracer.pipeline_layout,
+        {workgroup.x, workgroup.y,
+            get_shared_stack_split(shared_stack, traversal_stack_size),
+            traversal_stack_size},
         vk::PipelineCreateFlagBits::eDispatchBase);
 }
 
+// Every candidate shape adds samples of the center tile to the accumulation,
+// once with the traversal stack in private memory and once with all but a
+// small overflow of it in shared memory, timed by the scopes of the GPU
+// profiler. The accumulation holds no samples yet and is cleared afterwards.
+// The fastest shape is cached for the device so later runs skip the tuning.
+static void tune_workgroup_size(camera const& camera) {
+    workgroup_size_tuned = true;
+    if (!is_gpu_timing()) {
+        fmt::println("The workgroup size can't be tuned without timestamps");
+        return;
+    }
+    if (!is_headless()) {
+        // the accumulation images must be out of their initial layout
+        get_command_buffer(vk::PipelineBindPoint::eGraphics);
+        submit_command_buffer(vk::PipelineBindPoint::eGraphics);
+        wait_submission(vk::PipelineBindPoint::eGraphics,
+            get_submission_serial(vk::PipelineBindPoint::eGraphics));
+    }
+    vk::PhysicalDeviceLimits const limits =
+        physical_device.getProperties().limits;
+    glm::uvec2 const image_extent{render_extent.width, render_extent.height};
+    glm::uvec2 const extent = glm::min(tiles.size, image_extent);
+    glm::uvec2 const offset = (image_extent - extent) / 2u;
+    kernel_tuning best{
+        .workgroup_size = workgroup_size,
+        .shared_stack_size = shared_stack_size,
+    };
+    float best_milliseconds = std::numeric_limits<float>::max();
+    fmt::println("Tuning the workgroup size on {}x{} pixels", extent.x,
+        extent.y);
+    for (glm::uvec2 const candidate : get_workgroup_size_candidates()) {
+        if (candidate.x * candidate.y > limits.maxComputeWorkGroupInvocations ||
+            candidate.x > limits.maxComputeWorkGroupSize[0] ||
+            candidate.y > limits.maxComputeWorkGroupSize[1]) {
+            continue;
+        }
+        std::vector<uint32_t> shared_stacks{0};
+        uint32_t const fitting_stack = get_shared_stack_size(
+            limits.maxComputeSharedMemorySize, candidate);
+        if (fitting_stack != 0) {
+            shared_stacks.push_back(fitting_stack);
+        }
+        for (uint32_t const shared_stack : shared_stacks) {
+            // the previous variant has finished on the GPU
+            device.destroyPipeline(megakernel_raytracer.pipeline);
+            megakernel_raytracer.pipeline =
+                create_megakernel_raytracer_variant(candidate, shared_stack);
+            workgroup_size = candidate;
+            auto const [compute_command_buffer, compute_sync_idx] =
+                get_command_buffer(vk::PipelineBindPoint::eCompute);
+            bind_megakernel_raytracer(
+                compute_command_buffer, compute_sync_idx);
+            for (uint32_t r = 0; r < TUNING_ROUND; ++r) {
+                megakernel_raytracer_pc const megakernel_raytracer_pc{
+                    .camera = get_glsl_raytracer_camera(
+                        camera, render_extent.width, render_extent.height),
+                    .random_seed = get_sample_seed(base_seed, sampler, r),
+                    .preview = 0,
+                    .max_depth = max_tracing_depth,
+                    .light_count = light_count,
+                    .sky_light = sky_light_idx,
+                    .light_sampling = (uint32_t) light_sampling,
+                    .sampler = (uint32_t) sampler,
+                    .sample_index = r,
+                    .count_rays = 0,
+                };
+                compute_command_buffer.pushConstants(
+                    megakernel_raytracer.pipeline_layout,
+                    vk::ShaderStageFlagBits::eCompute, 0,
+                    (uint32_t) sizeof(megakernel_raytracer_pc),
+                    &megakernel_raytracer_pc);
+                begin_gpu_scope(compute_command_buffer,
+                    vk::PipelineBindPoint::eCompute, "tuning");
+                dispatch_pixels(compute_command_buffer, offset, extent);
+                end_gpu_scope(
+                    compute_command_buffer, vk::PipelineBindPoint::eCompute);
+                // the next round adds to the sums of this one
+                vk::MemoryBarrier const round_barrier{
+                    .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+                    .dstAccessMask = vk::AccessFlagBits::eShaderRead |
+                                     vk::AccessFlagBits::eShaderWrite,
+                };
+                compute_command_buffer.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eComputeShader,
+                    vk::PipelineStageFlagBits::eComputeShader, {}, 1,
+                    &round_barrier, 0, nullptr, 0, nullptr);
+            }
+            submit_command_buffer(vk::PipelineBindPoint::eCompute);
+            wait_submission(vk::PipelineBindPoint::eCompute,
+                get_submission_serial(vk::PipelineBindPoint::eCompute));
+            collect_gpu_profile();
+            std::vector<float> const rounds = get_collected_gpu_times(
+                vk::PipelineBindPoint::eCompute, "tuning");
+            CHECK(rounds.size() == TUNING_ROUND, "Tuning scopes are lost");
+            float const milliseconds =
+                *std::min_element(rounds.begin() + 1, rounds.end());
+            fmt::println("  {}x{}, {} of {} stack entries shared: {:.3f} ms",
+                candidate.x, candidate.y,
+                get_shared_stack_split(shared_stack, traversal_stack_size),
+                traversal_stack_size, milliseconds);
+            if (milliseconds < best_milliseconds) {
+                best_milliseconds = milliseconds;
+                best = {.workgroup_size = candidate,
+                    .shared_stack_size = shared_stack};
+            }
+        }
+    }
+    device.destroyPipeline(megakernel_raytracer.pipeline);
+    megakernel_raytracer.pipeline = create_megakernel_raytracer_variant(
+        best.workgroup_size, best.shared_stack_size);
+    workgroup_size = best.workgroup_size;
+    shared_stack_size = best.shared_stack_size;
+    // the first sample starts from an empty accumulation
+    clear_accumulation(
+        get_command_buffer(vk::PipelineBindPoint::eCompute).first);
+    save_kernel_tuning(WORKGROUP_SIZE_CACHE, get_device_key(physical_device),
+        "megakernel_raytracer", best);
+    fmt::println("Selected workgroup size {}x{} with {} of {} stack entries "
+                 "shared",
+        best.workgroup_size.x, best.workgroup_size.y,
+        get_shared_stack_split(best.shared_stack_size, traversal_stack_size),
+        traversal_stack_size);
+}
+
 static void destroy_megakernel_raytracer_pipeline() {
     for (uint32_t s = 0; s < MEGAKERNAL_RAYTRACER_SET; ++s) {
         device.destroyDescriptorSetLayout(
@@ -274,16 +556,38 @@ static void prepare_megakernel_raytracer_resources(scene const& scene) {
                         (int32_t) scene.lights.size() - 1 :
                         -1;
     bvh const bvh = create_bvh(scene);
+    uint32_t const stack_size = get_traversal_stack_size(bvh);
+    if (stack_size != traversal_stack_size) {
+        // the samples of the previous scene are done with the kernel
+        wait_vulkan();
+        traversal_stack_size = stack_size;
+        device.destroyPipeline(megakernel_raytracer.pipeline);
+        megakernel_raytracer.pipeline = create_megakernel_raytracer_variant(
+            workgroup_size, shared_stack_size);
+    }
+    aabb const& bounds = bvh.tlas[0].aabb;
+    glm::vec3 const center = get_aabb_centroid(bounds);
+    tuning_camera = create_camera(
+        center + glm::vec3{0.0f, 0.0f, glm::length(get_aabb_extent(bounds))},
+        center, 45.0f);
+    std::vector<glsl_light_bvh_node> const light_bvh =
+        create_light_bvh(scene, bvh);
+    std::vector<float> const sky_distribution = create_sky_distribution(scene);
+    std::vector<glsl_alias_entry> const light_alias =
+        create_light_alias_tables(scene, bvh, light_bvh);
     std::vector<glm::mat4> inverse_transformations{};
     inverse_transformations.reserve(scene.transformation.size());
     for (uint32_t t = 0; t < scene.transformation.size(); ++t) {
         inverse_transformations.push_back(
             glm::inverse(scene.transformation[t]));
     }
-    auto const [graphics_command_buffer, graphics_sync_idx] =
-        get_command_buffer(vk::PipelineBindPoint::eGraphics);
     auto const [compute_command_buffer, compute_sync_idx] =
         get_command_buffer(vk::PipelineBindPoint::eCompute);
+    // there is no graphics queue work when rendering headless
+    vk::CommandBuffer const graphics_command_buffer =
+        is_headless() ?
+            compute_command_buffer :
+            get_command_buffer(vk::PipelineBindPoint::eGraphics).first;
     megakernel_raytracer.tlas_buffer = create_gpu_only_buffer(vma_alloc,
         size_in_byte(bvh.tlas), {}, vk::BufferUsageFlagBits::eStorageBuffer);
     megakernel_raytracer.blas_buffer = create_gpu_only_buffer(vma_alloc,
@@ -311,17 +615,30 @@ static void prepare_megakernel_raytracer_resources(scene const& scene) {
     megakernel_raytracer.light_buffer =
         create_gpu_only_buffer(vma_alloc, size_in_byte(scene.lights), {},
             vk::BufferUsageFlagBits::eStorageBuffer);
-    megakernel_raytracer.preview_image = create_texture2d(device, vma_alloc,
-        compute_command_buffer, preview_width, preview_height, 1,
-        vk::Format::eR32G32B32A32Sfloat,
-        {command_queues.graphics_queue_idx, command_queues.compute_queue_idx},
-        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage);
-    megakernel_raytracer.accumulation_image = create_texture2d(device,
-        vma_alloc, compute_command_buffer, swapchain_extent.width,
-        swapchain_extent.height, 1, vk::Format::eR32G32B32A32Sfloat, {},
-        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage |
-            vk::ImageUsageFlagBits::eTransferSrc |
-            vk::ImageUsageFlagBits::eTransferDst);
+    megakernel_raytracer.light_bvh_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(light_bvh), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    megakernel_raytracer.sky_distribution_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(sky_distribution), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    megakernel_raytracer.light_alias_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(light_alias), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    megakernel_raytracer.ray_counter_buffer =
+        create_gpu_only_buffer(vma_alloc, 2 * (uint32_t) sizeof(uint32_t), {},
+            vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eTransferSrc);
+    megakernel_raytracer.work_counter_buffer =
+        create_gpu_only_buffer(vma_alloc, (uint32_t) sizeof(uint32_t), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    megakernel_raytracer.preview_history_buffer = create_gpu_only_buffer(
+        vma_alloc, (uint32_t) sizeof(glsl_preview_history), {},
+        vk::BufferUsageFlagBits::eStorageBuffer);
+    update_buffer(vma_alloc, compute_command_buffer,
+        megakernel_raytracer.preview_history_buffer,
+        to_byte_span(glsl_preview_history{}), 0);
+    prepare_accumulation_images(
+        compute_command_buffer, graphics_command_buffer);
     for (uint32_t t = 0; t < scene.textures.size(); ++t) {
         texture_data const& data = scene.textures[t];
         vk::Format const format = data.format == texture_format::unorm ?
@@ -335,11 +652,8 @@ static void prepare_megakernel_raytracer_resources(scene const& scene) {
                 vk::ImageUsageFlagBits::eSampled |
                     vk::ImageUsageFlagBits::eTransferDst));
     }
-    megakernel_raytracer.output_image = create_texture2d(device, vma_alloc,
-        graphics_command_buffer, swapchain_extent.width,
-        swapchain_extent.height, 1, vk::Format::eR32G32B32A32Sfloat, {},
-        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage |
-            vk::ImageUsageFlagBits::eTransferDst);
+    begin_gpu_scope(
+        compute_command_buffer, vk::PipelineBindPoint::eCompute, "upload");
     update_buffer(vma_alloc, compute_command_buffer,
         megakernel_raytracer.tlas_buffer, to_byte_span(bvh.tlas), 0);
     update_buffer(vma_alloc, compute_command_buffer,
@@ -362,6 +676,14 @@ static void prepare_megakernel_raytracer_resources(scene const& scene) {
         megakernel_raytracer.medium_buffer, to_byte_span(scene.mediums), 0);
     update_buffer(vma_alloc, compute_command_buffer,
         megakernel_raytracer.light_buffer, to_byte_span(scene.lights), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        megakernel_raytracer.light_bvh_buffer, to_byte_span(light_bvh), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        megakernel_raytracer.sky_distribution_buffer,
+        to_byte_span(sky_distribution), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        megakernel_raytracer.light_alias_buffer, to_byte_span(light_alias), 0);
+    end_gpu_scope(compute_command_buffer, vk::PipelineBindPoint::eCompute);
     for (uint32_t t = 0; t < megakernel_raytracer.texture_array.size(); ++t) {
         update_texture2d(vma_alloc, megakernel_raytracer.texture_array[t],
             graphics_command_buffer, scene.textures[t]);
@@ -378,6 +700,9 @@ static void prepare_megakernel_raytracer_resources(scene const& scene) {
         megakernel_raytracer.material_buffer,
         megakernel_raytracer.medium_buffer,
         megakernel_raytracer.light_buffer,
+        megakernel_raytracer.light_bvh_buffer,
+        megakernel_raytracer.sky_distribution_buffer,
+        megakernel_raytracer.light_alias_buffer,
     };
     std::array<vk::BufferMemoryBarrier, buffers.size()> buffer_barriers{};
     for (uint32_t i = 0; i < buffers.size(); ++i) {
@@ -449,13 +774,25 @@ static void prepare_megakernel_raytracer_resources(scene const& scene) {
         update_descriptor_storage_buffer_whole(device,
             megakernel_raytracer.descriptor_sets[2][f], 2, 0,
             megakernel_raytracer.light_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            megakernel_raytracer.descriptor_sets[2][f], 3, 0,
+            megakernel_raytracer.light_bvh_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            megakernel_raytracer.descriptor_sets[2][f], 4, 0,
+            megakernel_raytracer.sky_distribution_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            megakernel_raytracer.descriptor_sets[2][f], 5, 0,
+            megakernel_raytracer.light_alias_buffer);
         // set 3
-        update_descriptor_storage_image(device,
-            megakernel_raytracer.descriptor_sets[3][f], 0, 0,
-            megakernel_raytracer.accumulation_image.primary_view);
-        update_descriptor_storage_image(device,
-            megakernel_raytracer.descriptor_sets[3][f], 0, 1,
-            megakernel_raytracer.preview_image.primary_view);
+        update_descriptor_storage_buffer_whole(device,
+            megakernel_raytracer.descriptor_sets[3][f], 2, 0,
+            megakernel_raytracer.ray_counter_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            megakernel_raytracer.descriptor_sets[3][f], 3, 0,
+            megakernel_raytracer.work_counter_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            megakernel_raytracer.descriptor_sets[3][f], 7, 0,
+            megakernel_raytracer.preview_history_buffer);
         for (uint32_t t = 0; t < megakernel_raytracer.texture_array.size();
              ++t) {
             update_descriptor_image_sampler_combined(device,
@@ -477,317 +814,946 @@ static void clean_megakernel_raytracer_resources() {
     destroy_buffer(vma_alloc, megakernel_raytracer.material_buffer);
     destroy_buffer(vma_alloc, megakernel_raytracer.medium_buffer);
     destroy_buffer(vma_alloc, megakernel_raytracer.light_buffer);
-    destroy_image(device, vma_alloc, megakernel_raytracer.accumulation_image);
-    destroy_image(device, vma_alloc, megakernel_raytracer.preview_image);
-    destroy_image(device, vma_alloc, megakernel_raytracer.output_image);
+    destroy_buffer(vma_alloc, megakernel_raytracer.light_bvh_buffer);
+    destroy_buffer(vma_alloc, megakernel_raytracer.sky_distribution_buffer);
+    destroy_buffer(vma_alloc, megakernel_raytracer.light_alias_buffer);
+    destroy_buffer(vma_alloc, megakernel_raytracer.preview_history_buffer);
+    destroy_buffer(vma_alloc, megakernel_raytracer.ray_counter_buffer);
+    destroy_buffer(vma_alloc, megakernel_raytracer.work_counter_buffer);
+    clean_accumulation_images();
     for (uint32_t i = 0; i < megakernel_raytracer.texture_array.size(); ++i) {
         destroy_image(device, vma_alloc, megakernel_raytracer.texture_array[i]);
     }
     megakernel_raytracer.texture_array.clear();
 }
 
-static void create_rect_pipeline() {
-    std::vector<vk_descriptor_set_binding> bindings{
-        {vk::DescriptorType::eCombinedImageSampler, 2}
+static void prepare_accumulation_images(
+    vk::CommandBuffer compute_command_buffer,
+    vk::CommandBuffer graphics_command_buffer) {
+    megakernel_raytracer.accumulation_image = create_texture2d(device,
+        vma_alloc, compute_command_buffer, render_extent.width,
+        render_extent.height, 1, vk::Format::eR32G32B32A32Sfloat, {},
+        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage |
+            vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eTransferDst);
+    megakernel_raytracer.output_image = create_texture2d(device, vma_alloc,
+        graphics_command_buffer, render_extent.width, render_extent.height, 1,
+        vk::Format::eR32G32B32A32Sfloat, {},
+        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage |
+            vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eTransferDst);
+    // 1x1 stand-ins keep the descriptors valid while an image isn't in use
+    for (uint32_t i = 0; i < AOV_IMAGE; ++i) {
+        bool const in_use = (aov_images & (1u << i)) != 0;
+        megakernel_raytracer.aov_images[i] = create_texture2d(device,
+            vma_alloc, compute_command_buffer,
+            in_use ? render_extent.width : 1,
+            in_use ? render_extent.height : 1, 1,
+            vk::Format::eR32G32B32A32Sfloat, {},
+            vk::ImageUsageFlagBits::eStorage |
+                vk::ImageUsageFlagBits::eTransferSrc |
+                vk::ImageUsageFlagBits::eTransferDst);
+    }
+    for (vk_image& image : megakernel_raytracer.filtered_images) {
+        image = create_texture2d(device, vma_alloc, compute_command_buffer,
+            denoise ? render_extent.width : 1,
+            denoise ? render_extent.height : 1, 1,
+            vk::Format::eR32G32B32A32Sfloat, {},
+            vk::ImageUsageFlagBits::eStorage);
+    }
+    // the preview may take up to every pixel, offscreen renders never preview
+    uint32_t const preview_width = is_headless() ? 1 : render_extent.width;
+    uint32_t const preview_height = is_headless() ? 1 : render_extent.height;
+    megakernel_raytracer.preview_image = create_texture2d(device, vma_alloc,
+        compute_command_buffer, preview_width, preview_height, 1,
+        vk::Format::eR32G32B32A32Sfloat, {},
+        vk::ImageUsageFlagBits::eStorage |
+            vk::ImageUsageFlagBits::eTransferSrc);
+    // written by the compute queue and sampled by the graphics queue
+    for (vk_image& image : megakernel_raytracer.display_images) {
+        image = create_texture2d(device, vma_alloc, compute_command_buffer,
+            preview_width, preview_height, 1, vk::Format::eR32G32B32A32Sfloat,
+            {command_queues.graphics_queue_idx,
+                command_queues.compute_queue_idx},
+            vk::ImageUsageFlagBits::eSampled |
+                vk::ImageUsageFlagBits::eTransferDst);
+    }
+    {
+        std::lock_guard const lock{display_mutex};
+        latest_publication = {};
+        display_reads = {};
+    }
+    for (uint32_t i = 0; i < 2; ++i) {
+        megakernel_raytracer.history_images[i] = create_texture2d(device,
+            vma_alloc, compute_command_buffer, preview_width, preview_height,
+            1, vk::Format::eR32G32B32A32Sfloat, {},
+            vk::ImageUsageFlagBits::eStorage);
+        megakernel_raytracer.history_guide_images[i] = create_texture2d(device,
+            vma_alloc, compute_command_buffer, preview_width, preview_height,
+            1, vk::Format::eR32G32B32A32Sfloat, {},
+            vk::ImageUsageFlagBits::eStorage);
+    }
+    previous_preview.reset();
+    for (uint32_t f = 0; f < FRAME_IN_FLIGHT; ++f) {
+        update_descriptor_storage_image(device,
+            megakernel_raytracer.descriptor_sets[3][f], 0, 0,
+            megakernel_raytracer.accumulation_image.primary_view);
+        update_descriptor_storage_image(device,
+            megakernel_raytracer.descriptor_sets[3][f], 0, 1,
+            megakernel_raytracer.preview_image.primary_view);
+        for (uint32_t i = 0; i < 2; ++i) {
+            update_descriptor_storage_image(device,
+                megakernel_raytracer.descriptor_sets[3][f], 5, i,
+                megakernel_raytracer.history_images[i].primary_view);
+            update_descriptor_storage_image(device,
+                megakernel_raytracer.descriptor_sets[3][f], 6, i,
+                megakernel_raytracer.history_guide_images[i].primary_view);
+            update_descriptor_storage_image(device,
+                upscaler.descriptor_sets[f], 0, i,
+                megakernel_raytracer.history_images[i].primary_view);
+            update_descriptor_storage_image(device,
+                upscaler.descriptor_sets[f], 1, i,
+                megakernel_raytracer.history_guide_images[i].primary_view);
+        }
+        update_descriptor_storage_image(device, upscaler.descriptor_sets[f],
+            2, 0, megakernel_raytracer.preview_image.primary_view);
+        update_descriptor_storage_image(device,
+            denoiser.descriptor_sets[f], 0, 0,
+            megakernel_raytracer.accumulation_image.primary_view);
+        for (uint32_t i = 0; i < AOV_IMAGE; ++i) {
+            update_descriptor_storage_image(device,
+                megakernel_raytracer.descriptor_sets[3][f], 4, i,
+                megakernel_raytracer.aov_images[i].primary_view);
+        }
+        // the albedo and the normal with depth guide the denoiser, the
+        // running statistics give the variance
+        std::array const features{AOV_IMAGE_ALBEDO, AOV_IMAGE_NORMAL_DEPTH,
+            AOV_IMAGE_VARIANCE};
+        for (uint32_t i = 0; i < features.size(); ++i) {
+            update_descriptor_storage_image(device,
+                denoiser.descriptor_sets[f], 1, i,
+                megakernel_raytracer
+                    .aov_images[(uint32_t) std::countr_zero(features[i])]
+                    .primary_view);
+        }
+        for (uint32_t i = 0; i < 2; ++i) {
+            update_descriptor_storage_image(device,
+                denoiser.descriptor_sets[f], 2, i,
+                megakernel_raytracer.filtered_images[i].primary_view);
+        }
+        update_descriptor_storage_image(device,
+            denoiser.descriptor_sets[f], 3, 0,
+            megakernel_raytracer.output_image.primary_view);
+    }
+}
+
+static void clean_accumulation_images() {
+    destroy_image(device, vma_alloc, megakernel_raytracer.accumulation_image);
+    destroy_image(device, vma_alloc, megakernel_raytracer.output_image);
+    destroy_image(device, vma_alloc, megakernel_raytracer.preview_image);
+    for (vk_image& image : megakernel_raytracer.display_images) {
+        destroy_image(device, vma_alloc, image);
+        image = {};
+    }
+    for (uint32_t i = 0; i < 2; ++i) {
+        destroy_image(
+            device, vma_alloc, megakernel_raytracer.history_images[i]);
+        destroy_image(
+            device, vma_alloc, megakernel_raytracer.history_guide_images[i]);
+    }
+    for (vk_image& image : megakernel_raytracer.aov_images) {
+        destroy_image(device, vma_alloc, image);
+        image = {};
+    }
+    for (vk_image& image : megakernel_raytracer.filtered_images) {
+        destroy_image(device, vma_alloc, image);
+        image = {};
+    }
+    clean_raytracer_read_backs();
+    megakernel_raytracer.accumulation_image = {};
+    megakernel_raytracer.output_image = {};
+}
+
+static void apply_render_options(render_options const& options) {
+    tiles.count.x = options.resolution_x / options.tile_width;
+    tiles.count.y = options.resolution_y / options.tile_height;
+    tiles.size.x = options.tile_width;
+    tiles.size.y = options.tile_height;
+    max_tracing_depth = options.max_depth;
+    base_seed = options.seed;
+    persistent_threads = options.persistent_threads;
+    light_sampling = options.light_sampling;
+    sampler = options.sampler;
+    denoise = options.denoise;
+    aovs = options.aovs;
+    aov_images = get_aov_images(options);
+    adaptive_threshold = options.adaptive_threshold;
+    preview_frame_time = options.preview_frame_time;
+    tile_frame_time = options.tile_frame_time;
+}
+
+// Every AOV is divided by the sample count of its pixel, the denoiser is
+// guided by the albedo, normal and depth, and both the denoiser and adaptive
+// sampling need the variance of every pixel.
+static uint32_t get_aov_images(render_options const& options) {
+    uint32_t images = 0;
+    if (options.aovs != 0 || options.denoise) {
+        images |= AOV_IMAGE_ALBEDO;
+    }
+    if ((options.aovs & (AOV_NORMAL | AOV_DEPTH)) != 0 || options.denoise) {
+        images |= AOV_IMAGE_NORMAL_DEPTH;
+    }
+    if ((options.aovs & AOV_DIRECT) != 0) {
+        images |= AOV_IMAGE_DIRECT;
+    }
+    if ((options.aovs & AOV_INDIRECT) != 0) {
+        images |= AOV_IMAGE_INDIRECT;
+    }
+    if ((options.aovs & AOV_EMISSION) != 0) {
+        images |= AOV_IMAGE_EMISSION;
+    }
+    if (options.denoise || options.adaptive_threshold > 0.0f) {
+        images |= AOV_IMAGE_VARIANCE;
+    }
+    return images;
+}
+
+static void prepare_rect_resources() {
+    for (uint32_t i = 0; i < DISPLAY_IMAGE; ++i) {
+        set_raytracer_frame_image(i, primary_sampler,
+            megakernel_raytracer.display_images[i].primary_view);
+    }
+}
+
+static void bind_megakernel_raytracer(
+    vk::CommandBuffer command_buffer, uint32_t sync_idx) {
+    command_buffer.bindPipeline(
+        vk::PipelineBindPoint ::eCompute, megakernel_raytracer.pipeline);
+    std::array<vk::DescriptorSet, MEGAKERNAL_RAYTRACER_SET>
+        megakernel_raytracer_sets{};
+    for (uint32_t s = 0; s < MEGAKERNAL_RAYTRACER_SET; ++s) {
+        megakernel_raytracer_sets[s] =
+            megakernel_raytracer.descriptor_sets[s][sync_idx];
+    }
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+        megakernel_raytracer.pipeline_layout, 0, MEGAKERNAL_RAYTRACER_SET,
+        megakernel_raytracer_sets.data(), 0, nullptr);
+}
+
+// Workgroups overhanging the pixels skip them in the shader, so tiles and
+// regions need not be multiples of the workgroup size. Persistent threads
+// instead claim the pixels from the work counter, which starts at 0. Adaptive
+// sampling always takes the persistent path, so lanes skipping converged
+// pixels move on to pixels still needing samples instead of idling.
+static void dispatch_pixels(vk::CommandBuffer command_buffer,
+    glm::uvec2 offset, glm::uvec2 extent) {
+    std::array const rect{offset, offset + extent};
+    command_buffer.pushConstants(megakernel_raytracer.pipeline_layout,
+        vk::ShaderStageFlagBits::eCompute,
+        (uint32_t) offsetof(megakernel_raytracer_pc, rect_min),
+        (uint32_t) sizeof(rect), rect.data());
+    bool const use_persistent =
+        persistent_threads || adaptive_threshold > 0.0f;
+    uint32_t const persistent = use_persistent ? 1 : 0;
+    command_buffer.pushConstants(megakernel_raytracer.pipeline_layout,
+        vk::ShaderStageFlagBits::eCompute,
+        (uint32_t) offsetof(megakernel_raytracer_pc, persistent),
+        (uint32_t) sizeof(persistent), &persistent);
+    if (!use_persistent) {
+        auto const [first, count] =
+            get_workgroup_range(offset, extent, workgroup_size);
+        command_buffer.dispatchBase(first.x, first.y, 0, count.x, count.y, 1);
+        return;
+    }
+    vk::BufferMemoryBarrier const previous_barrier{
+        .srcAccessMask =
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .buffer = megakernel_raytracer.work_counter_buffer.buffer,
+        .offset = 0,
+        .size = vk::WholeSize,
+    };
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eTransfer, {}, 0, nullptr, 1,
+        &previous_barrier, 0, nullptr);
+    command_buffer.fillBuffer(
+        megakernel_raytracer.work_counter_buffer.buffer, 0, vk::WholeSize, 0);
+    vk::BufferMemoryBarrier const reset_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask =
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .buffer = megakernel_raytracer.work_counter_buffer.buffer,
+        .offset = 0,
+        .size = vk::WholeSize,
+    };
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader, {}, 0, nullptr, 1,
+        &reset_barrier, 0, nullptr);
+    uint32_t const invocations = workgroup_size.x * workgroup_size.y;
+    uint32_t const needed =
+        (extent.x * extent.y + invocations - 1) / invocations;
+    command_buffer.dispatch(std::min(needed, PERSISTENT_WORKGROUPS), 1, 1);
+}
+
+// Points the next preview at the history of the last one, previews before it
+// render without history.
+static void update_preview_history(vk::CommandBuffer command_buffer,
+    glsl_raytracer_camera const& camera, glm::uvec2 extent) {
+    history_index ^= 1;
+    preview_frame const previous =
+        previous_preview.value_or(preview_frame{camera, extent});
+    glsl_preview_history const history{
+        .previous_camera = previous.camera,
+        .previous_extent = previous.extent,
+        .history_index = history_index,
+        .history_valid = previous_preview.has_value() ? 1u : 0u,
+    };
+    previous_preview = preview_frame{camera, extent};
+    vk::BufferMemoryBarrier const previous_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderRead,
+        .dstAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .buffer = megakernel_raytracer.preview_history_buffer.buffer,
+        .offset = 0,
+        .size = vk::WholeSize,
+    };
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eTransfer, {}, 0, nullptr, 1,
+        &previous_barrier, 0, nullptr);
+    command_buffer.updateBuffer(
+        megakernel_raytracer.preview_history_buffer.buffer, 0,
+        sizeof(history), &history);
+    // the history images of the last preview are read by this one
+    vk::MemoryBarrier const update_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite |
+                         vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask =
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+    };
+    command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader, {}, 1, &update_barrier, 0,
+        nullptr, 0, nullptr);
+}
+
+static void clear_accumulation(vk::CommandBuffer command_buffer) {
+    std::array const images{
+        megakernel_raytracer.accumulation_image.image,
+        megakernel_raytracer.aov_images[0].image,
+        megakernel_raytracer.aov_images[1].image,
+        megakernel_raytracer.aov_images[2].image,
+        megakernel_raytracer.aov_images[3].image,
+        megakernel_raytracer.aov_images[4].image,
+        megakernel_raytracer.aov_images[5].image,
+    };
+    clear_raytracer_accumulation(command_buffer, images,
+        megakernel_raytracer.ray_counter_buffer.buffer);
+}
+
+// Headless rendering has nothing to keep responsive, so every tile of one
+// sample is recorded into the same command buffer.
+static void accumulate_offscreen(camera const& camera) {
+    auto const [compute_command_buffer, compute_sync_idx] =
+        get_command_buffer(vk::PipelineBindPoint::eCompute);
+    bind_megakernel_raytracer(compute_command_buffer, compute_sync_idx);
+    if (camera.dirty) {
+        accumulation_counter = 0;
+        tiles.current.x = 0;
+        tiles.current.y = 0;
+    }
+    if (accumulation_counter == 0) {
+        begin_gpu_scope(
+            compute_command_buffer, vk::PipelineBindPoint::eCompute, "clear");
+        clear_accumulation(compute_command_buffer);
+        end_gpu_scope(compute_command_buffer, vk::PipelineBindPoint::eCompute);
+    }
+    megakernel_raytracer_pc const megakernel_raytracer_pc{
+        .camera = get_glsl_raytracer_camera(
+            camera, render_extent.width, render_extent.height),
+        .random_seed = get_sample_seed(base_seed, sampler,
+            region.first_sample + accumulation_counter),
+        .preview = 0,
+        .max_depth = max_tracing_depth,
+        .light_count = light_count,
+        .sky_light = sky_light_idx,
+        .light_sampling = (uint32_t) light_sampling,
+        .sampler = (uint32_t) sampler,
+        .sample_index = region.first_sample + accumulation_counter,
+        .count_rays = 1,
+        .aovs = aov_images,
+        .adaptive_threshold = adaptive_threshold,
+    };
+    compute_command_buffer.pushConstants(megakernel_raytracer.pipeline_layout,
+        vk::ShaderStageFlagBits::eCompute, 0,
+        (uint32_t) sizeof(megakernel_raytracer_pc), &megakernel_raytracer_pc);
+    begin_gpu_scope(
+        compute_command_buffer, vk::PipelineBindPoint::eCompute, "sample");
+    bool finished = false;
+    if (region.width != 0) {
+        dispatch_pixels(compute_command_buffer, {region.x, region.y},
+            {region.width, region.height});
+        finished = true;
+    }
+    while (!finished) {
+        glm::uvec2 const viewport = current_viewport();
+        dispatch_pixels(compute_command_buffer, viewport, tiles.size);
+        finished = next_tile();
+    }
+    end_gpu_scope(compute_command_buffer, vk::PipelineBindPoint::eCompute);
+    ++accumulation_counter;
+    // the next sample accumulates on top of this one
+    vk::ImageMemoryBarrier const render_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask =
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+        .oldLayout = vk::ImageLayout::eGeneral,
+        .newLayout = vk::ImageLayout::eGeneral,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .image = megakernel_raytracer.accumulation_image.image,
+        .subresourceRange = whole_range,
+    };
+    compute_command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eComputeShader, {}, 0, nullptr, 0, nullptr,
+        1, &render_barrier);
+}
+
+// The output image shows the sums of the finished samples.
+static void copy_accumulation(vk::CommandBuffer command_buffer) {
+    vk::ImageMemoryBarrier const render_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eTransferRead,
+        .oldLayout = vk::ImageLayout::eGeneral,
+        .newLayout = vk::ImageLayout::eGeneral,
+        .srcQueueFamilyIndex = command_queues.compute_queue_idx,
+        .dstQueueFamilyIndex = command_queues.compute_queue_idx,
+        .image = megakernel_raytracer.accumulation_image.image,
+        .subresourceRange = whole_range,
+    };
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eTransfer, {}, 0, nullptr, 0, nullptr, 1,
+        &render_barrier);
+    vk::ImageSubresourceLayers const layer{
+        .aspectMask = vk::ImageAspectFlagBits::eColor,
+        .mipLevel = 0,
+        .baseArrayLayer = 0,
+        .layerCount = 1,
     };
-    rect.descriptor_layout = create_descriptor_set_layout(
-        device, vk::ShaderStageFlagBits::eFragment, bindings);
+    vk::Offset3D const offset{0, 0, 0};
+    vk::Extent3D const extent{
+        megakernel_raytracer.accumulation_image.width,
+        megakernel_raytracer.accumulation_image.height,
+        1,
+    };
+    vk::ImageCopy const image_copy{
+        .srcSubresource = layer,
+        .srcOffset = offset,
+        .dstSubresource = layer,
+        .dstOffset = offset,
+        .extent = extent,
+    };
+    command_buffer.copyImage(megakernel_raytracer.accumulation_image.image,
+        vk::ImageLayout::eGeneral, megakernel_raytracer.output_image.image,
+        vk::ImageLayout::eGeneral, 1, &image_copy);
+}
+
+// Copies the finished preview or sweep into the display image the window
+// isn't sampling, after the window frames that sampled it before.
+static void publish_display_image(
+    vk::CommandBuffer command_buffer, vk_image const& source) {
+    uint32_t image = 0;
+    uint64_t last_read = 0;
+    {
+        std::lock_guard const lock{display_mutex};
+        image = latest_publication.submission == 0 ?
+                    0 :
+                    (latest_publication.image + 1) % DISPLAY_IMAGE;
+        last_read = display_reads[image];
+    }
+    if (last_read != 0) {
+        add_submission_wait(vk::PipelineBindPoint::eCompute,
+            vk::PipelineBindPoint::eGraphics, last_read,
+            vk::PipelineStageFlagBits::eTransfer);
+    }
+    vk::MemoryBarrier const source_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite |
+                         vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlagBits::eTransferRead |
+                         vk::AccessFlagBits::eTransferWrite,
+    };
+    command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eTransfer, {}, 1, &source_barrier, 0,
+        nullptr, 0, nullptr);
+    vk::ImageSubresourceLayers const layer{
+        .aspectMask = vk::ImageAspectFlagBits::eColor,
+        .mipLevel = 0,
+        .baseArrayLayer = 0,
+        .layerCount = 1,
+    };
+    vk::ImageCopy const image_copy{
+        .srcSubresource = layer,
+        .srcOffset = {0, 0, 0},
+        .dstSubresource = layer,
+        .dstOffset = {0, 0, 0},
+        .extent = {source.width, source.height, 1},
+    };
+    command_buffer.copyImage(source.image, vk::ImageLayout::eGeneral,
+        megakernel_raytracer.display_images[image].image,
+        vk::ImageLayout::eGeneral, 1, &image_copy);
+    // later previews, sweeps and denoises write the source again
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eTransfer,
+        {}, 0, nullptr, 0, nullptr, 0, nullptr);
+    pending_publication = image;
+}
+
+static void create_denoiser_pipeline() {
+    std::vector<vk_descriptor_set_binding> const bindings{
+        {vk::DescriptorType::eStorageImage, 1},
+        {vk::DescriptorType::eStorageImage, 3},
+        {vk::DescriptorType::eStorageImage, 2},
+        {vk::DescriptorType::eStorageImage, 1},
+    };
+    denoiser.descriptor_layout = create_descriptor_set_layout(
+        device, vk::ShaderStageFlagBits::eCompute, bindings);
     create_descriptor_set(device, primary_descriptor_pool,
-        rect.descriptor_layout, rect.descriptor_sets);
-    std::array pc_sizes{(uint32_t) sizeof(rect_pc)};
-    std::array pc_stages{vk::ShaderStageFlagBits::eFragment};
-    std::array layouts{rect.descriptor_layout};
-    rect.pipeline_layout =
+        denoiser.descriptor_layout, denoiser.descriptor_sets);
+    std::array pc_sizes{(uint32_t) sizeof(denoiser_pc)};
+    std::array pc_stages{vk::ShaderStageFlagBits::eCompute};
+    std::array layouts{denoiser.descriptor_layout};
+    denoiser.pipeline_layout =
         create_pipeline_layout(device, pc_sizes, pc_stages, layouts);
-    rect.pipeline = create_graphics_pipeline(device,
-        PATH_FROM_BINARY("shaders/rect.vert.spv"),
-        PATH_FROM_BINARY("shaders/rect.frag.spv"), rect.pipeline_layout,
-        frame_objects.render_pass, {}, vk::PolygonMode::eFill, false, false);
+    denoiser.pipeline = create_compute_pipeline(device,
+        PATH_FROM_BINARY("shaders/denoise.comp.spv"), denoiser.pipeline_layout,
+        {});
 }
 
-static void destroy_rect_pipeline() {
-    device.destroyDescriptorSetLayout(rect.descriptor_layout);
-    device.destroyPipelineLayout(rect.pipeline_layout);
-    device.destroy(rect.pipeline);
+static void destroy_denoiser_pipeline() {
+    device.destroyDescriptorSetLayout(denoiser.descriptor_layout);
+    device.destroyPipelineLayout(denoiser.pipeline_layout);
+    device.destroy(denoiser.pipeline);
 }
 
-static void prepare_rect_resources() {
-    for (uint32_t f = 0; f < FRAME_IN_FLIGHT; ++f) {
-        update_descriptor_image_sampler_combined(device,
-            rect.descriptor_sets[f], 0, 0, primary_sampler,
-            megakernel_raytracer.output_image.primary_view);
-        update_descriptor_image_sampler_combined(device,
-            rect.descriptor_sets[f], 0, 1, blocky_sampler,
-            megakernel_raytracer.preview_image.primary_view);
+// Filters the mean of the accumulation into the output image, every pass
+// waits for the previous one.
+static void denoise_accumulation(
+    vk::CommandBuffer command_buffer, uint32_t sync_idx) {
+    // the last samples and the copies of an earlier denoise
+    vk::MemoryBarrier const previous_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite |
+                         vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask =
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+    };
+    command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader, {}, 1, &previous_barrier, 0,
+        nullptr, 0, nullptr);
+    command_buffer.bindPipeline(
+        vk::PipelineBindPoint::eCompute, denoiser.pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+        denoiser.pipeline_layout, 0, 1, &denoiser.descriptor_sets[sync_idx], 0,
+        nullptr);
+    uint32_t const group_x = (render_extent.width + 7) / 8;
+    uint32_t const group_y = (render_extent.height + 7) / 8;
+    for (uint32_t i = 0; i < DENOISE_ITERATION; ++i) {
+        denoiser_pc const denoiser_pc{
+            .iteration = i,
+            .iteration_count = DENOISE_ITERATION,
+        };
+        command_buffer.pushConstants(denoiser.pipeline_layout,
+            vk::ShaderStageFlagBits::eCompute, 0,
+            (uint32_t) sizeof(denoiser_pc), &denoiser_pc);
+        command_buffer.dispatch(group_x, group_y, 1);
+        vk::MemoryBarrier const pass_barrier{
+            .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+            .dstAccessMask = vk::AccessFlagBits::eShaderRead |
+                             vk::AccessFlagBits::eShaderWrite,
+        };
+        command_buffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader,
+            vk::PipelineStageFlagBits::eComputeShader, {}, 1, &pass_barrier, 0,
+            nullptr, 0, nullptr);
     }
 }
 
+static glm::uvec2 get_preview_extent() {
+    glm::vec2 const extent =
+        preview_scale * glm::vec2{render_extent.width, render_extent.height};
+    return glm::max(glm::uvec2{glm::round(extent)}, glm::uvec2{1});
+}
+
+// GPU time of the scopes the last frame recorded into the compute command
+// buffer just begun, the submission of the buffer has finished already.
+// Nothing when that frame recorded none of them or the queue has no
+// timestamps.
+static std::optional<float> get_previous_gpu_time(
+    std::span<char const* const> scopes) {
+    float milliseconds = 0.0f;
+    for (char const* scope : scopes) {
+        for (float const time : get_collected_gpu_times(
+                 vk::PipelineBindPoint::eCompute, scope)) {
+            milliseconds += time;
+        }
+    }
+    if (milliseconds <= 0.0f) {
+        return std::nullopt;
+    }
+    return milliseconds;
+}
+
+// Scales the pixels times samples of the preview by the ratio of the budget
+// to the GPU time of an earlier preview. The square root damps the reaction,
+// that preview is a few frames old.
+static void scale_preview(float milliseconds) {
+    float const ratio =
+        std::clamp(std::sqrt(preview_frame_time / milliseconds), 0.5f, 2.0f);
+    float const work =
+        preview_scale * preview_scale * (float) preview_samples * ratio;
+    preview_samples =
+        std::clamp((uint32_t) work, 1u, MAX_PREVIEW_SAMPLE);
+    preview_scale = std::clamp(std::sqrt(work / (float) preview_samples),
+        MIN_PREVIEW_SCALE, 1.0f);
+}
+
+// Same damped ratio for the tiles of the next frames, at most a sweep.
+static void scale_tiles(float milliseconds) {
+    float const ratio =
+        std::clamp(std::sqrt(tile_frame_time / milliseconds), 0.5f, 2.0f);
+    tiles_per_frame = std::clamp(tiles_per_frame * ratio, 1.0f,
+        (float) (tiles.count.x * tiles.count.y));
+}
+
+static void create_upscaler_pipeline() {
+    std::vector<vk_descriptor_set_binding> const bindings{
+        {vk::DescriptorType::eStorageImage, 2},
+        {vk::DescriptorType::eStorageImage, 2},
+        {vk::DescriptorType::eStorageImage, 1},
+    };
+    upscaler.descriptor_layout = create_descriptor_set_layout(
+        device, vk::ShaderStageFlagBits::eCompute, bindings);
+    create_descriptor_set(device, primary_descriptor_pool,
+        upscaler.descriptor_layout, upscaler.descriptor_sets);
+    std::array pc_sizes{(uint32_t) sizeof(upscaler_pc)};
+    std::array pc_stages{vk::ShaderStageFlagBits::eCompute};
+    std::array layouts{upscaler.descriptor_layout};
+    upscaler.pipeline_layout =
+        create_pipeline_layout(device, pc_sizes, pc_stages, layouts);
+    upscaler.pipeline = create_compute_pipeline(device,
+        PATH_FROM_BINARY("shaders/preview_upscale.comp.spv"),
+        upscaler.pipeline_layout, {});
+}
+
+static void destroy_upscaler_pipeline() {
+    device.destroyDescriptorSetLayout(upscaler.descriptor_layout);
+    device.destroyPipelineLayout(upscaler.pipeline_layout);
+    device.destroy(upscaler.pipeline);
+}
+
+// Fills the full resolution preview image from the history the last preview
+// sample wrote.
+static void upscale_preview(vk::CommandBuffer command_buffer,
+    uint32_t sync_idx, glm::uvec2 extent) {
+    vk::MemoryBarrier const preview_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eShaderRead,
+    };
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eComputeShader, {}, 1, &preview_barrier, 0,
+        nullptr, 0, nullptr);
+    command_buffer.bindPipeline(
+        vk::PipelineBindPoint::eCompute, upscaler.pipeline);
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+        upscaler.pipeline_layout, 0, 1, &upscaler.descriptor_sets[sync_idx], 0,
+        nullptr);
+    upscaler_pc const upscaler_pc{
+        .preview_extent = extent,
+        .history_index = history_index,
+    };
+    command_buffer.pushConstants(upscaler.pipeline_layout,
+        vk::ShaderStageFlagBits::eCompute, 0, (uint32_t) sizeof(upscaler_pc),
+        &upscaler_pc);
+    command_buffer.dispatch(
+        (render_extent.width + 7) / 8, (render_extent.height + 7) / 8, 1);
+}
+
 void megakernel_raytracer_initialize(render_options const& options) {
     if (initialized) {
         return;
     }
     initialized = true;
-    tiles.count.x = options.resolution_x / options.tile_width;
-    tiles.count.y = options.resolution_y / options.tile_height;
-    tiles.size.x = options.tile_width;
-    tiles.size.y = options.tile_height;
-    max_tracing_depth = options.max_depth;
+    apply_render_options(options);
+    render_extent = get_render_extent(options);
     primary_descriptor_pool = create_descriptor_pool(device);
     indexing_descriptor_pool = create_descriptor_pool(
         device, vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind);
     primary_sampler = create_default_sampler(device);
-    blocky_sampler = create_blocky_sampler(device);
-    vk::SemaphoreCreateInfo const semaphore_info{};
-    vk::Result result;
-    for (uint32_t f = 0; f < FRAME_IN_FLIGHT; ++f) {
-        VK_CHECK_CREATE(result, compute_semaphores[f],
-            device.createSemaphore(semaphore_info));
-        VK_CHECK_CREATE(result, graphics_semaphores[f],
-            device.createSemaphore(semaphore_info));
-        VK_CHECK_CREATE(result, present_semaphores[f],
-            device.createSemaphore(semaphore_info));
-    }
-    create_frame_objects();
     create_megakernel_raytracer_pipeline();
-    create_rect_pipeline();
+    create_denoiser_pipeline();
+    create_upscaler_pipeline();
+    if (!is_headless()) {
+        create_raytracer_frame_objects();
+    }
 }
 
 void megakernel_raytracer_prepare_data(scene const& scene) {
-    preview_width = win_width / PREVIEW_RATIO;
-    preview_height = win_height / PREVIEW_RATIO;
     prepare_megakernel_raytracer_resources(scene);
-    prepare_rect_resources();
+    if (!is_headless()) {
+        prepare_rect_resources();
+    }
+    // ahead of the first sample, so no render pays for it
+    if (!workgroup_size_tuned) {
+        tune_workgroup_size(tuning_camera);
+    }
+}
+
+void megakernel_raytracer_set_options(render_options const& options) {
+    // the AOV images are only full sized while in use
+    bool const aovs_changed = get_aov_images(options) != aov_images ||
+                              options.denoise != denoise;
+    apply_render_options(options);
+    accumulation_counter = 0;
+    previous_preview.reset();
+    // the accumulation follows the swapchain when there is a window
+    vk::Extent2D const extent =
+        is_headless() ?
+            vk::Extent2D{options.resolution_x, options.resolution_y} :
+            render_extent;
+    if (extent == render_extent && !aovs_changed) {
+        return;
+    }
+    render_extent = extent;
+    if (!megakernel_raytracer.accumulation_image.image) {
+        return;
+    }
+    wait_vulkan();
+    clean_accumulation_images();
+    auto const [compute_command_buffer, compute_sync_idx] =
+        get_command_buffer(vk::PipelineBindPoint::eCompute);
+    vk::CommandBuffer const graphics_command_buffer =
+        is_headless() ?
+            compute_command_buffer :
+            get_command_buffer(vk::PipelineBindPoint::eGraphics).first;
+    prepare_accumulation_images(
+        compute_command_buffer, graphics_command_buffer);
+    if (!is_headless()) {
+        prepare_rect_resources();
+    }
+}
+
+void megakernel_raytracer_set_region(render_region const& new_region) {
+    check_render_region(new_region, render_extent);
+    region = new_region;
+    accumulation_counter = 0;
 }
 
 void megakernel_raytracer_update_data(scene const&) {
 }
 
 void megakernel_raytracer_render(camera const& camera) {
-    vk::Result result;
-    auto const [compute_command_buffer, compute_sync_idx] =
-        get_command_buffer(vk::PipelineBindPoint::eCompute);
+    if (is_headless()) {
+        accumulate_offscreen(camera);
+        return;
+    }
     auto const [graphics_command_buffer, graphics_sync_idx] =
         get_command_buffer(vk::PipelineBindPoint::eGraphics);
-    result = swapchain_acquire_next_image_wrapper(device,
-        frame_objects.swapchain, 1e9, present_semaphores[graphics_sync_idx],
-        nullptr, &frame_objects.swapchain_image_idx);
-    if (result == vk::Result::eErrorOutOfDateKHR) {
-        refresh_frame_objects();
+    if (!acquire_raytracer_frame(graphics_sync_idx)) {
         return;
     }
-    CHECK(
-        result == vk::Result::eSuccess || result == vk::Result::eSuboptimalKHR,
-        "");
-    // megakernel raytracer
-    compute_command_buffer.bindPipeline(
-        vk::PipelineBindPoint ::eCompute, megakernel_raytracer.pipeline);
-    std::array<vk::DescriptorSet, MEGAKERNAL_RAYTRACER_SET>
-        megakernel_raytracer_sets{};
-    for (uint32_t s = 0; s < MEGAKERNAL_RAYTRACER_SET; ++s) {
-        megakernel_raytracer_sets[s] =
-            megakernel_raytracer.descriptor_sets[s][compute_sync_idx];
+    // the frame is sure to be submitted from here on, the render thread may
+    // wait for its submission
+    publication shown{};
+    {
+        std::lock_guard const lock{display_mutex};
+        shown = latest_publication;
+        if (shown.submission != 0) {
+            display_reads[shown.image] =
+                get_recording_serial(vk::PipelineBindPoint::eGraphics);
+        }
     }
-    compute_command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
-        megakernel_raytracer.pipeline_layout, 0, MEGAKERNAL_RAYTRACER_SET,
-        megakernel_raytracer_sets.data(), 0, nullptr);
-    vk::ImageSubresourceRange const whole_range{
-        .aspectMask = vk::ImageAspectFlagBits::eColor,
-        .baseMipLevel = 0,
-        .levelCount = 1,
-        .baseArrayLayer = 0,
-        .layerCount = 1,
-    };
+    if (shown.submission != 0) {
+        add_submission_wait(vk::PipelineBindPoint::eGraphics,
+            vk::PipelineBindPoint::eCompute, shown.submission,
+            vk::PipelineStageFlagBits::eFragmentShader);
+    }
+    // rect, previews and denoised sweeps hold a mean, the sums count the
+    // samples of every pixel in alpha, which differ under adaptive sampling
+    draw_raytracer_frame(graphics_command_buffer, graphics_sync_idx,
+        shown.submission != 0 ? std::optional{shown.image} : std::nullopt);
+}
+
+// Records and submits a preview while the camera is dirty and the tiles of
+// the budget otherwise, on the render thread. The publication becomes visible
+// to the window thread after its submission, so a window frame never waits
+// for a compute submission the render thread has yet to make.
+void megakernel_raytracer_accumulate(camera const& camera) {
+    CHECK(!is_headless(), "Headless renders accumulate in render");
+    auto const [compute_command_buffer, compute_sync_idx] =
+        get_command_buffer(vk::PipelineBindPoint::eCompute);
+    bind_megakernel_raytracer(compute_command_buffer, compute_sync_idx);
     if (camera.dirty) {
-        bool const camera_start_moving = accumulation_counter != 0;
         accumulation_counter = 0;
         tiles.current.x = 0;
         tiles.current.y = 0;
-        megakernel_raytracer_pc const megakernel_raytracer_pc{
-            .camera = get_glsl_raytracer_camera(
-                camera, preview_width, preview_height),
-            .random_seed = rand_uint(),
-            .preview = 1,
-            .max_depth = max_tracing_depth,
-            .light_count = light_count,
-            .sky_light = sky_light_idx,
-        };
-        compute_command_buffer.pushConstants(
-            megakernel_raytracer.pipeline_layout,
-            vk::ShaderStageFlagBits::eCompute, 0,
-            (uint32_t) sizeof(megakernel_raytracer_pc),
-            &megakernel_raytracer_pc);
-        compute_command_buffer.dispatch(preview_width, preview_height, 1);
-        if (camera_start_moving) {
-            add_submit_signal(vk::PipelineBindPoint::eCompute,
-                compute_semaphores[compute_sync_idx]);
-            add_submit_wait(vk::PipelineBindPoint::eGraphics,
-                compute_semaphores[compute_sync_idx],
-                vk::PipelineStageFlagBits::eFragmentShader);
+        if (std::optional<float> const milliseconds =
+                get_previous_gpu_time(PREVIEW_SCOPES)) {
+            scale_preview(*milliseconds);
         }
-    } else {
-        if (accumulation_counter == 0 && tiles.current.x == 0 &&
-            tiles.current.y == 0) {
-            std::array const black{0.0f, 0.0f, 0.0f, 1.0f};
-            vk::ClearColorValue const black_clear{.float32 = black};
-            compute_command_buffer.clearColorImage(
-                megakernel_raytracer.accumulation_image.image,
-                vk::ImageLayout::eGeneral, &black_clear, 1, &whole_range);
-            vk::ImageMemoryBarrier const clear_barrier{
-                .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
-                .dstAccessMask = vk::AccessFlagBits::eShaderRead,
-                .oldLayout = vk::ImageLayout::eGeneral,
-                .newLayout = vk::ImageLayout::eGeneral,
-                .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
-                .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
-                .image = megakernel_raytracer.accumulation_image.image,
-                .subresourceRange = whole_range,
+        glm::uvec2 const preview_extent = get_preview_extent();
+        glsl_raytracer_camera const preview_camera = get_glsl_raytracer_camera(
+            camera, preview_extent.x, preview_extent.y);
+        // later samples reproject onto the same camera and blend in
+        for (uint32_t s = 0; s < preview_samples; ++s) {
+            begin_gpu_scope(compute_command_buffer,
+                vk::PipelineBindPoint::eCompute, "preview history upload");
+            update_preview_history(
+                compute_command_buffer, preview_camera, preview_extent);
+            end_gpu_scope(
+                compute_command_buffer, vk::PipelineBindPoint::eCompute);
+            megakernel_raytracer_pc const megakernel_raytracer_pc{
+                .camera = preview_camera,
+                .random_seed =
+                    get_sample_seed(base_seed, sampler, preview_counter),
+                .preview = 1,
+                .max_depth = max_tracing_depth,
+                .light_count = light_count,
+                .sky_light = sky_light_idx,
+                .light_sampling = (uint32_t) light_sampling,
+                .sampler = (uint32_t) sampler,
+                .sample_index = preview_counter++,
+                .count_rays = 0,
             };
-            compute_command_buffer.pipelineBarrier(
-                vk::PipelineStageFlagBits::eTransfer,
-                vk::PipelineStageFlagBits::eComputeShader, {}, 0, nullptr, 0,
-                nullptr, 1, &clear_barrier);
+            compute_command_buffer.pushConstants(
+                megakernel_raytracer.pipeline_layout,
+                vk::ShaderStageFlagBits::eCompute, 0,
+                (uint32_t) sizeof(megakernel_raytracer_pc),
+                &megakernel_raytracer_pc);
+            begin_gpu_scope(compute_command_buffer,
+                vk::PipelineBindPoint::eCompute, "preview");
+            dispatch_pixels(compute_command_buffer, {0, 0}, preview_extent);
+            end_gpu_scope(
+                compute_command_buffer, vk::PipelineBindPoint::eCompute);
         }
-        megakernel_raytracer_pc const megakernel_raytracer_pc{
-            .camera = get_glsl_raytracer_camera(
-                camera, swapchain_extent.width, swapchain_extent.height),
-            .random_seed = rand_uint(),
-            .preview = 0,
-            .max_depth = max_tracing_depth,
-            .light_count = light_count,
-            .sky_light = sky_light_idx,
-        };
-        compute_command_buffer.pushConstants(
-            megakernel_raytracer.pipeline_layout,
-            vk::ShaderStageFlagBits::eCompute, 0,
-            (uint32_t) sizeof(megakernel_raytracer_pc),
-            &megakernel_raytracer_pc);
-        glm::uvec2 const viewport = current_viewport();
-        compute_command_buffer.dispatchBase(
-            viewport.x, viewport.y, 0, tiles.size.x, tiles.size.y, 1);
-        bool const finished = next_tile();
-        if (finished) {
-            ++accumulation_counter;
-            vk::ImageMemoryBarrier const render_barrier{
-                .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
-                .dstAccessMask = vk::AccessFlagBits::eTransferRead,
-                .oldLayout = vk::ImageLayout::eGeneral,
-                .newLayout = vk::ImageLayout::eGeneral,
-                .srcQueueFamilyIndex = command_queues.compute_queue_idx,
-                .dstQueueFamilyIndex = command_queues.compute_queue_idx,
-                .image = megakernel_raytracer.accumulation_image.image,
-                .subresourceRange = whole_range,
-            };
-            compute_command_buffer.pipelineBarrier(
-                vk::PipelineStageFlagBits::eComputeShader,
-                vk::PipelineStageFlagBits::eTransfer, {}, 0, nullptr, 0,
-                nullptr, 1, &render_barrier);
-            vk::ImageSubresourceLayers const layer{
-                .aspectMask = vk::ImageAspectFlagBits::eColor,
-                .mipLevel = 0,
-                .baseArrayLayer = 0,
-                .layerCount = 1,
-            };
-            vk::Offset3D const offset{0, 0, 0};
-            vk::Extent3D const extent{
-                megakernel_raytracer.accumulation_image.width,
-                megakernel_raytracer.accumulation_image.height,
-                1,
-            };
-            vk::ImageCopy const image_copy{
-                .srcSubresource = layer,
-                .srcOffset = offset,
-                .dstSubresource = layer,
-                .dstOffset = offset,
-                .extent = extent,
+        begin_gpu_scope(compute_command_buffer,
+            vk::PipelineBindPoint::eCompute, "preview upscale");
+        upscale_preview(
+            compute_command_buffer, compute_sync_idx, preview_extent);
+        end_gpu_scope(compute_command_buffer, vk::PipelineBindPoint::eCompute);
+        begin_gpu_scope(compute_command_buffer,
+            vk::PipelineBindPoint::eCompute, "publish");
+        publish_display_image(
+            compute_command_buffer, megakernel_raytracer.preview_image);
+        end_gpu_scope(compute_command_buffer, vk::PipelineBindPoint::eCompute);
+    } else {
+        if (std::optional<float> const milliseconds =
+                get_previous_gpu_time(TILE_SCOPES)) {
+            scale_tiles(*milliseconds);
+        }
+        bool any_finished = false;
+        uint32_t const tile_count = (uint32_t) tiles_per_frame;
+        for (uint32_t t = 0; t < tile_count; ++t) {
+            if (accumulation_counter == 0 && tiles.current.x == 0 &&
+                tiles.current.y == 0) {
+                begin_gpu_scope(compute_command_buffer,
+                    vk::PipelineBindPoint::eCompute, "clear");
+                clear_accumulation(compute_command_buffer);
+                end_gpu_scope(
+                    compute_command_buffer, vk::PipelineBindPoint::eCompute);
+            }
+            megakernel_raytracer_pc const megakernel_raytracer_pc{
+                .camera = get_glsl_raytracer_camera(
+                    camera, render_extent.width, render_extent.height),
+                .random_seed =
+                    get_sample_seed(base_seed, sampler, accumulation_counter),
+                .preview = 0,
+                .max_depth = max_tracing_depth,
+                .light_count = light_count,
+                .sky_light = sky_light_idx,
+                .light_sampling = (uint32_t) light_sampling,
+                .sampler = (uint32_t) sampler,
+                .sample_index = accumulation_counter,
+                .count_rays = 0,
+                .aovs = aov_images,
+                .adaptive_threshold = adaptive_threshold,
             };
-            compute_command_buffer.copyImage(
-                megakernel_raytracer.accumulation_image.image,
-                vk::ImageLayout::eGeneral,
-                megakernel_raytracer.output_image.image,
-                vk::ImageLayout::eGeneral, 1, &image_copy);
-            add_submit_signal(vk::PipelineBindPoint::eCompute,
-                compute_semaphores[compute_sync_idx]);
-            add_submit_wait(vk::PipelineBindPoint ::eGraphics,
-                compute_semaphores[compute_sync_idx],
-                vk::PipelineStageFlagBits::eFragmentShader);
+            compute_command_buffer.pushConstants(
+                megakernel_raytracer.pipeline_layout,
+                vk::ShaderStageFlagBits::eCompute, 0,
+                (uint32_t) sizeof(megakernel_raytracer_pc),
+                &megakernel_raytracer_pc);
+            glm::uvec2 const viewport = current_viewport();
+            begin_gpu_scope(compute_command_buffer,
+                vk::PipelineBindPoint::eCompute, "tile");
+            dispatch_pixels(compute_command_buffer, viewport, tiles.size);
+            end_gpu_scope(
+                compute_command_buffer, vk::PipelineBindPoint::eCompute);
+            bool const finished = next_tile();
+            if (finished) {
+                ++accumulation_counter;
+                any_finished = true;
+                if (denoise) {
+                    begin_gpu_scope(compute_command_buffer,
+                        vk::PipelineBindPoint::eCompute, "denoise");
+                    denoise_accumulation(
+                        compute_command_buffer, compute_sync_idx);
+                    end_gpu_scope(compute_command_buffer,
+                        vk::PipelineBindPoint::eCompute);
+                    // the denoiser bound its own pipeline
+                    bind_megakernel_raytracer(
+                        compute_command_buffer, compute_sync_idx);
+                } else {
+                    begin_gpu_scope(compute_command_buffer,
+                        vk::PipelineBindPoint::eCompute, "accumulation copy");
+                    copy_accumulation(compute_command_buffer);
+                    end_gpu_scope(compute_command_buffer,
+                        vk::PipelineBindPoint::eCompute);
+                }
+                // the next sweep adds to the sums read above
+                compute_command_buffer.pipelineBarrier(
+                    vk::PipelineStageFlagBits::eComputeShader |
+                        vk::PipelineStageFlagBits::eTransfer,
+                    vk::PipelineStageFlagBits::eComputeShader, {}, 0, nullptr,
+                    0, nullptr, 0, nullptr);
+            }
+        }
+        // only the last sweep finished in the frame is shown
+        if (any_finished) {
+            begin_gpu_scope(compute_command_buffer,
+                vk::PipelineBindPoint::eCompute, "publish");
+            publish_display_image(
+                compute_command_buffer, megakernel_raytracer.output_image);
+            end_gpu_scope(
+                compute_command_buffer, vk::PipelineBindPoint::eCompute);
         }
     }
-    // rect
-    vk::Rect2D const render_area{
-        .offset = {0, 0},
-        .extent = swapchain_extent,
-    };
-    vk::ClearValue const color_clear{
-        .color = {std::array{0.0f, 0.0f, 0.0f, 1.0f}}};
-    vk::RenderPassBeginInfo const render_pass_begin_info{
-        .renderPass = frame_objects.render_pass,
-        .framebuffer =
-            frame_objects.framebuffers[frame_objects.swapchain_image_idx],
-        .renderArea = render_area,
-        .clearValueCount = 1,
-        .pClearValues = &color_clear,
-    };
-    graphics_command_buffer.beginRenderPass(
-        render_pass_begin_info, vk::SubpassContents::eInline);
-    vk::Viewport const viewport{
-        .x = 0.0f,
-        .y = 0.0f,
-        .width = (float) swapchain_extent.width,
-        .height = (float) swapchain_extent.height,
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f,
-    };
-    graphics_command_buffer.setViewport(0, 1, &viewport);
-    vk::Rect2D const scissor = render_area;
-    graphics_command_buffer.setScissor(0, 1, &scissor);
-    graphics_command_buffer.bindPipeline(
-        vk::PipelineBindPoint::eGraphics, rect.pipeline);
-    graphics_command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
-        rect.pipeline_layout, 0, 1, &rect.descriptor_sets[graphics_sync_idx], 0,
-        nullptr);
-    bool const only_preview = accumulation_counter == 0;
-    rect_pc const rect_pc{
-        .frame_scalar =
-            only_preview ? 1.0f : 1.0f / (float) accumulation_counter,
-        .preview = only_preview,
-    };
-    graphics_command_buffer.pushConstants(rect.pipeline_layout,
-        vk::ShaderStageFlagBits::eFragment, 0, (uint32_t) sizeof(rect_pc),
-        &rect_pc);
-    graphics_command_buffer.draw(3, 1, 0, 0);
-    graphics_command_buffer.endRenderPass();
-    if (camera.dirty) {
-        vk::ImageMemoryBarrier const preview_barrier{
-            .srcAccessMask = vk::AccessFlagBits::eNone,
-            .dstAccessMask = vk::AccessFlagBits::eNone,
-            .oldLayout = vk::ImageLayout::eGeneral,
-            .newLayout = vk::ImageLayout::eGeneral,
-            .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
-            .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
-            .image = megakernel_raytracer.preview_image.image,
-            .subresourceRange = whole_range,
+    submit_command_buffer(vk::PipelineBindPoint::eCompute);
+    if (pending_publication.has_value()) {
+        std::lock_guard const lock{display_mutex};
+        latest_publication = publication{
+            .submission =
+                get_submission_serial(vk::PipelineBindPoint::eCompute),
+            .image = *pending_publication,
         };
-        compute_command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eNone,
-            vk::PipelineStageFlagBits::eComputeShader, {}, 0, nullptr, 0,
-            nullptr, 1, &preview_barrier);
+        pending_publication.reset();
     }
-    add_submit_wait(vk::PipelineBindPoint::eGraphics,
-        present_semaphores[graphics_sync_idx],
-        vk::PipelineStageFlagBits::eColorAttachmentOutput);
-    add_submit_signal(vk::PipelineBindPoint::eGraphics,
-        graphics_semaphores[graphics_sync_idx]);
-    add_present_wait(graphics_semaphores[graphics_sync_idx]);
 }
 
 void megakernel_raytracer_present() {
-    vk::Result const result =
-        present(frame_objects.swapchain, frame_objects.swapchain_image_idx);
-    if (result == vk::Result::eErrorOutOfDateKHR ||
-        result == vk::Result::eSuboptimalKHR) {
-        refresh_frame_objects();
-    } else {
-        CHECK(result == vk::Result::eSuccess, "");
+    if (is_headless()) {
+        return;
     }
+    present_raytracer_frame();
 }
 
 void megakernel_raytracer_destroy() {
@@ -798,25 +1764,227 @@ void megakernel_raytracer_destroy() {
     device.destroyDescriptorPool(primary_descriptor_pool);
     device.destroyDescriptorPool(indexing_descriptor_pool);
     device.destroySampler(primary_sampler);
-    device.destroySampler(blocky_sampler);
-    for (uint32_t f = 0; f < FRAME_IN_FLIGHT; ++f) {
-        device.destroySemaphore(compute_semaphores[f]);
-        device.destroySemaphore(graphics_semaphores[f]);
-        device.destroySemaphore(present_semaphores[f]);
-    }
     cleanup_staging_buffer(vma_alloc);
     cleanup_staging_image(vma_alloc);
-    destroy_rect_pipeline();
     clean_megakernel_raytracer_resources();
     destroy_megakernel_raytracer_pipeline();
-    destroy_frame_objects();
+    destroy_denoiser_pipeline();
+    destroy_upscaler_pipeline();
+    if (!is_headless()) {
+        destroy_raytracer_frame_objects();
+    }
+}
+
+std::vector<float> megakernel_raytracer_read_back() {
+    return wait_raytracer_read_back(megakernel_raytracer_request_read_back());
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
+// Copies the AOV images in use one after another into a buffer, over the
+// same part of the image as the color.
+std::vector<image_layer> megakernel_raytracer_read_back_aovs() {
+    if (aovs == 0) {
+        return {};
+    }
+    auto const [offset, extent] = get_read_back_rect(region, render_extent);
+    uint32_t const pixel_count = extent.width * extent.height;
+    uint32_t const image_size = pixel_count * 4 * (uint32_t) sizeof(float);
+    // the running statistics only steer the renderer
+    uint32_t const layer_images = aov_images & ~AOV_IMAGE_VARIANCE;
+    vk_buffer readback_buffer = create_readback_buffer(vma_alloc,
+        image_size * (uint32_t) std::popcount(layer_images), {});
+    auto const [compute_command_buffer, compute_sync_idx] =
+        get_command_buffer(vk::PipelineBindPoint::eCompute);
+    vk::MemoryBarrier const render_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eTransferRead,
+    };
+    compute_command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eTransfer, {}, 1, &render_barrier, 0,
+        nullptr, 0, nullptr);
+    uint32_t buffer_offset = 0;
+    for (uint32_t i = 0; i < AOV_IMAGE; ++i) {
+        if ((layer_images & (1u << i)) == 0) {
+            continue;
+        }
+        vk::BufferImageCopy const copy_info{
+            .bufferOffset = buffer_offset,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource =
+                vk::ImageSubresourceLayers{
+                    .aspectMask = vk::ImageAspectFlagBits::eColor,
+                    .mipLevel = 0,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+            .imageOffset = offset,
+            .imageExtent = extent,
+        };
+        compute_command_buffer.copyImageToBuffer(
+            megakernel_raytracer.aov_images[i].image, vk::ImageLayout::eGeneral,
+            readback_buffer.buffer, 1, &copy_info);
+        buffer_offset += image_size;
+    }
+    vk::BufferMemoryBarrier const host_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlagBits::eHostRead,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .buffer = readback_buffer.buffer,
+        .offset = 0,
+        .size = vk::WholeSize,
+    };
+    compute_command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eHost, {}, 0, nullptr, 1, &host_barrier, 0,
+        nullptr);
+    submit_command_buffer(vk::PipelineBindPoint::eCompute);
+    wait_vulkan();
+    vmaInvalidateAllocation(
+        vma_alloc, readback_buffer.allocation, 0, VK_WHOLE_SIZE);
+    float const* const sums =
+        reinterpret_cast<float const*>(readback_buffer.mapped);
+    auto const get_image_sums = [&](uint32_t image) {
+        // images in use before it
+        int const index = std::popcount(layer_images & (image - 1));
+        return sums + (size_t) index * 4 * pixel_count;
+    };
+    // the albedo image counts the samples of every pixel
+    float const* const albedo_count = get_image_sums(AOV_IMAGE_ALBEDO);
+    std::vector<image_layer> layers{};
+    auto const add_layer = [&](std::string const& name,
+                               std::vector<std::string> const& channels,
+                               uint32_t image, uint32_t first_component) {
+        float const* const image_sums = get_image_sums(image);
+        size_t const stride = channels.size();
+        image_layer layer{
+            .name = name,
+            .channels = channels,
+            .data = std::vector<float>(stride * pixel_count),
+        };
+        for (size_t p = 0; p < pixel_count; ++p) {
+            float const count = albedo_count[4 * p + 3];
+            float const scalar = count > 0.0f ? 1.0f / count : 0.0f;
+            for (size_t c = 0; c < stride; ++c) {
+                layer.data[p * stride + c] =
+                    scalar * image_sums[4 * p + first_component + c];
+            }
+        }
+        layers.push_back(std::move(layer));
+    };
+    if ((aovs & AOV_ALBEDO) != 0) {
+        add_layer("albedo", {"R", "G", "B"}, AOV_IMAGE_ALBEDO, 0);
+    }
+    if ((aovs & AOV_NORMAL) != 0) {
+        add_layer("normal", {"X", "Y", "Z"}, AOV_IMAGE_NORMAL_DEPTH, 0);
+        std::vector<float>& normals = layers.back().data;
+        for (size_t n = 0; n < normals.size(); n += 3) {
+            glm::vec3 const normal{normals[n], normals[n + 1], normals[n + 2]};
+            float const length = glm::length(normal);
+            if (length > 0.0f) {
+                normals[n + 0] = normal.x / length;
+                normals[n + 1] = normal.y / length;
+                normals[n + 2] = normal.z / length;
+            }
+        }
+    }
+    if ((aovs & AOV_DEPTH) != 0) {
+        add_layer("depth", {"Z"}, AOV_IMAGE_NORMAL_DEPTH, 3);
+    }
+    if ((aovs & AOV_DIRECT) != 0) {
+        add_layer("direct", {"R", "G", "B"}, AOV_IMAGE_DIRECT, 0);
+    }
+    if ((aovs & AOV_INDIRECT) != 0) {
+        add_layer("indirect", {"R", "G", "B"}, AOV_IMAGE_INDIRECT, 0);
+    }
+    if ((aovs & AOV_EMISSION) != 0) {
+        add_layer("emission", {"R", "G", "B"}, AOV_IMAGE_EMISSION, 0);
+    }
+    if ((aovs & AOV_SAMPLE_COUNT) != 0) {
+        image_layer layer{
+            .name = "sample_count",
+            .channels = {"Y"},
+            .data = std::vector<float>(pixel_count),
+        };
+        for (size_t p = 0; p < pixel_count; ++p) {
+            layer.data[p] = albedo_count[4 * p + 3];
+        }
+        layers.push_back(std::move(layer));
+    }
+    destroy_buffer(vma_alloc, readback_buffer);
+    return layers;
+}
+#pragma clang diagnostic pop
+
+uint32_t megakernel_raytracer_request_read_back() {
+    // regions are merged from their sums and aren't denoised on their own,
+    // the denoised image follows the sums in the read back
+    bool const denoised =
+        denoise && region.width == 0 && accumulation_counter != 0;
+    if (!denoised) {
+        std::array const images{megakernel_raytracer.accumulation_image.image};
+        return request_raytracer_read_back(images, region, render_extent,
+            megakernel_raytracer.ray_counter_buffer, accumulation_counter);
+    }
+    auto const [compute_command_buffer, compute_sync_idx] =
+        get_command_buffer(vk::PipelineBindPoint::eCompute);
+    begin_gpu_scope(
+        compute_command_buffer, vk::PipelineBindPoint::eCompute, "denoise");
+    denoise_accumulation(compute_command_buffer, compute_sync_idx);
+    end_gpu_scope(compute_command_buffer, vk::PipelineBindPoint::eCompute);
+    std::array const images{
+        megakernel_raytracer.accumulation_image.image,
+        megakernel_raytracer.output_image.image,
+    };
+    return request_raytracer_read_back(images, region, render_extent,
+        megakernel_raytracer.ray_counter_buffer, accumulation_counter);
+}
+
+std::vector<float> megakernel_raytracer_fetch_read_back(uint32_t ticket) {
+    return fetch_raytracer_read_back(ticket);
+}
+
+accumulation megakernel_raytracer_fetch_accumulation(uint32_t ticket) {
+    return fetch_raytracer_accumulation(ticket);
+}
+
+void megakernel_raytracer_restore_accumulation(accumulation const& state) {
+    // the AOVs aren't saved, the next samples gather them again and every
+    // one is divided by its own sample count. The luminance statistics of
+    // adaptive sampling start over too, so converged pixels take the minimum
+    // samples again before they stop.
+    std::array<vk::Image, AOV_IMAGE> aov_images{};
+    for (uint32_t i = 0; i < AOV_IMAGE; ++i) {
+        aov_images[i] = megakernel_raytracer.aov_images[i].image;
+    }
+    restore_raytracer_accumulation(megakernel_raytracer.accumulation_image,
+        aov_images, megakernel_raytracer.ray_counter_buffer, state);
+    accumulation_counter = state.sample_count;
+    tiles.current.x = 0;
+    tiles.current.y = 0;
+}
+
+uint64_t megakernel_raytracer_traced_rays() {
+    return get_raytracer_traced_rays();
 }
 
 void load_megakernel_raytracer(renderer& renderer) {
     renderer.initialize = megakernel_raytracer_initialize;
     renderer.prepare_data = megakernel_raytracer_prepare_data;
+    renderer.set_options = megakernel_raytracer_set_options;
+    renderer.set_region = megakernel_raytracer_set_region;
     renderer.update_data = megakernel_raytracer_update_data;
     renderer.render = megakernel_raytracer_render;
+    renderer.accumulate = megakernel_raytracer_accumulate;
     renderer.present = megakernel_raytracer_present;
     renderer.destroy = megakernel_raytracer_destroy;
+    renderer.read_back = megakernel_raytracer_read_back;
+    renderer.read_back_aovs = megakernel_raytracer_read_back_aovs;
+    renderer.request_read_back = megakernel_raytracer_request_read_back;
+    renderer.fetch_read_back = megakernel_raytracer_fetch_read_back;
+    renderer.fetch_accumulation = megakernel_raytracer_fetch_accumulation;
+    renderer.restore_accumulation = megakernel_raytracer_restore_accumulation;
+    renderer.traced_rays = megakernel_raytracer_traced_rays;
 }
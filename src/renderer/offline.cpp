@@ -0,0 +1,286 @@
+#include "check.h"
+#include "asset/scene.h"
+#include "asset/checkpoint.h"
+#include "asset/image_writer.h"
+#include "renderer/offline.h"
+#include "renderer/render_context.h"
+#include "utils/high_resolution_clock.h"
+
+#include <string>
+#include <future>
+#include <numeric>
+#include <optional>
+#include <algorithm>
+#include <filesystem>
+
+#pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
+
+static void render_job_image(renderer const& renderer,
+    render_options const& options, camera camera, render_job const& job);
+static std::string get_sequence_file(
+    std::string const& pattern, uint32_t frame);
+
+static void render_job_image(renderer const& renderer,
+    render_options const& options, camera camera, render_job const& job) {
+    uint32_t const target_spp = job.samples_per_pixel;
+    float const time_limit = job.time_limit_seconds;
+    high_resolution_clock clock{};
+    uint32_t spp = 0;
+    uint64_t resumed_rays = 0;
+    camera.dirty = true;
+    bool const checkpointing = job.checkpoint_interval_seconds > 0.0f;
+    std::string const checkpoint_file = job.output_file + ".checkpoint";
+    uint64_t const setup_hash =
+        checkpointing || job.resume ?
+            hash_render_setup(job.scene_file, options, camera) :
+            0;
+    if (job.resume) {
+        std::optional<checkpoint> const resumed =
+            read_checkpoint(checkpoint_file, setup_hash, options.resolution_x,
+                options.resolution_y, options.seed);
+        if (resumed.has_value()) {
+            renderer.restore_accumulation(resumed->accumulation);
+            spp = resumed->accumulation.sample_count;
+            resumed_rays = resumed->accumulation.traced_rays;
+            camera.dirty = false;
+            fmt::println("Resumed {} at {} spp", job.output_file, spp);
+        }
+    }
+    // only .exr holds the AOV layers, other formats get the color alone
+    bool const writing_aovs = options.aovs != 0 && renderer.read_back_aovs &&
+                              job.output_file.ends_with(".exr");
+    if (options.aovs != 0 && !writing_aovs) {
+        fmt::println("{} isn't .exr, its AOVs aren't written", job.output_file);
+    }
+    uint32_t const first_spp = spp;
+    float last_checkpoint = 0.0f;
+    std::optional<uint32_t> pending_checkpoint{};
+    std::future<void> writing{};
+    while (target_spp == 0 || spp < target_spp) {
+        clock.tick();
+        if (time_limit > 0.0f && clock.get_total_seconds() >= time_limit) {
+            break;
+        }
+        renderer.render(camera);
+        submit_command_buffer(vk::PipelineBindPoint::eCompute);
+        camera.dirty = false;
+        ++spp;
+        // the copy is queued ahead of this sample, the queue keeps running
+        // while it is fetched and the file is written on another thread
+        if (pending_checkpoint.has_value()) {
+            if (writing.valid()) {
+                writing.get();
+            }
+            writing = std::async(std::launch::async,
+                [checkpoint_file,
+                    state = checkpoint{
+                        .setup_hash = setup_hash,
+                        .width = options.resolution_x,
+                        .height = options.resolution_y,
+                        .seed = options.seed,
+                        .accumulation = renderer.fetch_accumulation(
+                            pending_checkpoint.value()),
+                        .finished_jobs = {},
+                    }]() { write_checkpoint(checkpoint_file, state); });
+            pending_checkpoint.reset();
+        }
+        if (checkpointing && clock.get_total_seconds() - last_checkpoint >=
+                                 job.checkpoint_interval_seconds) {
+            last_checkpoint = clock.get_total_seconds();
+            pending_checkpoint = renderer.request_read_back();
+        }
+    }
+    if (pending_checkpoint.has_value()) {
+        renderer.fetch_accumulation(pending_checkpoint.value());
+    }
+    if (writing.valid()) {
+        writing.get();
+    }
+    std::vector<float> const pixels = renderer.read_back();
+    std::vector<image_layer> const layers =
+        writing_aovs ? renderer.read_back_aovs() : std::vector<image_layer>{};
+    clock.tick();
+    float const render_seconds = clock.get_total_seconds();
+    write_image(job.output_file, options.resolution_x, options.resolution_y,
+        pixels, layers);
+    if (checkpointing) {
+        // the image is complete, a later resume starts over
+        std::filesystem::remove(checkpoint_file);
+    }
+    clock.tick();
+    float const write_seconds = clock.get_delta_seconds();
+    float const samples = (float) (spp - first_spp) *
+                          (float) options.resolution_x *
+                          (float) options.resolution_y;
+    float const rays =
+        renderer.traced_rays ?
+            (float) (renderer.traced_rays() - resumed_rays) :
+            0.0f;
+    fmt::println("Rendered {}x{} at {} spp in {:.3f} s", options.resolution_x,
+        options.resolution_y, spp, render_seconds);
+    fmt::println("{:.2f} Msamples/s, {:.2f} Mrays/s",
+        1e-6f * samples / render_seconds, 1e-6f * rays / render_seconds);
+    fmt::println("Wrote {} in {:.3f} s", job.output_file, write_seconds);
+}
+
+void render_jobs(renderer const& renderer, std::span<render_job const> jobs) {
+    CHECK(renderer.read_back && renderer.set_options &&
+              renderer.fetch_accumulation && renderer.restore_accumulation,
+        "The renderer can't render offline");
+    // jobs of one scene run back to back so its bvh is built and uploaded
+    // once, meshes and textures shared by different scenes are loaded once
+    std::vector<uint32_t> order(jobs.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return jobs[a].scene_file < jobs[b].scene_file;
+    });
+    asset_cache cache{};
+    high_resolution_clock clock{};
+    bool initialized = false;
+    for (uint32_t begin = 0; begin < order.size();) {
+        std::string const& scene_file = jobs[order[begin]].scene_file;
+        uint32_t end = begin + 1;
+        while (end < order.size() &&
+               jobs[order[end]].scene_file == scene_file) {
+            ++end;
+        }
+        clock.tick();
+        auto const [scene_options, scene_camera, scene] =
+            load_scene(scene_file, &cache);
+        bool scene_prepared = false;
+        for (uint32_t j = begin; j < end; ++j) {
+            render_job const& job = jobs[order[j]];
+            render_options options = scene_options;
+            if (job.resolution.has_value()) {
+                options.resolution_x = job.resolution.value()[0];
+                options.resolution_y = job.resolution.value()[1];
+                CHECK(options.resolution_x % options.tile_width == 0 &&
+                          options.resolution_y % options.tile_height == 0,
+                    "Resolution of {} isn't divisible by the tile size",
+                    job.output_file);
+            }
+            if (job.seed.has_value()) {
+                options.seed = job.seed.value();
+            }
+            if (!initialized) {
+                renderer.initialize(options);
+                initialized = true;
+            } else {
+                renderer.set_options(options);
+            }
+            if (!scene_prepared) {
+                renderer.prepare_data(scene);
+                scene_prepared = true;
+                clock.tick();
+                fmt::println("Prepared {} in {:.3f} s", scene_file,
+                    clock.get_delta_seconds());
+            }
+            render_job_image(
+                renderer, options, job.camera.value_or(scene_camera), job);
+        }
+        begin = end;
+    }
+    free_asset_cache(cache);
+}
+
+static std::string get_sequence_file(
+    std::string const& pattern, uint32_t frame) {
+    size_t const stem = pattern.find_last_of("/\\") + 1;
+    size_t const begin = pattern.find('#', stem);
+    if (begin == std::string::npos) {
+        size_t extension = pattern.find_last_of('.');
+        if (extension == std::string::npos || extension < stem) {
+            extension = pattern.size();
+        }
+        return fmt::format("{}_{:04}{}", pattern.substr(0, extension), frame,
+            pattern.substr(extension));
+    }
+    size_t end = pattern.find_first_not_of('#', begin);
+    if (end == std::string::npos) {
+        end = pattern.size();
+    }
+    return fmt::format("{}{:0{}}{}", pattern.substr(0, begin), frame,
+        end - begin, pattern.substr(end));
+}
+
+void render_sequence(renderer const& renderer, render_job const& job,
+    camera_path const& path) {
+    CHECK(renderer.request_read_back && renderer.fetch_read_back,
+        "The renderer can't render offline");
+    asset_cache cache{};
+    auto [options, scene_camera, scene] = load_scene(job.scene_file, &cache);
+    if (job.seed.has_value()) {
+        options.seed = job.seed.value();
+    }
+    renderer.initialize(options);
+    renderer.prepare_data(scene);
+    uint32_t const width = options.resolution_x;
+    uint32_t const height = options.resolution_y;
+    uint32_t const frame_count = get_camera_path_frame_count(path);
+    uint32_t const target_spp = job.samples_per_pixel;
+    float const time_limit = job.time_limit_seconds;
+    std::optional<uint32_t> pending_ticket{};
+    uint32_t pending_frame = 0;
+    std::future<void> encoding{};
+    auto const encode_pending = [&]() {
+        std::vector<float> pixels =
+            renderer.fetch_read_back(pending_ticket.value());
+        pending_ticket.reset();
+        // at most one image is encoded at a time
+        if (encoding.valid()) {
+            encoding.get();
+        }
+        encoding = std::async(std::launch::async,
+            [width, height, pixels = std::move(pixels),
+                file = get_sequence_file(job.output_file, pending_frame)]() {
+                write_image(file, width, height, pixels);
+            });
+    };
+    high_resolution_clock sequence_clock{};
+    sequence_clock.tick();
+    for (uint32_t frame = 0; frame < frame_count; ++frame) {
+        camera camera = evaluate_camera_path(path, frame);
+        camera.dirty = true;
+        high_resolution_clock clock{};
+        uint32_t spp = 0;
+        while (target_spp == 0 || spp < target_spp) {
+            clock.tick();
+            if (time_limit > 0.0f && clock.get_total_seconds() >= time_limit) {
+                break;
+            }
+            renderer.render(camera);
+            submit_command_buffer(vk::PipelineBindPoint::eCompute);
+            camera.dirty = false;
+            ++spp;
+            // the copy of the previous frame is queued ahead of this sample
+            if (pending_ticket.has_value()) {
+                encode_pending();
+            }
+        }
+        // a frame stopped before its first sample has not fetched the
+        // previous one yet
+        if (pending_ticket.has_value()) {
+            encode_pending();
+        }
+        // the accumulation still holds the previous frame
+        if (spp == 0) {
+            fmt::println("Frame {} got no samples within the time limit, it "
+                         "isn't written",
+                frame);
+            continue;
+        }
+        pending_ticket = renderer.request_read_back();
+        pending_frame = frame;
+    }
+    if (pending_ticket.has_value()) {
+        encode_pending();
+    }
+    if (encoding.valid()) {
+        encoding.get();
+    }
+    sequence_clock.tick();
+    float const seconds = sequence_clock.get_total_seconds();
+    fmt::println("Rendered {} frames of {}x{} in {:.3f} s, {:.3f} s per frame",
+        frame_count, width, height, seconds, seconds / (float) frame_count);
+    free_asset_cache(cache);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <span>
+
+#include "renderer/renderer.h"
+#include "asset/render_job.h"
+#include "asset/camera_path.h"
+
+// Renders the jobs one after another on a headless render context. Jobs of
+// one scene share its data on the device, every job accumulates until its
+// sample target or time limit is met, writes its image and reports
+// throughput.
+void render_jobs(renderer const& renderer, std::span<render_job const> jobs);
+
+// Renders every frame of the camera path for the scene and output pattern
+// of the job. The scene data stays on the device and the image of a frame is
+// read back and encoded while the next frame renders.
+void render_sequence(renderer const& renderer, render_job const& job,
+    camera_path const& path);
@@ -0,0 +1,559 @@
+#include <array>
+#include <cstring>
+
+#include "check.h"
+#include "vulkan/vulkan_swapchain.h"
+#include "vulkan/vulkan_render_pass.h"
+#include "vulkan/vulkan_framebuffer.h"
+#include "vulkan/vulkan_descriptor.h"
+#include "vulkan/vulkan_pipeline.h"
+
+#include "asset/texture.h"
+
+#include "renderer/raytracer_common.h"
+#include "renderer/render_context.h"
+#include "renderer/gpu_profiler.h"
+
+#include "utils/to_span.h"
+#include "utils/file.h"
+
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+#pragma clang diagnostic ignored "-Wglobal-constructors"
+
+static void refresh_frame_objects();
+static void create_rect_pipeline();
+static void destroy_rect_pipeline();
+
+static uint32_t constexpr READ_BACK_SLOT = 2;
+
+static vk::ImageSubresourceRange constexpr whole_range{
+    .aspectMask = vk::ImageAspectFlagBits::eColor,
+    .baseMipLevel = 0,
+    .levelCount = 1,
+    .baseArrayLayer = 0,
+    .layerCount = 1,
+};
+
+static std::array<vk::Semaphore, FRAME_IN_FLIGHT> graphics_semaphores{};
+static std::array<vk::Semaphore, FRAME_IN_FLIGHT> present_semaphores{};
+
+static struct {
+    vk::SwapchainKHR swapchain;
+    std::vector<vk::Image> swapchain_image;
+    std::vector<vk::ImageView> presents;
+    vk::RenderPass render_pass;
+    std::vector<vk::Framebuffer> framebuffers;
+    uint32_t swapchain_image_idx;
+} frame_objects{};
+
+static struct {
+    vk::DescriptorPool descriptor_pool;
+    // descriptors
+    vk::DescriptorSetLayout descriptor_layout;
+    std::array<vk::DescriptorSet, FRAME_IN_FLIGHT> descriptor_sets;
+    // pipeline
+    vk::PipelineLayout pipeline_layout;
+    vk::Pipeline pipeline;
+} rect;
+
+struct rect_pc {
+    float frame_scalar;
+    uint32_t image;  // the image the rect shader samples
+};
+
+struct read_back_slot {
+    uint64_t submission;    // compute submission carrying the copy
+    uint32_t sample_count;  // samples accumulated when it was requested
+    uint32_t image_count;   // images copied one after another
+    bool pending;
+};
+
+// host visible copies of the images, one per read back in flight
+static std::array<vk_buffer, READ_BACK_SLOT> readback_buffers{};
+static std::array<read_back_slot, READ_BACK_SLOT> read_back_slots{};
+static uint32_t next_read_back_slot = 0;
+
+static uint64_t traced_rays = 0;
+
+uint32_t get_sample_seed(
+    uint32_t base_seed, sampler_type sampler, uint32_t sample_index) {
+    if (sampler == sampler_type::sobol) {
+        sample_index = 0;
+    }
+    uint32_t hash = base_seed ^ (sample_index + 0x9e3779b9u +
+                                    (base_seed << 6) + (base_seed >> 2));
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+vk::Extent2D get_render_extent(render_options const& options) {
+    return is_headless() ?
+               vk::Extent2D{options.resolution_x, options.resolution_y} :
+               swapchain_extent;
+}
+
+void check_render_region(
+    render_region const& region, vk::Extent2D render_extent) {
+    CHECK(region.x + region.width <= render_extent.width &&
+              region.y + region.height <= render_extent.height,
+        "Region exceeds the {}x{} image", render_extent.width,
+        render_extent.height);
+}
+
+std::pair<vk::Offset3D, vk::Extent3D> get_read_back_rect(
+    render_region const& region, vk::Extent2D render_extent) {
+    bool const whole_image = region.width == 0;
+    vk::Offset3D const offset{
+        whole_image ? 0 : (int32_t) region.x,
+        whole_image ? 0 : (int32_t) region.y,
+        0,
+    };
+    vk::Extent3D const extent{
+        whole_image ? render_extent.width : region.width,
+        whole_image ? render_extent.height : region.height,
+        1,
+    };
+    return std::make_pair(offset, extent);
+}
+
+void create_raytracer_frame_objects() {
+    vk::SemaphoreCreateInfo const semaphore_info{};
+    vk::Result result;
+    for (uint32_t f = 0; f < FRAME_IN_FLIGHT; ++f) {
+        VK_CHECK_CREATE(result, graphics_semaphores[f],
+            device.createSemaphore(semaphore_info));
+        VK_CHECK_CREATE(result, present_semaphores[f],
+            device.createSemaphore(semaphore_info));
+    }
+    std::tie(frame_objects.swapchain, frame_objects.swapchain_image,
+        frame_objects.presents) =
+        create_swapchain(device, surface, command_queues);
+    frame_objects.render_pass = create_render_pass(device);
+    frame_objects.framebuffers = create_framebuffers(
+        device, frame_objects.render_pass, frame_objects.presents);
+    create_rect_pipeline();
+}
+
+void destroy_raytracer_frame_objects() {
+    destroy_rect_pipeline();
+    for (auto const framebuffer : frame_objects.framebuffers) {
+        device.destroyFramebuffer(framebuffer);
+    }
+    device.destroyRenderPass(frame_objects.render_pass);
+    for (auto const view : frame_objects.presents) {
+        device.destroyImageView(view);
+    }
+    device.destroySwapchainKHR(frame_objects.swapchain);
+    for (uint32_t f = 0; f < FRAME_IN_FLIGHT; ++f) {
+        device.destroySemaphore(graphics_semaphores[f]);
+        device.destroySemaphore(present_semaphores[f]);
+    }
+}
+
+static void refresh_frame_objects() {
+    // a render thread may keep submitting to the compute queue
+    auto const queue_lock = lock_queues();
+    wait_window(device, physical_device, surface, window);
+    for (auto const framebuffer : frame_objects.framebuffers) {
+        device.destroyFramebuffer(framebuffer);
+    }
+    for (auto const view : frame_objects.presents) {
+        device.destroyImageView(view);
+    }
+    device.destroySwapchainKHR(frame_objects.swapchain);
+    std::tie(frame_objects.swapchain, frame_objects.swapchain_image,
+        frame_objects.presents) =
+        create_swapchain(device, surface, command_queues);
+    frame_objects.framebuffers = create_framebuffers(
+        device, frame_objects.render_pass, frame_objects.presents);
+}
+
+static void create_rect_pipeline() {
+    rect.descriptor_pool = create_descriptor_pool(device);
+    std::vector<vk_descriptor_set_binding> bindings{
+        {vk::DescriptorType::eCombinedImageSampler, 2}
+    };
+    rect.descriptor_layout = create_descriptor_set_layout(
+        device, vk::ShaderStageFlagBits::eFragment, bindings);
+    create_descriptor_set(device, rect.descriptor_pool,
+        rect.descriptor_layout, rect.descriptor_sets);
+    std::array pc_sizes{(uint32_t) sizeof(rect_pc)};
+    std::array pc_stages{vk::ShaderStageFlagBits::eFragment};
+    std::array layouts{rect.descriptor_layout};
+    rect.pipeline_layout =
+        create_pipeline_layout(device, pc_sizes, pc_stages, layouts);
+    rect.pipeline = create_graphics_pipeline(device,
+        PATH_FROM_BINARY("shaders/rect.vert.spv"),
+        PATH_FROM_BINARY("shaders/rect.frag.spv"), rect.pipeline_layout,
+        frame_objects.render_pass, {}, vk::PolygonMode::eFill, false, false);
+}
+
+static void destroy_rect_pipeline() {
+    device.destroyDescriptorPool(rect.descriptor_pool);
+    device.destroyDescriptorSetLayout(rect.descriptor_layout);
+    device.destroyPipelineLayout(rect.pipeline_layout);
+    device.destroy(rect.pipeline);
+}
+
+void set_raytracer_frame_image(
+    uint32_t image, vk::Sampler sampler, vk::ImageView view) {
+    for (uint32_t f = 0; f < FRAME_IN_FLIGHT; ++f) {
+        update_descriptor_image_sampler_combined(
+            device, rect.descriptor_sets[f], 0, image, sampler, view);
+    }
+}
+
+bool acquire_raytracer_frame(uint32_t sync_idx) {
+    vk::Result const result = swapchain_acquire_next_image_wrapper(device,
+        frame_objects.swapchain, 1e9, present_semaphores[sync_idx], nullptr,
+        &frame_objects.swapchain_image_idx);
+    if (result == vk::Result::eErrorOutOfDateKHR) {
+        refresh_frame_objects();
+        return false;
+    }
+    CHECK(
+        result == vk::Result::eSuccess || result == vk::Result::eSuboptimalKHR,
+        "");
+    return true;
+}
+
+void draw_raytracer_frame(vk::CommandBuffer command_buffer, uint32_t sync_idx,
+    std::optional<uint32_t> image) {
+    vk::Rect2D const render_area{
+        .offset = {0, 0},
+        .extent = swapchain_extent,
+    };
+    vk::ClearValue const color_clear{
+        .color = {std::array{0.0f, 0.0f, 0.0f, 1.0f}}};
+    vk::RenderPassBeginInfo const render_pass_begin_info{
+        .renderPass = frame_objects.render_pass,
+        .framebuffer =
+            frame_objects.framebuffers[frame_objects.swapchain_image_idx],
+        .renderArea = render_area,
+        .clearValueCount = 1,
+        .pClearValues = &color_clear,
+    };
+    begin_gpu_scope(command_buffer, vk::PipelineBindPoint::eGraphics, "rect");
+    command_buffer.beginRenderPass(
+        render_pass_begin_info, vk::SubpassContents::eInline);
+    if (image.has_value()) {
+        vk::Viewport const viewport{
+            .x = 0.0f,
+            .y = 0.0f,
+            .width = (float) swapchain_extent.width,
+            .height = (float) swapchain_extent.height,
+            .minDepth = 0.0f,
+            .maxDepth = 1.0f,
+        };
+        command_buffer.setViewport(0, 1, &viewport);
+        vk::Rect2D const scissor = render_area;
+        command_buffer.setScissor(0, 1, &scissor);
+        command_buffer.bindPipeline(
+            vk::PipelineBindPoint::eGraphics, rect.pipeline);
+        command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
+            rect.pipeline_layout, 0, 1, &rect.descriptor_sets[sync_idx], 0,
+            nullptr);
+        // the alpha of the sums counts the samples of every pixel, which
+        // differ under adaptive sampling, images holding a mean have 1
+        rect_pc const rect_pc{
+            .frame_scalar = 1.0f,
+            .image = image.value(),
+        };
+        command_buffer.pushConstants(rect.pipeline_layout,
+            vk::ShaderStageFlagBits::eFragment, 0, (uint32_t) sizeof(rect_pc),
+            &rect_pc);
+        command_buffer.draw(3, 1, 0, 0);
+    }
+    command_buffer.endRenderPass();
+    end_gpu_scope(command_buffer, vk::PipelineBindPoint::eGraphics);
+    add_submit_wait(vk::PipelineBindPoint::eGraphics,
+        present_semaphores[sync_idx],
+        vk::PipelineStageFlagBits::eColorAttachmentOutput);
+    add_submit_signal(
+        vk::PipelineBindPoint::eGraphics, graphics_semaphores[sync_idx]);
+    add_present_wait(graphics_semaphores[sync_idx]);
+}
+
+void present_raytracer_frame() {
+    vk::Result const result =
+        present(frame_objects.swapchain, frame_objects.swapchain_image_idx);
+    if (result == vk::Result::eErrorOutOfDateKHR ||
+        result == vk::Result::eSuboptimalKHR) {
+        refresh_frame_objects();
+    } else {
+        CHECK(result == vk::Result::eSuccess, "");
+    }
+}
+
+void clear_raytracer_accumulation(vk::CommandBuffer command_buffer,
+    std::span<vk::Image const> images, vk::Buffer ray_counter) {
+    // earlier samples and read back copies may still be in flight
+    vk::MemoryBarrier const previous_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eTransferWrite,
+    };
+    command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eTransfer, {}, 1, &previous_barrier, 0,
+        nullptr, 0, nullptr);
+    // the alpha channels hold sums too
+    std::array const zero{0.0f, 0.0f, 0.0f, 0.0f};
+    vk::ClearColorValue const zero_clear{.float32 = zero};
+    std::vector<vk::ImageMemoryBarrier> clear_barriers(images.size());
+    for (uint32_t i = 0; i < images.size(); ++i) {
+        command_buffer.clearColorImage(images[i], vk::ImageLayout::eGeneral,
+            &zero_clear, 1, &whole_range);
+        clear_barriers[i] = vk::ImageMemoryBarrier{
+            .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+            .dstAccessMask = vk::AccessFlagBits::eShaderRead |
+                             vk::AccessFlagBits::eShaderWrite,
+            .oldLayout = vk::ImageLayout::eGeneral,
+            .newLayout = vk::ImageLayout::eGeneral,
+            .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .image = images[i],
+            .subresourceRange = whole_range,
+        };
+    }
+    command_buffer.fillBuffer(ray_counter, 0, vk::WholeSize, 0);
+    vk::BufferMemoryBarrier const counter_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask =
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .buffer = ray_counter,
+        .offset = 0,
+        .size = vk::WholeSize,
+    };
+    command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader, {}, 0, nullptr, 1,
+        &counter_barrier, (uint32_t) clear_barriers.size(),
+        clear_barriers.data());
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
+void restore_raytracer_accumulation(vk_image const& accumulation_image,
+    std::span<vk::Image const> cleared_images, vk_buffer const& ray_counter,
+    accumulation const& state) {
+    CHECK(state.sums.size() == 4 * (size_t) accumulation_image.width *
+                                   accumulation_image.height,
+        "The accumulation to restore isn't {}x{}", accumulation_image.width,
+        accumulation_image.height);
+    auto const [compute_command_buffer, compute_sync_idx] =
+        get_command_buffer(vk::PipelineBindPoint::eCompute);
+    // earlier samples and read back copies may still be in flight
+    vk::MemoryBarrier const previous_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eTransferWrite,
+    };
+    compute_command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eTransfer, {}, 1, &previous_barrier, 0,
+        nullptr, 0, nullptr);
+    texture_data const sums{
+        .width = accumulation_image.width,
+        .height = accumulation_image.height,
+        .data = const_cast<float*>(state.sums.data()),
+        .channel = texture_channel::rgba,
+        .format = texture_format::sfloat,
+    };
+    update_texture2d(
+        vma_alloc, accumulation_image, compute_command_buffer, sums);
+    std::array const zero{0.0f, 0.0f, 0.0f, 0.0f};
+    vk::ClearColorValue const zero_clear{.float32 = zero};
+    for (vk::Image const image : cleared_images) {
+        compute_command_buffer.clearColorImage(image,
+            vk::ImageLayout::eGeneral, &zero_clear, 1, &whole_range);
+    }
+    std::array const ray_counter_values{
+        (uint32_t) state.traced_rays,
+        (uint32_t) (state.traced_rays >> 32),
+    };
+    update_buffer(vma_alloc, compute_command_buffer, ray_counter,
+        to_byte_span(ray_counter_values), 0);
+    vk::MemoryBarrier const restore_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask =
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+    };
+    compute_command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader, {}, 1, &restore_barrier, 0,
+        nullptr, 0, nullptr);
+    traced_rays = state.traced_rays;
+}
+
+uint32_t request_raytracer_read_back(std::span<vk::Image const> images,
+    render_region const& region, vk::Extent2D render_extent,
+    vk_buffer const& ray_counter, uint32_t sample_count) {
+    uint32_t const slot = next_read_back_slot;
+    CHECK(!read_back_slots[slot].pending,
+        "Read back slot {} is requested before being fetched", slot);
+    next_read_back_slot = (next_read_back_slot + 1) % READ_BACK_SLOT;
+    vk_buffer& readback_buffer = readback_buffers[slot];
+    auto const [compute_command_buffer, compute_sync_idx] =
+        get_command_buffer(vk::PipelineBindPoint::eCompute);
+    auto const [offset, extent] = get_read_back_rect(region, render_extent);
+    uint32_t const pixel_count = extent.width * extent.height;
+    uint32_t const image_size = pixel_count * 4 * (uint32_t) sizeof(float);
+    uint32_t const images_size = (uint32_t) images.size() * image_size;
+    uint32_t const size = images_size + 2 * (uint32_t) sizeof(uint32_t);
+    if (readback_buffer.size != size) {
+        destroy_buffer(vma_alloc, readback_buffer);
+        readback_buffer = create_readback_buffer(vma_alloc, size, {});
+    }
+    std::vector<vk::ImageMemoryBarrier> render_barriers(images.size());
+    for (uint32_t i = 0; i < images.size(); ++i) {
+        render_barriers[i] = vk::ImageMemoryBarrier{
+            .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+            .dstAccessMask = vk::AccessFlagBits::eTransferRead,
+            .oldLayout = vk::ImageLayout::eGeneral,
+            .newLayout = vk::ImageLayout::eGeneral,
+            .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .image = images[i],
+            .subresourceRange = whole_range,
+        };
+    }
+    compute_command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eTransfer, {}, 0, nullptr, 0, nullptr,
+        (uint32_t) render_barriers.size(), render_barriers.data());
+    begin_gpu_scope(
+        compute_command_buffer, vk::PipelineBindPoint::eCompute, "read back");
+    for (uint32_t i = 0; i < images.size(); ++i) {
+        vk::BufferImageCopy const copy_info{
+            .bufferOffset = i * image_size,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource =
+                vk::ImageSubresourceLayers{
+                    .aspectMask = vk::ImageAspectFlagBits::eColor,
+                    .mipLevel = 0,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+            .imageOffset = offset,
+            .imageExtent = extent,
+        };
+        compute_command_buffer.copyImageToBuffer(images[i],
+            vk::ImageLayout::eGeneral, readback_buffer.buffer, 1, &copy_info);
+    }
+    end_gpu_scope(compute_command_buffer, vk::PipelineBindPoint::eCompute);
+    vk::BufferMemoryBarrier const counter_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask = vk::AccessFlagBits::eTransferRead,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .buffer = ray_counter.buffer,
+        .offset = 0,
+        .size = vk::WholeSize,
+    };
+    compute_command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eTransfer, {}, 0, nullptr, 1,
+        &counter_barrier, 0, nullptr);
+    vk::BufferCopy const counter_copy{
+        .srcOffset = 0,
+        .dstOffset = images_size,
+        .size = 2 * sizeof(uint32_t),
+    };
+    compute_command_buffer.copyBuffer(
+        ray_counter.buffer, readback_buffer.buffer, 1, &counter_copy);
+    vk::BufferMemoryBarrier const host_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlagBits::eHostRead,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .buffer = readback_buffer.buffer,
+        .offset = 0,
+        .size = vk::WholeSize,
+    };
+    compute_command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eHost, {}, 0, nullptr, 1, &host_barrier, 0,
+        nullptr);
+    submit_command_buffer(vk::PipelineBindPoint::eCompute);
+    read_back_slots[slot] = read_back_slot{
+        .submission = get_submission_serial(vk::PipelineBindPoint::eCompute),
+        .sample_count = sample_count,
+        .image_count = (uint32_t) images.size(),
+        .pending = true,
+    };
+    return slot;
+}
+
+accumulation fetch_raytracer_accumulation(uint32_t ticket) {
+    CHECK(ticket < READ_BACK_SLOT && read_back_slots[ticket].pending,
+        "Read back {} isn't requested", ticket);
+    read_back_slot& slot = read_back_slots[ticket];
+    vk_buffer const& readback_buffer = readback_buffers[ticket];
+    wait_submission(vk::PipelineBindPoint::eCompute, slot.submission);
+    slot.pending = false;
+    uint32_t const images_size =
+        readback_buffer.size - 2 * (uint32_t) sizeof(uint32_t);
+    uint32_t const image_size = images_size / slot.image_count;
+    vmaInvalidateAllocation(
+        vma_alloc, readback_buffer.allocation, 0, VK_WHOLE_SIZE);
+    float const* const sums =
+        reinterpret_cast<float const*>(readback_buffer.mapped);
+    std::array<uint32_t, 2> ray_counter{};
+    std::memcpy(ray_counter.data(), readback_buffer.mapped + images_size,
+        sizeof(ray_counter));
+    traced_rays = (uint64_t) ray_counter[1] << 32 | ray_counter[0];
+    return accumulation{
+        .sums = std::vector<float>(sums, sums + image_size / sizeof(float)),
+        .sample_count = slot.sample_count,
+        .traced_rays = traced_rays,
+    };
+}
+
+std::vector<float> fetch_raytracer_read_back(uint32_t ticket) {
+    uint32_t const image_count =
+        ticket < READ_BACK_SLOT ? read_back_slots[ticket].image_count : 1;
+    accumulation const state = fetch_raytracer_accumulation(ticket);
+    if (image_count > 1) {
+        float const* const pixels =
+            reinterpret_cast<float const*>(readback_buffers[ticket].mapped) +
+            (image_count - 1) * state.sums.size();
+        return std::vector<float>(pixels, pixels + state.sums.size());
+    }
+    // the accumulation holds the sum of the samples of every pixel with their
+    // count in alpha
+    std::vector<float> pixels(state.sums.size());
+    for (size_t p = 0; p < pixels.size(); p += 4) {
+        float const frame_scalar =
+            state.sums[p + 3] > 0.0f ? 1.0f / state.sums[p + 3] : 0.0f;
+        pixels[p + 0] = frame_scalar * state.sums[p + 0];
+        pixels[p + 1] = frame_scalar * state.sums[p + 1];
+        pixels[p + 2] = frame_scalar * state.sums[p + 2];
+        pixels[p + 3] = 1.0f;
+    }
+    return pixels;
+}
+#pragma clang diagnostic pop
+
+std::vector<float> wait_raytracer_read_back(uint32_t ticket) {
+    wait_vulkan();
+    cleanup_staging_buffer(vma_alloc);
+    cleanup_staging_image(vma_alloc);
+    return fetch_raytracer_read_back(ticket);
+}
+
+void clean_raytracer_read_backs() {
+    for (uint32_t i = 0; i < READ_BACK_SLOT; ++i) {
+        destroy_buffer(vma_alloc, readback_buffers[i]);
+        readback_buffers[i] = {};
+        read_back_slots[i].pending = false;
+    }
+}
+
+uint64_t get_raytracer_traced_rays() {
+    return traced_rays;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <utility>
+#include <optional>
+
+#include "vulkan/vulkan_header.h"
+#include "vulkan/vulkan_buffer.h"
+#include "vulkan/vulkan_image.h"
+
+#include "renderer/renderer.h"
+
+// Accumulation, read back and presentation shared by the raytracers. Both
+// accumulate the sums of their samples in an rgba32f image with the sample
+// count of every pixel in alpha, next to a 64-bit counter of the traced rays.
+// One raytracer is initialized at a time, the state here is its own.
+
+// The seed of a sample only depends on the base seed and the sample index, so
+// a render is reproducible no matter how its samples get submitted. The Sobol
+// sampler scrambles every sample of a pixel with the same seed and takes the
+// sample index from the push constants instead.
+uint32_t get_sample_seed(
+    uint32_t base_seed, sampler_type sampler, uint32_t sample_index);
+
+// Extent of the accumulation, the swapchain extent unless rendering headless.
+vk::Extent2D get_render_extent(render_options const& options);
+
+void check_render_region(
+    render_region const& region, vk::Extent2D render_extent);
+
+// Part of the accumulation a read back copies, the whole image without a
+// region.
+std::pair<vk::Offset3D, vk::Extent3D> get_read_back_rect(
+    render_region const& region, vk::Extent2D render_extent);
+
+// Swapchain, render pass, semaphores and the rect pipeline drawing one of two
+// images of the raytracer to the window.
+void create_raytracer_frame_objects();
+
+void destroy_raytracer_frame_objects();
+
+// Binds an image the rect shader samples by its index, on every frame in
+// flight.
+void set_raytracer_frame_image(
+    uint32_t image, vk::Sampler sampler, vk::ImageView view);
+
+// False when the swapchain was out of date and is recreated, the frame is
+// skipped then.
+bool acquire_raytracer_frame(uint32_t sync_idx);
+
+// Draws the image of the index, which the graphics queue has to be able to
+// read by now, or only clears the window without one. Adds the semaphores of
+// the swapchain image to the submission.
+void draw_raytracer_frame(vk::CommandBuffer command_buffer, uint32_t sync_idx,
+    std::optional<uint32_t> image);
+
+void present_raytracer_frame();
+
+// Zeroes the images and the ray counter once the earlier samples and read
+// back copies are done with them.
+void clear_raytracer_accumulation(vk::CommandBuffer command_buffer,
+    std::span<vk::Image const> images, vk::Buffer ray_counter);
+
+// Uploads the sums and the ray counter of a saved accumulation and zeroes
+// the other images, which aren't saved.
+void restore_raytracer_accumulation(vk_image const& accumulation_image,
+    std::span<vk::Image const> cleared_images, vk_buffer const& ray_counter,
+    accumulation const& state);
+
+// Copies the rect of the region of every image after the last samples into
+// a host visible buffer, the first one being the accumulation, followed by
+// the ray counter, and submits the compute queue. There are two slots, the
+// ticket has to be fetched before the one after the next request.
+uint32_t request_raytracer_read_back(std::span<vk::Image const> images,
+    render_region const& region, vk::Extent2D render_extent,
+    vk_buffer const& ray_counter, uint32_t sample_count);
+
+// Waits for the submission of the copy only.
+accumulation fetch_raytracer_accumulation(uint32_t ticket);
+
+// The last image the read back copied if there were several, otherwise the
+// mean of the accumulation.
+std::vector<float> fetch_raytracer_read_back(uint32_t ticket);
+
+// Waits for the device instead, uploads of the scene have finished then and
+// their staging buffers are freed.
+std::vector<float> wait_raytracer_read_back(uint32_t ticket);
+
+// Frees the read back buffers, a resized accumulation gets new ones.
+void clean_raytracer_read_backs();
+
+// Rays traced since the last clear, as of the last fetch or restore.
+uint64_t get_raytracer_traced_rays();
@@ -1,4 +1,6 @@
 #include <bitset>
+#include <algorithm>
+#include <mutex>
 
 #include "check.h"
 #include "window.h"
@@ -6,11 +8,13 @@
 #include "vulkan/vulkan_swapchain.h"
 #include "vulkan/vulkan_buffer.h"
 #include "renderer/render_context.h"
+#include "renderer/gpu_profiler.h"
 
 #pragma clang diagnostic ignored "-Wexit-time-destructors"
 #pragma clang diagnostic ignored "-Wglobal-constructors"
 
 static bool initialized = false;
+static bool headless_context = false;
 
 // glfw
 uint32_t win_width = 1280;
@@ -27,37 +31,60 @@ vk::Device device{};
 vk::PhysicalDevice physical_device{};
 vulkan_queues command_queues{};
 VmaAllocator vma_alloc = nullptr;
+// Every submission of a queue signals the next serial on its timeline
+// semaphore, so a serial both tells when a command buffer can be reused and
+// lets the other queue wait for the submission without a fence.
 static struct vk_commands {
     vk::CommandPool pool;
     uint32_t index = 0;
     bool new_buffer = true;
     std::array<vk::CommandBuffer, FRAME_IN_FLIGHT> buffers;
-    std::array<vk::Fence, FRAME_IN_FLIGHT> fences;
+    vk::Semaphore timeline;
+    // submission serial of every buffer, the newest one known as finished
+    std::array<uint64_t, FRAME_IN_FLIGHT> serials;
+    uint64_t submitted = 0;
+    uint64_t finished = 0;
     std::vector<vk::Semaphore> wait_semphores;
     std::vector<vk::PipelineStageFlags> wait_stages;
+    std::vector<uint64_t> wait_values;  // 0 for binary semaphores
     std::vector<vk::Semaphore> signal_semphores;
+    std::vector<uint64_t> signal_values;
 } graphics_commands{}, compute_commands{};
 static std::vector<vk::Semaphore> present_semaphore{};
 
+static void wait_timeline(vk_commands& commands, uint64_t serial);
+// the compute and graphics queue may be the same one
+static std::mutex queue_mutex{};
+
 bool window_should_close() {
-    return glfwWindowShouldClose(window);
+    return headless_context || glfwWindowShouldClose(window);
 }
 
 void poll_window_event() {
-    glfwPollEvents();
+    if (!headless_context) {
+        glfwPollEvents();
+    }
+}
+
+bool is_headless() {
+    return headless_context;
 }
 
-void create_render_context() {
+void create_render_context(bool headless, bool profiling) {
     if (initialized) {
         return;
     }
+    headless_context = headless;
     /* GLFW */
-    auto const glfw_resize_callback = [](GLFWwindow*, int width, int height) {
-        win_width = (uint32_t) width;
-        win_height = (uint32_t) height;
-    };
-    window = glfw_create_window((int) win_width, (int) win_height);
-    glfwSetFramebufferSizeCallback(window, glfw_resize_callback);
+    if (!headless) {
+        auto const glfw_resize_callback = [](GLFWwindow*, int width,
+                                              int height) {
+            win_width = (uint32_t) width;
+            win_height = (uint32_t) height;
+        };
+        window = glfw_create_window((int) win_width, (int) win_height);
+        glfwSetFramebufferSizeCallback(window, glfw_resize_callback);
+    }
     /* INSTANCE */
     std::vector<const char*> inst_ext{};
     std::vector<const char*> inst_layer{};
@@ -67,7 +94,7 @@ void create_render_context() {
     inst_ext.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
     inst_layer.push_back("VK_LAYER_KHRONOS_validation");
 #endif
-    {
+    if (!headless) {
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
         uint32_t glfw_required_inst_ext_cnt = 0;
@@ -77,8 +104,8 @@ void create_render_context() {
             glfw_required_inst_ext_name + glfw_required_inst_ext_cnt,
             std::back_inserter(inst_ext));
 #pragma clang diagnostic pop
+        dev_ext.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
     }
-    dev_ext.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
     dev_ext.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
     vk::DynamicLoader vk_loader = load_vulkan();
     instance = create_instance(inst_ext, inst_layer);
@@ -87,7 +114,9 @@ void create_render_context() {
     dbg_messenger = create_debug_messenger(instance);
 #endif
     /* SURFACE */
-    surface = create_surface(instance, window);
+    if (!headless) {
+        surface = create_surface(instance, window);
+    }
     /* DEVICE */
     const void* dev_creation_pnext = nullptr;
     vk::PhysicalDeviceDescriptorIndexingFeatures const
@@ -99,19 +128,28 @@ void create_render_context() {
             .descriptorBindingVariableDescriptorCount = vk::True,
             .runtimeDescriptorArray = vk::True,
         };
-    vk::PhysicalDeviceSynchronization2Features const synchron2_feature{
+    vk::PhysicalDeviceTimelineSemaphoreFeatures const timeline_feature{
         .pNext = (void*) &descriptor_indexing_features,
+        .timelineSemaphore = vk::True,
+    };
+    vk::PhysicalDeviceSynchronization2Features const synchron2_feature{
+        .pNext = (void*) &timeline_feature,
         .synchronization2 = vk::True,
     };
     dev_creation_pnext = &synchron2_feature;
+    // the graphics-only features are not needed to accumulate offscreen
     vk::PhysicalDeviceFeatures const physical_device_deature{
-        .sampleRateShading = vk::True,
-        .multiDrawIndirect = vk::True,
-        .fillModeNonSolid = vk::True,
+        .sampleRateShading = headless ? vk::False : vk::True,
+        .multiDrawIndirect = headless ? vk::False : vk::True,
+        .fillModeNonSolid = headless ? vk::False : vk::True,
+    };
+    // a profile without them has timestamps only
+    vk::PhysicalDeviceFeatures const optional_feature{
+        .pipelineStatisticsQuery = profiling ? vk::True : vk::False,
     };
     std::tie(device, physical_device, command_queues) =
         select_physical_device_create_device_queues(instance, surface, dev_ext,
-            dev_creation_pnext, physical_device_deature);
+            dev_creation_pnext, physical_device_deature, optional_feature);
     VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptor_indexing_properties{
         .sType =
             VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT,
@@ -165,18 +203,23 @@ void create_render_context() {
     VK_CHECK(
         result, device.allocateCommandBuffers(&command_buffer_allocation_info,
                     compute_commands.buffers.data()));
-    vk::FenceCreateInfo const fence_info{
-        .flags = vk::FenceCreateFlagBits::eSignaled,
+    vk::SemaphoreTypeCreateInfo const timeline_type_info{
+        .semaphoreType = vk::SemaphoreType::eTimeline,
+        .initialValue = 0,
     };
-    for (uint32_t i = 0; i < FRAME_IN_FLIGHT; ++i) {
-        VK_CHECK_CREATE(result, graphics_commands.fences[i],
-            device.createFence(fence_info));
-        VK_CHECK_CREATE(
-            result, compute_commands.fences[i], device.createFence(fence_info));
-    }
+    vk::SemaphoreCreateInfo const timeline_info{
+        .pNext = &timeline_type_info,
+    };
+    VK_CHECK_CREATE(result, graphics_commands.timeline,
+        device.createSemaphore(timeline_info));
+    VK_CHECK_CREATE(result, compute_commands.timeline,
+        device.createSemaphore(timeline_info));
     /* SWAPCHAIN PREPARE */
-    prepare_swapchain(physical_device, surface);
-    wait_window(device, physical_device, surface, window);
+    if (!headless) {
+        prepare_swapchain(physical_device, surface);
+        wait_window(device, physical_device, surface, window);
+    }
+    create_gpu_profiler(profiling);
     initialized = true;
     /* CREATE DUMMY BUFFER */
     create_dummy_buffer(vma_alloc);
@@ -187,29 +230,37 @@ void destroy_render_context() {
         return;
     }
     destroy_dummy_buffer(vma_alloc);
-    for (uint32_t i = 0; i < FRAME_IN_FLIGHT; ++i) {
-        device.destroyFence(graphics_commands.fences[i]);
-        device.destroyFence(compute_commands.fences[i]);
-    }
+    destroy_gpu_profiler();
+    device.destroySemaphore(graphics_commands.timeline);
+    device.destroySemaphore(compute_commands.timeline);
     device.destroyCommandPool(graphics_commands.pool);
     device.destroyCommandPool(compute_commands.pool);
     vmaDestroyAllocator(vma_alloc);
     device.destroy();
-    instance.destroySurfaceKHR(surface);
+    if (surface) {
+        instance.destroySurfaceKHR(surface);
+    }
 #if defined(VK_DBG)
     instance.destroyDebugUtilsMessengerEXT(dbg_messenger);
 #endif
     instance.destroy();
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (window) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
     initialized = false;
 }
 
 void wait_vulkan() {
     vk::Result result;
+    std::lock_guard const lock{queue_mutex};
     VK_CHECK(result, device.waitIdle());
 }
 
+std::unique_lock<std::mutex> lock_queues() {
+    return std::unique_lock{queue_mutex};
+}
+
 std::pair<vk::CommandBuffer, uint32_t> get_command_buffer(
     vk::PipelineBindPoint bind_point) {
     vk::Result result;
@@ -217,15 +268,18 @@ std::pair<vk::CommandBuffer, uint32_t> get_command_buffer(
                                 graphics_commands :
                                 compute_commands;
     vk::CommandBuffer const command_buffer = commands.buffers[commands.index];
-    vk::Fence const command_fence = commands.fences[commands.index];
     vk::CommandBufferBeginInfo const begin_info{
         .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit};
     if (commands.new_buffer) {
         commands.new_buffer = false;
-        VK_CHECK(result, device.waitForFences(1, &command_fence, true, 1e12));
-        VK_CHECK(result, device.resetFences(1, &command_fence));
+        // blocks only while the queue is a whole ring of buffers behind
+        wait_timeline(commands, commands.serials[commands.index]);
         VK_CHECK(result, command_buffer.reset());
         VK_CHECK(result, command_buffer.begin(begin_info));
+        if (is_gpu_timing()) {
+            begin_gpu_profile(bind_point, commands.index,
+                commands.submitted + 1, command_buffer);
+        }
     }
     return std::make_pair(command_buffer, commands.index);
 }
@@ -237,6 +291,21 @@ void add_submit_wait(vk::PipelineBindPoint bind_point, vk::Semaphore semaphore,
                                 compute_commands;
     commands.wait_semphores.push_back(semaphore);
     commands.wait_stages.push_back(stage);
+    commands.wait_values.push_back(0);
+}
+
+void add_submission_wait(vk::PipelineBindPoint bind_point,
+    vk::PipelineBindPoint submitter, uint64_t serial,
+    vk::PipelineStageFlags stage) {
+    vk_commands& commands = bind_point == vk::PipelineBindPoint::eGraphics ?
+                                graphics_commands :
+                                compute_commands;
+    vk_commands const& submitting =
+        submitter == vk::PipelineBindPoint::eGraphics ? graphics_commands :
+                                                        compute_commands;
+    commands.wait_semphores.push_back(submitting.timeline);
+    commands.wait_stages.push_back(stage);
+    commands.wait_values.push_back(serial);
 }
 
 void add_submit_signal(
@@ -245,6 +314,7 @@ void add_submit_signal(
                                 graphics_commands :
                                 compute_commands;
     commands.signal_semphores.push_back(semaphore);
+    commands.signal_values.push_back(0);
 }
 
 void submit_command_buffer(vk::PipelineBindPoint bind_point) {
@@ -257,11 +327,21 @@ void submit_command_buffer(vk::PipelineBindPoint bind_point) {
     vk::Queue const command_queue =
         graphics ? command_queues.graphics_queue : command_queues.compute_queue;
     vk::CommandBuffer const command_buffer = commands.buffers[commands.index];
-    vk::Fence const command_fence = commands.fences[commands.index];
+    commands.serials[commands.index] = ++commands.submitted;
     commands.index = (commands.index + 1) % FRAME_IN_FLIGHT;
     commands.new_buffer = true;
+    commands.signal_semphores.push_back(commands.timeline);
+    commands.signal_values.push_back(commands.submitted);
     VK_CHECK(result, command_buffer.end());
+    // the values of binary semaphores are ignored
+    vk::TimelineSemaphoreSubmitInfo const timeline_info{
+        .waitSemaphoreValueCount = (uint32_t) commands.wait_values.size(),
+        .pWaitSemaphoreValues = commands.wait_values.data(),
+        .signalSemaphoreValueCount = (uint32_t) commands.signal_values.size(),
+        .pSignalSemaphoreValues = commands.signal_values.data(),
+    };
     vk::SubmitInfo const submit_info{
+        .pNext = &timeline_info,
         .waitSemaphoreCount = (uint32_t) commands.wait_semphores.size(),
         .pWaitSemaphores = commands.wait_semphores.data(),
         .pWaitDstStageMask = commands.wait_stages.data(),
@@ -270,10 +350,34 @@ void submit_command_buffer(vk::PipelineBindPoint bind_point) {
         .signalSemaphoreCount = (uint32_t) commands.signal_semphores.size(),
         .pSignalSemaphores = commands.signal_semphores.data(),
     };
-    VK_CHECK(result, command_queue.submit(1, &submit_info, command_fence));
+    {
+        std::lock_guard const lock{queue_mutex};
+        VK_CHECK(result, command_queue.submit(1, &submit_info, nullptr));
+    }
     commands.wait_semphores.clear();
     commands.wait_stages.clear();
+    commands.wait_values.clear();
     commands.signal_semphores.clear();
+    commands.signal_values.clear();
+}
+
+uint64_t get_submission_serial(vk::PipelineBindPoint bind_point) {
+    return bind_point == vk::PipelineBindPoint::eGraphics ?
+               graphics_commands.submitted :
+               compute_commands.submitted;
+}
+
+uint64_t get_recording_serial(vk::PipelineBindPoint bind_point) {
+    return get_submission_serial(bind_point) + 1;
+}
+
+void wait_submission(vk::PipelineBindPoint bind_point, uint64_t serial) {
+    vk_commands& commands = bind_point == vk::PipelineBindPoint::eGraphics ?
+                                graphics_commands :
+                                compute_commands;
+    CHECK(serial <= commands.submitted, "Submission {} isn't submitted yet",
+        serial);
+    wait_timeline(commands, serial);
 }
 
 void add_present_wait(vk::Semaphore semaphore) {
@@ -289,8 +393,33 @@ vk::Result present(
         .pSwapchains = &swapchain,
         .pImageIndices = &image_idx,
     };
-    vk::Result const result =
-        swapchain_present_wrapper(command_queues.present_queue, present_info);
+    vk::Result result;
+    {
+        std::lock_guard const lock{queue_mutex};
+        result = swapchain_present_wrapper(
+            command_queues.present_queue, present_info);
+    }
     present_semaphore.clear();
     return result;
 }
+
+// Asks the semaphore for its counter first, a wait is only needed when the
+// submission is still running.
+static void wait_timeline(vk_commands& commands, uint64_t serial) {
+    vk::Result result;
+    if (serial <= commands.finished) {
+        return;
+    }
+    VK_CHECK_CREATE(result, commands.finished,
+        device.getSemaphoreCounterValue(commands.timeline));
+    if (serial <= commands.finished) {
+        return;
+    }
+    vk::SemaphoreWaitInfo const wait_info{
+        .semaphoreCount = 1,
+        .pSemaphores = &commands.timeline,
+        .pValues = &serial,
+    };
+    VK_CHECK(result, device.waitSemaphores(wait_info, 1e12));
+    commands.finished = serial;
+}
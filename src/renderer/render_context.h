@@ -1,5 +1,7 @@
 #pragma once
 
+#include <mutex>
+
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Weverything"
 #include "vk_mem_alloc.h"
@@ -13,12 +15,24 @@ bool window_should_close();
 
 void poll_window_event();
 
-void create_render_context();
+// A headless context has no window, surface or swapchain and only needs a
+// compute capable device, results are read back instead of presented. The GPU
+// scopes of gpu_profiler.h are timed for the budgets of the renderers, a
+// profiling context keeps them, with pipeline statistics queries where the
+// device has them.
+void create_render_context(bool headless = false, bool profiling = false);
+
+bool is_headless();
 
 void destroy_render_context();
 
 void wait_vulkan();
 
+// Queues are externally synchronized and the compute and graphics queue may
+// be the same one. Submitting and presenting lock them on their own, other
+// queue or device waits from a second thread hold the lock around them.
+std::unique_lock<std::mutex> lock_queues();
+
 std::pair<vk::CommandBuffer, uint32_t> get_command_buffer(
     vk::PipelineBindPoint bind_point);
 
@@ -28,8 +42,25 @@ void add_submit_wait(vk::PipelineBindPoint bind_point, vk::Semaphore semaphore,
 void add_submit_signal(
     vk::PipelineBindPoint bind_point, vk::Semaphore semaphore);
 
+// Waits on the GPU for a submission of the queue of the submitter bind
+// point, the wait may be added before that submission.
+void add_submission_wait(vk::PipelineBindPoint bind_point,
+    vk::PipelineBindPoint submitter, uint64_t serial,
+    vk::PipelineStageFlags stage);
+
 void submit_command_buffer(vk::PipelineBindPoint bind_point);
 
+// Serial of the latest submission on the queue of the bind point, starting
+// from 1 and signaled on the timeline semaphore of the queue. Waiting for one
+// blocks until that submission has finished, without draining the queue like
+// wait_vulkan.
+uint64_t get_submission_serial(vk::PipelineBindPoint bind_point);
+
+// Serial the command buffer being recorded gets once it is submitted.
+uint64_t get_recording_serial(vk::PipelineBindPoint bind_point);
+
+void wait_submission(vk::PipelineBindPoint bind_point, uint64_t serial);
+
 void add_present_wait(vk::Semaphore semaphore);
 
 vk::Result present(
@@ -2,10 +2,66 @@
 
 #include <cstdint>
 
+// How direct lighting picks the light to sample, the values match the
+// LIGHT_SAMPLING defines of the shaders.
+enum class light_sampling_mode : uint32_t {
+    uniform = 0,  // every light equally likely
+    bvh,          // area light triangles by importance through a light BVH
+    power,        // lights by power and their triangles by area
+};
+
+// Source of the random numbers of a sample, the values match the SAMPLER
+// defines of the shaders.
+enum class sampler_type : uint32_t {
+    random = 0,  // independent numbers from a hashed generator
+    sobol,       // Owen scrambled Sobol points, one dimension per number
+};
+
+// Arbitrary output variables accumulated next to the color for compositing,
+// every one is averaged over the samples of its pixel.
+uint32_t constexpr AOV_ALBEDO = 1 << 0;  // at the first hit
+uint32_t constexpr AOV_NORMAL = 1 << 1;  // shading normal at the first hit
+uint32_t constexpr AOV_DEPTH = 1 << 2;   // distance to the first hit
+uint32_t constexpr AOV_DIRECT = 1 << 3;  // light that bounced once
+uint32_t constexpr AOV_INDIRECT = 1 << 4;  // light that bounced more often
+uint32_t constexpr AOV_EMISSION = 1 << 5;  // emitters seen by the camera
+uint32_t constexpr AOV_SAMPLE_COUNT = 1 << 6;  // not averaged
+
 struct render_options {
     uint32_t resolution_x = 1280;
     uint32_t resolution_y = 720;
     uint32_t max_depth = 5;
     uint32_t tile_width = 256;
     uint32_t tile_height = 144;
+    uint32_t seed = 0;
+    // the megakernel loops over pixels with a fixed number of workgroups
+    bool persistent_threads = false;
+    // the wavefront sorts hits by material before shading them
+    bool sort_materials = false;
+    light_sampling_mode light_sampling = light_sampling_mode::uniform;
+    sampler_type sampler = sampler_type::random;
+    // the megakernel filters the accumulation before presenting or reading it
+    // back, guided by the albedo, normal and depth at the first hit
+    bool denoise = false;
+    // AOV bits, the megakernel exports them as layers of .exr renders
+    uint32_t aovs = 0;
+    // the megakernel stops sampling pixels whose mean luminance has a relative
+    // standard error below it, 0 samples every pixel
+    float adaptive_threshold = 0.0f;
+    // GPU milliseconds the megakernel preview may take per frame while the
+    // camera moves, its resolution and samples follow
+    float preview_frame_time = 16.0f;
+    // GPU milliseconds of tiles the megakernel records per frame once the
+    // camera rests
+    float tile_frame_time = 16.0f;
+};
+
+// Part of the image and of the sample sequence rendered offscreen, e.g. one
+// job of a distributed render. A zero sized region covers the whole image.
+struct render_region {
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t first_sample = 0;
 };
@@ -0,0 +1,52 @@
+#include "renderer/render_thread.h"
+
+#include <mutex>
+#include <thread>
+
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+#pragma clang diagnostic ignored "-Wglobal-constructors"
+
+static void run_render_thread(std::stop_token const& stop_token,
+    renderer const& renderer, scene const& scene);
+
+static std::jthread render_thread{};
+static std::mutex camera_mutex{};
+static camera next_camera{};  // guarded by camera_mutex
+
+void start_render_thread(
+    renderer const& renderer, scene const& scene, camera const& camera) {
+    renderer.update_data(scene);
+    renderer.accumulate(camera);
+    next_camera = camera;
+    next_camera.dirty = false;
+    render_thread = std::jthread{run_render_thread, std::cref(renderer),
+        std::cref(scene)};
+}
+
+void update_render_thread(camera const& camera) {
+    std::lock_guard const lock{camera_mutex};
+    bool const dirty = next_camera.dirty || camera.dirty;
+    next_camera = camera;
+    next_camera.dirty = dirty;
+}
+
+void stop_render_thread() {
+    render_thread.request_stop();
+    render_thread.join();
+}
+
+// The command buffers in flight pace the thread, recording one waits for the
+// submission that used it last.
+static void run_render_thread(std::stop_token const& stop_token,
+    renderer const& renderer, scene const& scene) {
+    while (!stop_token.stop_requested()) {
+        camera frame_camera{};
+        {
+            std::lock_guard const lock{camera_mutex};
+            frame_camera = next_camera;
+            next_camera.dirty = false;
+        }
+        renderer.update_data(scene);
+        renderer.accumulate(frame_camera);
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "renderer/renderer.h"
+#include "asset/camera.h"
+
+// Accumulates on a thread of its own with the accumulate of the renderer,
+// while the window thread keeps drawing and presenting what it finished last.
+// The samples per second then don't depend on the present mode or the input
+// handling of the window. The first frame is recorded before the thread
+// starts, it may tune the renderer on both queues.
+void start_render_thread(
+    renderer const& renderer, struct scene const& scene, camera const& camera);
+
+// Hands the camera of a window frame over, a dirty camera restarts the
+// accumulation even when the thread didn't see the frames in between.
+void update_render_thread(camera const& camera);
+
+void stop_render_thread();
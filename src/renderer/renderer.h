@@ -1,21 +1,69 @@
 #pragma once
 
+#include <vector>
+
+#include "asset/image_writer.h"
 #include "renderer/render_options.h"
 
+// The progressive accumulation of a renderer, enough to continue it later
+struct accumulation {
+    std::vector<float> sums;  // rgba sums over all samples
+    uint32_t sample_count = 0;
+    uint64_t traced_rays = 0;
+};
+
 struct renderer {
     void (*initialize)(render_options const& options) = nullptr;
 
     void (*prepare_data)(struct scene const& scene) = nullptr;
 
+    // swaps the options of an initialized renderer, the pipelines and scene
+    // data are kept and only frame sized resources are recreated
+    void (*set_options)(render_options const& options) = nullptr;
+
+    // restricts headless rendering and read backs to a region, the next
+    // camera reset starts its samples at the first sample of the region
+    void (*set_region)(render_region const& region) = nullptr;
+
     void (*update_data)(struct scene const& scene) = nullptr;
 
     void (*render)(struct camera const& camera) = nullptr;
 
+    // records and submits the compute work of a frame on the render thread,
+    // the window frames of render then only draw what it finished last. Null
+    // for renderers recording both in render.
+    void (*accumulate)(struct camera const& camera) = nullptr;
+
     void (*present)() = nullptr;
 
     void (*destroy)() = nullptr;
+
+    // waits for the accumulated samples and returns them as rgba floats
+    std::vector<float> (*read_back)() = nullptr;
+
+    // waits for the AOVs of the options and returns one layer per AOV
+    std::vector<image_layer> (*read_back_aovs)() = nullptr;
+
+    // copies the accumulation aside without waiting and returns a ticket, so
+    // the next frame can be rendered while the copy is fetched
+    uint32_t (*request_read_back)() = nullptr;
+
+    // waits for the copy of a ticket and returns it as rgba floats
+    std::vector<float> (*fetch_read_back)(uint32_t ticket) = nullptr;
+
+    // like fetch_read_back but returns the raw accumulation
+    accumulation (*fetch_accumulation)(uint32_t ticket) = nullptr;
+
+    // continues from an accumulation fetched earlier with the same scene,
+    // options and camera, the camera must not be dirty on the next render
+    void (*restore_accumulation)(accumulation const& state) = nullptr;
+
+    // rays traced into the accumulation, as of the last read back
+    uint64_t (*traced_rays)() = nullptr;
 };
 
 void load_rasterizer(renderer& renderer);
 
 void load_megakernel_raytracer(renderer& renderer);
+
+void load_wavefront_raytracer(renderer& renderer);
@@ -0,0 +1,1143 @@
+#include <algorithm>
+#include <cstddef>
+
+#include "check.h"
+#include "vulkan/vulkan_descriptor.h"
+#include "vulkan/vulkan_pipeline.h"
+#include "vulkan/vulkan_buffer.h"
+#include "vulkan/vulkan_image.h"
+
+#include "asset/camera.h"
+#include "asset/scene.h"
+#include "asset/texture.h"
+
+#include "renderer/renderer.h"
+#include "renderer/render_context.h"
+#include "renderer/raytracer_common.h"
+#include "renderer/bvh.h"
+#include "renderer/light_bvh.h"
+#include "renderer/light_distribution.h"
+
+#include "utils/to_span.h"
+#include "utils/file.h"
+
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+#pragma clang diagnostic ignored "-Wglobal-constructors"
+
+void wavefront_raytracer_initialize(render_options const& options);
+void wavefront_raytracer_prepare_data(scene const& scene);
+void wavefront_raytracer_set_options(render_options const& options);
+void wavefront_raytracer_set_region(render_region const& new_region);
+void wavefront_raytracer_update_data(scene const& scene);
+void wavefront_raytracer_render(camera const& camera);
+void wavefront_raytracer_present();
+void wavefront_raytracer_destroy();
+std::vector<float> wavefront_raytracer_read_back();
+uint32_t wavefront_raytracer_request_read_back();
+std::vector<float> wavefront_raytracer_fetch_read_back(uint32_t ticket);
+accumulation wavefront_raytracer_fetch_accumulation(uint32_t ticket);
+void wavefront_raytracer_restore_accumulation(accumulation const& state);
+uint64_t wavefront_raytracer_traced_rays();
+
+void load_wavefront_raytracer(renderer& renderer);
+
+static void create_wavefront_raytracer_pipeline();
+static void create_wavefront_raytracer_kernels();
+static void destroy_wavefront_raytracer_kernels();
+static void destroy_wavefront_raytracer_pipeline();
+static void prepare_wavefront_raytracer_resources(scene const& scene);
+static void clean_wavefront_raytracer_resources();
+static void prepare_accumulation_images(
+    vk::CommandBuffer compute_command_buffer,
+    vk::CommandBuffer graphics_command_buffer);
+static void clean_accumulation_images();
+static void apply_render_options(render_options const& options);
+static void prepare_rect_resources();
+static void bind_wavefront_raytracer(
+    vk::CommandBuffer command_buffer, uint32_t sync_idx);
+static void prepare_queue_buffers();
+static void clean_queue_buffers();
+static void queue_barrier(vk::CommandBuffer command_buffer);
+static void reset_queue(vk::CommandBuffer command_buffer, uint32_t queue);
+static void dispatch_queue(vk::CommandBuffer command_buffer,
+    vk::Pipeline pipeline, uint32_t queue);
+static void record_material_sort(vk::CommandBuffer command_buffer);
+static void record_wave(vk::CommandBuffer command_buffer,
+    struct wavefront_raytracer_pc& pc, uint32_t first_path,
+    uint32_t path_count);
+static void record_sample(vk::CommandBuffer command_buffer,
+    struct wavefront_raytracer_pc pc, glm::uvec2 offset, glm::uvec2 extent);
+static void clear_accumulation(vk::CommandBuffer command_buffer);
+static void accumulate_offscreen(camera const& camera);
+
+static bool initialized = false;
+
+static uint32_t constexpr PREVIEW_RATIO = 10;
+static uint32_t preview_width;
+static uint32_t preview_height;
+
+static uint32_t base_seed = 0;
+static sampler_type sampler = sampler_type::random;
+static uint32_t preview_counter = 0;
+
+static vk::DescriptorPool primary_descriptor_pool{};
+static vk::DescriptorPool indexing_descriptor_pool{};
+static vk::Sampler primary_sampler{};
+static vk::Sampler blocky_sampler{};
+
+static uint32_t constexpr WAVEFRONT_RAYTRACER_SET = 5;
+
+// invocations per workgroup of every kernel, paths are queued in units of it
+static uint32_t constexpr WAVEFRONT_WORKGROUP = 64;
+// entries of the traversal stack the bvh of the scene needs
+static uint32_t traversal_stack_size = 1;
+
+// a larger image is rendered in several waves of at most this many paths
+static uint32_t constexpr MAX_WAVE_PATHS = 1 << 20;
+
+static uint32_t constexpr PATH_SIZE = 64;
+static uint32_t constexpr HIT_SIZE = 32;
+static uint32_t constexpr SHADOW_RAY_SIZE = 48;
+
+// queue_t in wavefront.glsl, a count and the dispatch of its consumer
+struct wavefront_queue {
+    uint32_t count;
+    vk::DispatchIndirectCommand dispatch;
+};
+
+enum wavefront_queue_index : uint32_t {
+    RAY_QUEUE_0 = 0,
+    RAY_QUEUE_1 = 1,
+    HIT_QUEUE = 2,
+    SHADOW_QUEUE = 3,
+    QUEUE_COUNT = 4,
+};
+
+static uint32_t constexpr MAX_TEXTURE = 50;
+
+static uint32_t accumulation_counter = 0;
+
+// extent of the accumulation, the swapchain extent unless rendering headless
+static vk::Extent2D render_extent{};
+
+// rendered and read back part of a headless accumulation
+static render_region region{};
+
+static vk::ImageSubresourceRange constexpr whole_range{
+    .aspectMask = vk::ImageAspectFlagBits::eColor,
+    .baseMipLevel = 0,
+    .levelCount = 1,
+    .baseArrayLayer = 0,
+    .layerCount = 1,
+};
+
+static struct {
+    // descriptors
+    std::array<vk::DescriptorSetLayout, WAVEFRONT_RAYTRACER_SET>
+        descriptor_layouts;
+    std::array<std::array<vk::DescriptorSet, FRAME_IN_FLIGHT>,
+        WAVEFRONT_RAYTRACER_SET>
+        descriptor_sets;
+    // pipeline
+    vk::PipelineLayout pipeline_layout;
+    vk::Pipeline generate_pipeline;
+    vk::Pipeline extend_pipeline;
+    vk::Pipeline shade_pipeline;
+    vk::Pipeline connect_pipeline;
+    vk::Pipeline accumulate_pipeline;
+    vk::Pipeline sort_count_pipeline;
+    vk::Pipeline sort_scan_pipeline;
+    vk::Pipeline sort_scatter_pipeline;
+    // resources
+    // set 0
+    vk_buffer tlas_buffer;
+    vk_buffer blas_buffer;
+    // set 1
+    vk_buffer mesh_buffer;
+    vk_buffer transform_buffer;
+    vk_buffer inverse_transform_buffer;
+    vk_buffer instance_buffer;
+    vk_buffer triangle_buffer;
+    // set 2
+    vk_buffer material_buffer;
+    vk_buffer medium_buffer;
+    vk_buffer light_buffer;
+    vk_buffer light_bvh_buffer;
+    vk_buffer sky_distribution_buffer;
+    vk_buffer light_alias_buffer;
+    // set 3
+    vk_image accumulation_image;  // rendered by waves for accumulation
+    vk_image preview_image;       // low resolution for preview
+    std::vector<vk_image> texture_array;
+    // others
+    vk_image output_image;  // color from scratch image would be copied to
+                            // this image after every sample
+    vk_buffer ray_counter_buffer;  // rays traced since the last clear
+    // set 4
+    vk_buffer path_buffer;
+    vk_buffer hit_buffer;
+    vk_buffer shadow_ray_buffer;
+    vk_buffer ray_queue_buffer;
+    vk_buffer hit_queue_buffer;
+    vk_buffer queue_buffer;
+    vk_buffer material_bin_buffer;
+    vk_buffer sorted_hit_queue_buffer;
+} wavefront_raytracer;
+
+// paths in flight, the queues are sized for one wave of them
+static uint32_t wave_capacity = 0;
+
+static uint32_t max_tracing_depth = 0;
+static uint32_t light_count = 0;
+// misses and lights have a bin each, before those of the materials
+static uint32_t material_bin_count = 0;
+static bool sort_materials = false;
+static int32_t sky_light_idx = -1;
+static light_sampling_mode light_sampling = light_sampling_mode::uniform;
+
+struct wavefront_raytracer_pc {
+    glsl_raytracer_camera camera;
+    uint32_t random_seed;
+    uint32_t preview;
+    uint32_t max_depth;
+    uint32_t light_count;
+    int32_t sky_light;
+    uint32_t light_sampling;
+    uint32_t sampler;
+    uint32_t sample_index;
+    uint32_t count_rays;
+    glm::uvec2 rect_min{0};
+    glm::uvec2 rect_max{0};
+    uint32_t first_path = 0;
+    uint32_t path_count = 0;
+    uint32_t ray_queue = 0;
+    uint32_t sort_hits = 0;
+};
+
+static void create_wavefront_raytracer_pipeline() {
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptor_indexing_properties{
+        .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT,
+    };
+    VkPhysicalDeviceProperties2KHR phy_dev_properties{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR,
+        .pNext = &descriptor_indexing_properties,
+    };
+    vk::defaultDispatchLoaderDynamic.vkGetPhysicalDeviceProperties2(
+        physical_device, &phy_dev_properties);
+    std::array const bindings{
+        std::vector<vk_descriptor_set_binding>{
+                                               {vk::DescriptorType::eStorageBuffer, 1},
+                                               {vk::DescriptorType::eStorageBuffer, 1}},
+        std::vector<vk_descriptor_set_binding>{
+                                               {vk::DescriptorType::eStorageBuffer, 1},
+                                               {vk::DescriptorType::eStorageBuffer, 1},
+                                               {vk::DescriptorType::eStorageBuffer, 1},
+                                               {vk::DescriptorType::eStorageBuffer, 1},
+                                               {vk::DescriptorType::eStorageBuffer, 1}},
+        std::vector<vk_descriptor_set_binding>{
+                                               {vk::DescriptorType::eStorageBuffer, 1},
+                                               {vk::DescriptorType::eStorageBuffer, 1},
+                                               {vk::DescriptorType::eStorageBuffer, 1},
+                                               {vk::DescriptorType::eStorageBuffer, 1},
+                                               {vk::DescriptorType::eStorageBuffer, 1},
+                                               {vk::DescriptorType::eStorageBuffer, 1}},
+    };
+    std::vector<vk_descriptor_set_binding> const set_3_binding{
+        {        vk::DescriptorType::eStorageImage,           2},
+        {vk::DescriptorType::eCombinedImageSampler, MAX_TEXTURE},
+        {       vk::DescriptorType::eStorageBuffer,           1},
+    };
+    std::vector<vk_descriptor_set_binding> const set_4_binding(
+        8, {vk::DescriptorType::eStorageBuffer, 1});
+    for (uint32_t s = 0; s < bindings.size(); ++s) {
+        wavefront_raytracer.descriptor_layouts[s] =
+            create_descriptor_set_layout(
+                device, vk::ShaderStageFlagBits::eCompute, bindings[s]);
+        create_descriptor_set(device, primary_descriptor_pool,
+            wavefront_raytracer.descriptor_layouts[s],
+            wavefront_raytracer.descriptor_sets[s]);
+    }
+    wavefront_raytracer.descriptor_layouts[3] = create_descriptor_set_layout(
+        device, vk::ShaderStageFlagBits::eCompute, set_3_binding);
+    create_descriptor_set(device, indexing_descriptor_pool,
+        wavefront_raytracer.descriptor_layouts[3],
+        wavefront_raytracer.descriptor_sets[3]);
+    wavefront_raytracer.descriptor_layouts[4] = create_descriptor_set_layout(
+        device, vk::ShaderStageFlagBits::eCompute, set_4_binding);
+    create_descriptor_set(device, primary_descriptor_pool,
+        wavefront_raytracer.descriptor_layouts[4],
+        wavefront_raytracer.descriptor_sets[4]);
+    std::array pc_sizes{(uint32_t) sizeof(wavefront_raytracer_pc)};
+    std::array pc_stages{vk::ShaderStageFlagBits::eCompute};
+    wavefront_raytracer.pipeline_layout = create_pipeline_layout(
+        device, pc_sizes, pc_stages, wavefront_raytracer.descriptor_layouts);
+    create_wavefront_raytracer_kernels();
+}
+
+static void create_wavefront_raytracer_kernels() {
+    // the kernels are one dimensional and keep the traversal stack private
+    std::vector<uint32_t> const specialization_constants{
+        WAVEFRONT_WORKGROUP, 1, 0, traversal_stack_size};
+    wavefront_raytracer.generate_pipeline = create_compute_pipeline(device,
+        PATH_FROM_BINARY("shaders/wavefront_generate.comp.spv"),
+        wavefront_raytracer.pipeline_layout, specialization_constants);
+    wavefront_raytracer.extend_pipeline = create_compute_pipeline(device,
+        PATH_FROM_BINARY("shaders/wavefront_extend.comp.spv"),
+        wavefront_raytracer.pipeline_layout, specialization_constants);
+    wavefront_raytracer.shade_pipeline = create_compute_pipeline(device,
+        PATH_FROM_BINARY("shaders/wavefront_shade.comp.spv"),
+        wavefront_raytracer.pipeline_layout, specialization_constants);
+    wavefront_raytracer.connect_pipeline = create_compute_pipeline(device,
+        PATH_FROM_BINARY("shaders/wavefront_connect.comp.spv"),
+        wavefront_raytracer.pipeline_layout, specialization_constants);
+    wavefront_raytracer.accumulate_pipeline = create_compute_pipeline(device,
+        PATH_FROM_BINARY("shaders/wavefront_accumulate.comp.spv"),
+        wavefront_raytracer.pipeline_layout, specialization_constants);
+    wavefront_raytracer.sort_count_pipeline = create_compute_pipeline(device,
+        PATH_FROM_BINARY("shaders/wavefront_sort_count.comp.spv"),
+        wavefront_raytracer.pipeline_layout, specialization_constants);
+    wavefront_raytracer.sort_scan_pipeline = create_compute_pipeline(device,
+        PATH_FROM_BINARY("shaders/wavefront_sort_scan.comp.spv"),
+        wavefront_raytracer.pipeline_layout, specialization_constants);
+    wavefront_raytracer.sort_scatter_pipeline = create_compute_pipeline(device,
+        PATH_FROM_BINARY("shaders/wavefront_sort_scatter.comp.spv"),
+        wavefront_raytracer.pipeline_layout, specialization_constants);
+}
+
+static void destroy_wavefront_raytracer_kernels() {
+    device.destroyPipeline(wavefront_raytracer.generate_pipeline);
+    device.destroyPipeline(wavefront_raytracer.extend_pipeline);
+    device.destroyPipeline(wavefront_raytracer.shade_pipeline);
+    device.destroyPipeline(wavefront_raytracer.connect_pipeline);
+    device.destroyPipeline(wavefront_raytracer.accumulate_pipeline);
+    device.destroyPipeline(wavefront_raytracer.sort_count_pipeline);
+    device.destroyPipeline(wavefront_raytracer.sort_scan_pipeline);
+    device.destroyPipeline(wavefront_raytracer.sort_scatter_pipeline);
+}
+
+static void destroy_wavefront_raytracer_pipeline() {
+    for (uint32_t s = 0; s < WAVEFRONT_RAYTRACER_SET; ++s) {
+        device.destroyDescriptorSetLayout(
+            wavefront_raytracer.descriptor_layouts[s]);
+    }
+    device.destroyPipelineLayout(wavefront_raytracer.pipeline_layout);
+    destroy_wavefront_raytracer_kernels();
+}
+
+static void prepare_wavefront_raytracer_resources(scene const& scene) {
+    CHECK(scene.textures.size() <= MAX_TEXTURE, "");
+    clean_wavefront_raytracer_resources();
+    light_count = (uint32_t) scene.lights.size();
+    material_bin_count = (uint32_t) scene.materials.size() + 2;
+    sky_light_idx = scene.lights.back().type == light_type::sky ?
+                        (int32_t) scene.lights.size() - 1 :
+                        -1;
+    bvh const bvh = create_bvh(scene);
+    uint32_t const stack_size = get_traversal_stack_size(bvh);
+    if (stack_size != traversal_stack_size) {
+        // the samples of the previous scene are done with the kernels
+        wait_vulkan();
+        traversal_stack_size = stack_size;
+        destroy_wavefront_raytracer_kernels();
+        create_wavefront_raytracer_kernels();
+    }
+    std::vector<glsl_light_bvh_node> const light_bvh =
+        create_light_bvh(scene, bvh);
+    std::vector<float> const sky_distribution = create_sky_distribution(scene);
+    std::vector<glsl_alias_entry> const light_alias =
+        create_light_alias_tables(scene, bvh, light_bvh);
+    std::vector<glm::mat4> inverse_transformations{};
+    inverse_transformations.reserve(scene.transformation.size());
+    for (uint32_t t = 0; t < scene.transformation.size(); ++t) {
+        inverse_transformations.push_back(
+            glm::inverse(scene.transformation[t]));
+    }
+    auto const [compute_command_buffer, compute_sync_idx] =
+        get_command_buffer(vk::PipelineBindPoint::eCompute);
+    // there is no graphics queue work when rendering headless
+    vk::CommandBuffer const graphics_command_buffer =
+        is_headless() ?
+            compute_command_buffer :
+            get_command_buffer(vk::PipelineBindPoint::eGraphics).first;
+    wavefront_raytracer.tlas_buffer = create_gpu_only_buffer(vma_alloc,
+        size_in_byte(bvh.tlas), {}, vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.blas_buffer = create_gpu_only_buffer(vma_alloc,
+        size_in_byte(bvh.blas), {}, vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.mesh_buffer = create_gpu_only_buffer(vma_alloc,
+        size_in_byte(bvh.meshes), {}, vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.transform_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(scene.transformation),
+            {}, vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.inverse_transform_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(inverse_transformations),
+            {}, vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.instance_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(bvh.instances), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.triangle_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(bvh.triangles), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.material_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(scene.materials), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.medium_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(scene.mediums), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.light_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(scene.lights), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.light_bvh_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(light_bvh), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.sky_distribution_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(sky_distribution), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.light_alias_buffer =
+        create_gpu_only_buffer(vma_alloc, size_in_byte(light_alias), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.ray_counter_buffer =
+        create_gpu_only_buffer(vma_alloc, 2 * (uint32_t) sizeof(uint32_t), {},
+            vk::BufferUsageFlagBits::eStorageBuffer |
+                vk::BufferUsageFlagBits::eTransferSrc);
+    wavefront_raytracer.preview_image = create_texture2d(device, vma_alloc,
+        compute_command_buffer, preview_width, preview_height, 1,
+        vk::Format::eR32G32B32A32Sfloat,
+        {command_queues.graphics_queue_idx, command_queues.compute_queue_idx},
+        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage);
+    prepare_accumulation_images(
+        compute_command_buffer, graphics_command_buffer);
+    for (uint32_t t = 0; t < scene.textures.size(); ++t) {
+        texture_data const& data = scene.textures[t];
+        vk::Format const format = data.format == texture_format::unorm ?
+                                      vk::Format::eR8G8B8A8Unorm :
+                                      vk::Format::eR32G32B32A32Sfloat;
+        wavefront_raytracer.texture_array.push_back(
+            create_texture2d(device, vma_alloc, graphics_command_buffer,
+                data.width, data.height, 1, format,
+                {command_queues.compute_queue_idx,
+                    command_queues.graphics_queue_idx},
+                vk::ImageUsageFlagBits::eSampled |
+                    vk::ImageUsageFlagBits::eTransferDst));
+    }
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.tlas_buffer, to_byte_span(bvh.tlas), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.blas_buffer, to_byte_span(bvh.blas), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.mesh_buffer, to_byte_span(bvh.meshes), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.transform_buffer,
+        to_byte_span(scene.transformation), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.inverse_transform_buffer,
+        to_byte_span(inverse_transformations), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.instance_buffer, to_byte_span(bvh.instances), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.triangle_buffer, to_byte_span(bvh.triangles), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.material_buffer, to_byte_span(scene.materials), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.medium_buffer, to_byte_span(scene.mediums), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.light_buffer, to_byte_span(scene.lights), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.light_bvh_buffer, to_byte_span(light_bvh), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.sky_distribution_buffer,
+        to_byte_span(sky_distribution), 0);
+    update_buffer(vma_alloc, compute_command_buffer,
+        wavefront_raytracer.light_alias_buffer, to_byte_span(light_alias), 0);
+    for (uint32_t t = 0; t < wavefront_raytracer.texture_array.size(); ++t) {
+        update_texture2d(vma_alloc, wavefront_raytracer.texture_array[t],
+            graphics_command_buffer, scene.textures[t]);
+    }
+    // buffer barrier
+    std::array const buffers{
+        wavefront_raytracer.tlas_buffer,
+        wavefront_raytracer.blas_buffer,
+        wavefront_raytracer.mesh_buffer,
+        wavefront_raytracer.transform_buffer,
+        wavefront_raytracer.inverse_transform_buffer,
+        wavefront_raytracer.instance_buffer,
+        wavefront_raytracer.triangle_buffer,
+        wavefront_raytracer.material_buffer,
+        wavefront_raytracer.medium_buffer,
+        wavefront_raytracer.light_buffer,
+        wavefront_raytracer.light_bvh_buffer,
+        wavefront_raytracer.sky_distribution_buffer,
+        wavefront_raytracer.light_alias_buffer,
+    };
+    std::array<vk::BufferMemoryBarrier, buffers.size()> buffer_barriers{};
+    for (uint32_t i = 0; i < buffers.size(); ++i) {
+        buffer_barriers[i] = vk::BufferMemoryBarrier{
+            .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+            .dstAccessMask = vk::AccessFlagBits::eShaderRead,
+            .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .buffer = buffers[i].buffer,
+            .offset = 0,
+            .size = vk::WholeSize,
+        };
+    }
+    // image barrier
+    std::vector<vk::ImageMemoryBarrier> image_barriers{};
+    image_barriers.reserve(wavefront_raytracer.texture_array.size());
+    for (uint32_t t = 0; t < wavefront_raytracer.texture_array.size(); ++t) {
+        image_barriers.push_back(vk::ImageMemoryBarrier{
+            .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+            .dstAccessMask = vk::AccessFlagBits::eShaderRead,
+            .oldLayout = vk::ImageLayout::eGeneral,
+            .newLayout = vk::ImageLayout::eGeneral,
+            .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .image = wavefront_raytracer.texture_array[t].image,
+            .subresourceRange = vk::ImageSubresourceRange{
+                                                          .aspectMask = vk::ImageAspectFlagBits::eColor,
+                                                          .baseMipLevel = 0,
+                                                          .levelCount = wavefront_raytracer.texture_array[t].level,
+                                                          .baseArrayLayer = 0,
+                                                          .layerCount = wavefront_raytracer.texture_array[t].layer}
+        });
+    }
+    compute_command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader, {}, 0, nullptr,
+        (uint32_t) buffer_barriers.size(), buffer_barriers.data(),
+        (uint32_t) image_barriers.size(), image_barriers.data());
+    for (uint32_t f = 0; f < FRAME_IN_FLIGHT; ++f) {
+        // set 0
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[0][f], 0, 0,
+            wavefront_raytracer.tlas_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[0][f], 1, 0,
+            wavefront_raytracer.blas_buffer);
+        // set 1
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[1][f], 0, 0,
+            wavefront_raytracer.mesh_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[1][f], 1, 0,
+            wavefront_raytracer.transform_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[1][f], 2, 0,
+            wavefront_raytracer.inverse_transform_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[1][f], 3, 0,
+            wavefront_raytracer.instance_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[1][f], 4, 0,
+            wavefront_raytracer.triangle_buffer);
+        // set 2
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[2][f], 0, 0,
+            wavefront_raytracer.material_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[2][f], 1, 0,
+            wavefront_raytracer.medium_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[2][f], 2, 0,
+            wavefront_raytracer.light_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[2][f], 3, 0,
+            wavefront_raytracer.light_bvh_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[2][f], 4, 0,
+            wavefront_raytracer.sky_distribution_buffer);
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[2][f], 5, 0,
+            wavefront_raytracer.light_alias_buffer);
+        // set 3
+        update_descriptor_storage_image(device,
+            wavefront_raytracer.descriptor_sets[3][f], 0, 1,
+            wavefront_raytracer.preview_image.primary_view);
+        update_descriptor_storage_buffer_whole(device,
+            wavefront_raytracer.descriptor_sets[3][f], 2, 0,
+            wavefront_raytracer.ray_counter_buffer);
+        for (uint32_t t = 0; t < wavefront_raytracer.texture_array.size();
+             ++t) {
+            update_descriptor_image_sampler_combined(device,
+                wavefront_raytracer.descriptor_sets[3][f], 1, t,
+                primary_sampler,
+                wavefront_raytracer.texture_array[t].primary_view);
+        }
+    }
+}
+
+static void clean_wavefront_raytracer_resources() {
+    destroy_buffer(vma_alloc, wavefront_raytracer.tlas_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.blas_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.mesh_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.transform_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.inverse_transform_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.instance_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.triangle_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.material_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.medium_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.light_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.light_bvh_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.sky_distribution_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.light_alias_buffer);
+    destroy_image(device, vma_alloc, wavefront_raytracer.preview_image);
+    destroy_buffer(vma_alloc, wavefront_raytracer.ray_counter_buffer);
+    clean_accumulation_images();
+    for (uint32_t i = 0; i < wavefront_raytracer.texture_array.size(); ++i) {
+        destroy_image(device, vma_alloc, wavefront_raytracer.texture_array[i]);
+    }
+    wavefront_raytracer.texture_array.clear();
+}
+
+static void prepare_accumulation_images(
+    vk::CommandBuffer compute_command_buffer,
+    vk::CommandBuffer graphics_command_buffer) {
+    wavefront_raytracer.accumulation_image = create_texture2d(device,
+        vma_alloc, compute_command_buffer, render_extent.width,
+        render_extent.height, 1, vk::Format::eR32G32B32A32Sfloat, {},
+        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage |
+            vk::ImageUsageFlagBits::eTransferSrc |
+            vk::ImageUsageFlagBits::eTransferDst);
+    wavefront_raytracer.output_image = create_texture2d(device, vma_alloc,
+        graphics_command_buffer, render_extent.width, render_extent.height, 1,
+        vk::Format::eR32G32B32A32Sfloat, {},
+        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage |
+            vk::ImageUsageFlagBits::eTransferDst);
+    for (uint32_t f = 0; f < FRAME_IN_FLIGHT; ++f) {
+        update_descriptor_storage_image(device,
+            wavefront_raytracer.descriptor_sets[3][f], 0, 0,
+            wavefront_raytracer.accumulation_image.primary_view);
+    }
+    prepare_queue_buffers();
+}
+
+static void clean_accumulation_images() {
+    clean_queue_buffers();
+    destroy_image(device, vma_alloc, wavefront_raytracer.accumulation_image);
+    destroy_image(device, vma_alloc, wavefront_raytracer.output_image);
+    clean_raytracer_read_backs();
+    wavefront_raytracer.accumulation_image = {};
+    wavefront_raytracer.output_image = {};
+}
+
+// The queues hold one wave, which covers the whole image unless it is large.
+static void prepare_queue_buffers() {
+    wave_capacity = std::min(MAX_WAVE_PATHS,
+        std::max(render_extent.width * render_extent.height,
+            preview_width * preview_height));
+    wavefront_raytracer.path_buffer =
+        create_gpu_only_buffer(vma_alloc, wave_capacity * PATH_SIZE, {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.hit_buffer =
+        create_gpu_only_buffer(vma_alloc, wave_capacity * HIT_SIZE, {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.shadow_ray_buffer =
+        create_gpu_only_buffer(vma_alloc, wave_capacity * SHADOW_RAY_SIZE, {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.ray_queue_buffer = create_gpu_only_buffer(vma_alloc,
+        2 * wave_capacity * (uint32_t) sizeof(uint32_t), {},
+        vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.hit_queue_buffer = create_gpu_only_buffer(vma_alloc,
+        wave_capacity * (uint32_t) sizeof(uint32_t), {},
+        vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.queue_buffer = create_gpu_only_buffer(vma_alloc,
+        QUEUE_COUNT * (uint32_t) sizeof(wavefront_queue), {},
+        vk::BufferUsageFlagBits::eStorageBuffer |
+            vk::BufferUsageFlagBits::eIndirectBuffer);
+    wavefront_raytracer.material_bin_buffer = create_gpu_only_buffer(vma_alloc,
+        material_bin_count * (uint32_t) sizeof(uint32_t), {},
+        vk::BufferUsageFlagBits::eStorageBuffer);
+    wavefront_raytracer.sorted_hit_queue_buffer =
+        create_gpu_only_buffer(vma_alloc,
+            wave_capacity * (uint32_t) sizeof(uint32_t), {},
+            vk::BufferUsageFlagBits::eStorageBuffer);
+    std::array const buffers{
+        wavefront_raytracer.path_buffer,
+        wavefront_raytracer.hit_buffer,
+        wavefront_raytracer.shadow_ray_buffer,
+        wavefront_raytracer.ray_queue_buffer,
+        wavefront_raytracer.hit_queue_buffer,
+        wavefront_raytracer.queue_buffer,
+        wavefront_raytracer.material_bin_buffer,
+        wavefront_raytracer.sorted_hit_queue_buffer,
+    };
+    for (uint32_t f = 0; f < FRAME_IN_FLIGHT; ++f) {
+        for (uint32_t b = 0; b < buffers.size(); ++b) {
+            update_descriptor_storage_buffer_whole(device,
+                wavefront_raytracer.descriptor_sets[4][f], b, 0, buffers[b]);
+        }
+    }
+}
+
+static void clean_queue_buffers() {
+    destroy_buffer(vma_alloc, wavefront_raytracer.path_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.hit_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.shadow_ray_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.ray_queue_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.hit_queue_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.queue_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.material_bin_buffer);
+    destroy_buffer(vma_alloc, wavefront_raytracer.sorted_hit_queue_buffer);
+    wave_capacity = 0;
+}
+
+static void apply_render_options(render_options const& options) {
+    max_tracing_depth = options.max_depth;
+    base_seed = options.seed;
+    sort_materials = options.sort_materials;
+    light_sampling = options.light_sampling;
+    sampler = options.sampler;
+}
+
+// the accumulation copy is drawn as image 0 and the preview as image 1
+static void prepare_rect_resources() {
+    set_raytracer_frame_image(0, primary_sampler,
+        wavefront_raytracer.output_image.primary_view);
+    set_raytracer_frame_image(
+        1, blocky_sampler, wavefront_raytracer.preview_image.primary_view);
+}
+
+// Every kernel shares the pipeline layout, so the sets stay bound while the
+// pipelines are switched between the kernels.
+static void bind_wavefront_raytracer(
+    vk::CommandBuffer command_buffer, uint32_t sync_idx) {
+    std::array<vk::DescriptorSet, WAVEFRONT_RAYTRACER_SET>
+        wavefront_raytracer_sets{};
+    for (uint32_t s = 0; s < WAVEFRONT_RAYTRACER_SET; ++s) {
+        wavefront_raytracer_sets[s] =
+            wavefront_raytracer.descriptor_sets[s][sync_idx];
+    }
+    command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+        wavefront_raytracer.pipeline_layout, 0, WAVEFRONT_RAYTRACER_SET,
+        wavefront_raytracer_sets.data(), 0, nullptr);
+}
+
+// A kernel consumes the queues and the dispatch arguments written by the one
+// before it.
+static void queue_barrier(vk::CommandBuffer command_buffer) {
+    vk::MemoryBarrier const barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite |
+                         vk::AccessFlagBits::eTransferWrite,
+        .dstAccessMask = vk::AccessFlagBits::eShaderRead |
+                         vk::AccessFlagBits::eShaderWrite |
+                         vk::AccessFlagBits::eIndirectCommandRead |
+                         vk::AccessFlagBits::eTransferWrite,
+    };
+    command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eTransfer,
+        vk::PipelineStageFlagBits::eComputeShader |
+            vk::PipelineStageFlagBits::eDrawIndirect |
+            vk::PipelineStageFlagBits::eTransfer,
+        {}, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+static void reset_queue(vk::CommandBuffer command_buffer, uint32_t queue) {
+    wavefront_queue constexpr empty{
+        .count = 0,
+        .dispatch = {.x = 0, .y = 1, .z = 1},
+    };
+    command_buffer.updateBuffer(wavefront_raytracer.queue_buffer.buffer,
+        queue * sizeof(wavefront_queue), sizeof(empty), &empty);
+}
+
+static void dispatch_queue(vk::CommandBuffer command_buffer,
+    vk::Pipeline pipeline, uint32_t queue) {
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+    command_buffer.dispatchIndirect(wavefront_raytracer.queue_buffer.buffer,
+        queue * sizeof(wavefront_queue) + offsetof(wavefront_queue, dispatch));
+}
+
+// Counting sort of the hit queue by material: count the hits of every bin,
+// scan the counts into the first slot of every bin and scatter the hits.
+// Shade then runs mostly coherent bsdf code within a subgroup.
+static void record_material_sort(vk::CommandBuffer command_buffer) {
+    queue_barrier(command_buffer);
+    dispatch_queue(
+        command_buffer, wavefront_raytracer.sort_count_pipeline, HIT_QUEUE);
+    queue_barrier(command_buffer);
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+        wavefront_raytracer.sort_scan_pipeline);
+    command_buffer.dispatch(1, 1, 1);
+    queue_barrier(command_buffer);
+    dispatch_queue(
+        command_buffer, wavefront_raytracer.sort_scatter_pipeline, HIT_QUEUE);
+}
+
+// Generates a path per pixel of the wave and bounces them all once per depth.
+// Each kernel only runs the workgroups its queue filled, so terminated paths
+// cost nothing in the later bounces.
+static void record_wave(vk::CommandBuffer command_buffer,
+    wavefront_raytracer_pc& pc, uint32_t first_path, uint32_t path_count) {
+    pc.first_path = first_path;
+    pc.path_count = path_count;
+    pc.ray_queue = RAY_QUEUE_0;
+    pc.sort_hits = sort_materials ? 1 : 0;
+    queue_barrier(command_buffer);
+    for (uint32_t q = 0; q < QUEUE_COUNT; ++q) {
+        reset_queue(command_buffer, q);
+    }
+    queue_barrier(command_buffer);
+    command_buffer.pushConstants(wavefront_raytracer.pipeline_layout,
+        vk::ShaderStageFlagBits::eCompute, 0, (uint32_t) sizeof(pc), &pc);
+    uint32_t const group_count =
+        (path_count + WAVEFRONT_WORKGROUP - 1) / WAVEFRONT_WORKGROUP;
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+        wavefront_raytracer.generate_pipeline);
+    command_buffer.dispatch(group_count, 1, 1);
+    auto ray_queue = RAY_QUEUE_0;
+    auto next_ray_queue = RAY_QUEUE_1;
+    // like the megakernel, the ray of max_depth still gathers emission
+    for (uint32_t depth = 0; depth <= pc.max_depth; ++depth) {
+        queue_barrier(command_buffer);
+        reset_queue(command_buffer, HIT_QUEUE);
+        reset_queue(command_buffer, SHADOW_QUEUE);
+        reset_queue(command_buffer, next_ray_queue);
+        if (sort_materials) {
+            command_buffer.fillBuffer(
+                wavefront_raytracer.material_bin_buffer.buffer, 0,
+                vk::WholeSize, 0);
+        }
+        queue_barrier(command_buffer);
+        pc.ray_queue = ray_queue;
+        command_buffer.pushConstants(wavefront_raytracer.pipeline_layout,
+            vk::ShaderStageFlagBits::eCompute,
+            (uint32_t) offsetof(wavefront_raytracer_pc, ray_queue),
+            (uint32_t) sizeof(pc.ray_queue), &pc.ray_queue);
+        dispatch_queue(
+            command_buffer, wavefront_raytracer.extend_pipeline, ray_queue);
+        if (sort_materials) {
+            record_material_sort(command_buffer);
+        }
+        queue_barrier(command_buffer);
+        dispatch_queue(
+            command_buffer, wavefront_raytracer.shade_pipeline, HIT_QUEUE);
+        queue_barrier(command_buffer);
+        dispatch_queue(
+            command_buffer, wavefront_raytracer.connect_pipeline, SHADOW_QUEUE);
+        std::swap(ray_queue, next_ray_queue);
+    }
+    queue_barrier(command_buffer);
+    command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+        wavefront_raytracer.accumulate_pipeline);
+    command_buffer.dispatch(group_count, 1, 1);
+}
+
+// One sample of every pixel of the rect, in as many waves as the queues need.
+static void record_sample(vk::CommandBuffer command_buffer,
+    wavefront_raytracer_pc pc, glm::uvec2 offset, glm::uvec2 extent) {
+    pc.rect_min = offset;
+    pc.rect_max = offset + extent;
+    uint32_t const pixel_count = extent.x * extent.y;
+    for (uint32_t first = 0; first < pixel_count; first += wave_capacity) {
+        record_wave(command_buffer, pc, first,
+            std::min(wave_capacity, pixel_count - first));
+    }
+}
+
+static void clear_accumulation(vk::CommandBuffer command_buffer) {
+    std::array const images{wavefront_raytracer.accumulation_image.image};
+    clear_raytracer_accumulation(
+        command_buffer, images, wavefront_raytracer.ray_counter_buffer.buffer);
+}
+
+// Headless rendering has nothing to keep responsive, so every wave of one
+// sample is recorded into the same command buffer.
+static void accumulate_offscreen(camera const& camera) {
+    auto const [compute_command_buffer, compute_sync_idx] =
+        get_command_buffer(vk::PipelineBindPoint::eCompute);
+    bind_wavefront_raytracer(compute_command_buffer, compute_sync_idx);
+    if (camera.dirty) {
+        accumulation_counter = 0;
+    }
+    if (accumulation_counter == 0) {
+        clear_accumulation(compute_command_buffer);
+    }
+    wavefront_raytracer_pc const wavefront_raytracer_pc{
+        .camera = get_glsl_raytracer_camera(
+            camera, render_extent.width, render_extent.height),
+        .random_seed = get_sample_seed(base_seed, sampler,
+            region.first_sample + accumulation_counter),
+        .preview = 0,
+        .max_depth = max_tracing_depth,
+        .light_count = light_count,
+        .sky_light = sky_light_idx,
+        .light_sampling = (uint32_t) light_sampling,
+        .sampler = (uint32_t) sampler,
+        .sample_index = region.first_sample + accumulation_counter,
+        .count_rays = 1,
+    };
+    if (region.width != 0) {
+        record_sample(compute_command_buffer, wavefront_raytracer_pc,
+            {region.x, region.y}, {region.width, region.height});
+    } else {
+        record_sample(compute_command_buffer, wavefront_raytracer_pc, {0, 0},
+            {render_extent.width, render_extent.height});
+    }
+    ++accumulation_counter;
+    // the next sample accumulates on top of this one
+    vk::ImageMemoryBarrier const render_barrier{
+        .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+        .dstAccessMask =
+            vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite,
+        .oldLayout = vk::ImageLayout::eGeneral,
+        .newLayout = vk::ImageLayout::eGeneral,
+        .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+        .image = wavefront_raytracer.accumulation_image.image,
+        .subresourceRange = whole_range,
+    };
+    compute_command_buffer.pipelineBarrier(
+        vk::PipelineStageFlagBits::eComputeShader,
+        vk::PipelineStageFlagBits::eComputeShader, {}, 0, nullptr, 0, nullptr,
+        1, &render_barrier);
+}
+
+void wavefront_raytracer_initialize(render_options const& options) {
+    if (initialized) {
+        return;
+    }
+    initialized = true;
+    apply_render_options(options);
+    render_extent = get_render_extent(options);
+    primary_descriptor_pool = create_descriptor_pool(device);
+    indexing_descriptor_pool = create_descriptor_pool(
+        device, vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind);
+    primary_sampler = create_default_sampler(device);
+    blocky_sampler = create_blocky_sampler(device);
+    create_wavefront_raytracer_pipeline();
+    if (!is_headless()) {
+        create_raytracer_frame_objects();
+    }
+}
+
+void wavefront_raytracer_prepare_data(scene const& scene) {
+    preview_width = win_width / PREVIEW_RATIO;
+    preview_height = win_height / PREVIEW_RATIO;
+    prepare_wavefront_raytracer_resources(scene);
+    if (!is_headless()) {
+        prepare_rect_resources();
+    }
+}
+
+void wavefront_raytracer_set_options(render_options const& options) {
+    apply_render_options(options);
+    accumulation_counter = 0;
+    // the accumulation follows the swapchain when there is a window
+    vk::Extent2D const extent{options.resolution_x, options.resolution_y};
+    if (!is_headless() || extent == render_extent) {
+        return;
+    }
+    render_extent = extent;
+    if (!wavefront_raytracer.accumulation_image.image) {
+        return;
+    }
+    wait_vulkan();
+    clean_accumulation_images();
+    auto const [compute_command_buffer, compute_sync_idx] =
+        get_command_buffer(vk::PipelineBindPoint::eCompute);
+    prepare_accumulation_images(compute_command_buffer, compute_command_buffer);
+}
+
+void wavefront_raytracer_set_region(render_region const& new_region) {
+    check_render_region(new_region, render_extent);
+    region = new_region;
+    accumulation_counter = 0;
+}
+
+void wavefront_raytracer_update_data(scene const&) {
+}
+
+void wavefront_raytracer_render(camera const& camera) {
+    if (is_headless()) {
+        accumulate_offscreen(camera);
+        return;
+    }
+    auto const [compute_command_buffer, compute_sync_idx] =
+        get_command_buffer(vk::PipelineBindPoint::eCompute);
+    auto const [graphics_command_buffer, graphics_sync_idx] =
+        get_command_buffer(vk::PipelineBindPoint::eGraphics);
+    if (!acquire_raytracer_frame(graphics_sync_idx)) {
+        return;
+    }
+    // wavefront raytracer
+    bind_wavefront_raytracer(compute_command_buffer, compute_sync_idx);
+    if (camera.dirty) {
+        bool const camera_start_moving = accumulation_counter != 0;
+        accumulation_counter = 0;
+        wavefront_raytracer_pc const wavefront_raytracer_pc{
+            .camera = get_glsl_raytracer_camera(
+                camera, preview_width, preview_height),
+            .random_seed = get_sample_seed(base_seed, sampler, preview_counter),
+            .preview = 1,
+            .max_depth = max_tracing_depth,
+            .light_count = light_count,
+            .sky_light = sky_light_idx,
+            .light_sampling = (uint32_t) light_sampling,
+            .sampler = (uint32_t) sampler,
+            .sample_index = preview_counter++,
+            .count_rays = 0,
+        };
+        record_sample(compute_command_buffer, wavefront_raytracer_pc, {0, 0},
+            {preview_width, preview_height});
+        // the compute buffer is submitted before the graphics one
+        if (camera_start_moving) {
+            add_submission_wait(vk::PipelineBindPoint::eGraphics,
+                vk::PipelineBindPoint::eCompute,
+                get_recording_serial(vk::PipelineBindPoint::eCompute),
+                vk::PipelineStageFlagBits::eFragmentShader);
+        }
+    } else {
+        if (accumulation_counter == 0) {
+            clear_accumulation(compute_command_buffer);
+        }
+        wavefront_raytracer_pc const wavefront_raytracer_pc{
+            .camera = get_glsl_raytracer_camera(
+                camera, render_extent.width, render_extent.height),
+            .random_seed =
+                get_sample_seed(base_seed, sampler, accumulation_counter),
+            .preview = 0,
+            .max_depth = max_tracing_depth,
+            .light_count = light_count,
+            .sky_light = sky_light_idx,
+            .light_sampling = (uint32_t) light_sampling,
+            .sampler = (uint32_t) sampler,
+            .sample_index = accumulation_counter,
+            .count_rays = 0,
+        };
+        // the queues keep a sample cheap enough to finish within a frame
+        record_sample(compute_command_buffer, wavefront_raytracer_pc, {0, 0},
+            {render_extent.width, render_extent.height});
+        ++accumulation_counter;
+        vk::ImageMemoryBarrier const render_barrier{
+            .srcAccessMask = vk::AccessFlagBits::eShaderWrite,
+            .dstAccessMask = vk::AccessFlagBits::eTransferRead,
+            .oldLayout = vk::ImageLayout::eGeneral,
+            .newLayout = vk::ImageLayout::eGeneral,
+            .srcQueueFamilyIndex = command_queues.compute_queue_idx,
+            .dstQueueFamilyIndex = command_queues.compute_queue_idx,
+            .image = wavefront_raytracer.accumulation_image.image,
+            .subresourceRange = whole_range,
+        };
+        compute_command_buffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader,
+            vk::PipelineStageFlagBits::eTransfer, {}, 0, nullptr, 0,
+            nullptr, 1, &render_barrier);
+        vk::ImageSubresourceLayers const layer{
+            .aspectMask = vk::ImageAspectFlagBits::eColor,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        };
+        vk::Offset3D const offset{0, 0, 0};
+        vk::Extent3D const extent{
+            wavefront_raytracer.accumulation_image.width,
+            wavefront_raytracer.accumulation_image.height,
+            1,
+        };
+        vk::ImageCopy const image_copy{
+            .srcSubresource = layer,
+            .srcOffset = offset,
+            .dstSubresource = layer,
+            .dstOffset = offset,
+            .extent = extent,
+        };
+        compute_command_buffer.copyImage(
+            wavefront_raytracer.accumulation_image.image,
+            vk::ImageLayout::eGeneral,
+            wavefront_raytracer.output_image.image,
+            vk::ImageLayout::eGeneral, 1, &image_copy);
+        add_submission_wait(vk::PipelineBindPoint::eGraphics,
+            vk::PipelineBindPoint::eCompute,
+            get_recording_serial(vk::PipelineBindPoint::eCompute),
+            vk::PipelineStageFlagBits::eFragmentShader);
+    }
+    // rect, the accumulation counts its samples in alpha
+    bool const only_preview = accumulation_counter == 0;
+    draw_raytracer_frame(
+        graphics_command_buffer, graphics_sync_idx, only_preview ? 1u : 0u);
+    if (camera.dirty) {
+        vk::ImageMemoryBarrier const preview_barrier{
+            .srcAccessMask = vk::AccessFlagBits::eNone,
+            .dstAccessMask = vk::AccessFlagBits::eNone,
+            .oldLayout = vk::ImageLayout::eGeneral,
+            .newLayout = vk::ImageLayout::eGeneral,
+            .srcQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .dstQueueFamilyIndex = vk::QueueFamilyIgnored,
+            .image = wavefront_raytracer.preview_image.image,
+            .subresourceRange = whole_range,
+        };
+        compute_command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eNone,
+            vk::PipelineStageFlagBits::eComputeShader, {}, 0, nullptr, 0,
+            nullptr, 1, &preview_barrier);
+    }
+}
+
+void wavefront_raytracer_present() {
+    if (is_headless()) {
+        return;
+    }
+    present_raytracer_frame();
+}
+
+void wavefront_raytracer_destroy() {
+    if (!initialized) {
+        return;
+    }
+    initialized = false;
+    device.destroyDescriptorPool(primary_descriptor_pool);
+    device.destroyDescriptorPool(indexing_descriptor_pool);
+    device.destroySampler(primary_sampler);
+    device.destroySampler(blocky_sampler);
+    cleanup_staging_buffer(vma_alloc);
+    cleanup_staging_image(vma_alloc);
+    clean_wavefront_raytracer_resources();
+    destroy_wavefront_raytracer_pipeline();
+    if (!is_headless()) {
+        destroy_raytracer_frame_objects();
+    }
+}
+
+std::vector<float> wavefront_raytracer_read_back() {
+    return wait_raytracer_read_back(wavefront_raytracer_request_read_back());
+}
+
+uint32_t wavefront_raytracer_request_read_back() {
+    std::array const images{wavefront_raytracer.accumulation_image.image};
+    return request_raytracer_read_back(images, region, render_extent,
+        wavefront_raytracer.ray_counter_buffer, accumulation_counter);
+}
+
+std::vector<float> wavefront_raytracer_fetch_read_back(uint32_t ticket) {
+    return fetch_raytracer_read_back(ticket);
+}
+
+accumulation wavefront_raytracer_fetch_accumulation(uint32_t ticket) {
+    return fetch_raytracer_accumulation(ticket);
+}
+
+void wavefront_raytracer_restore_accumulation(accumulation const& state) {
+    restore_raytracer_accumulation(wavefront_raytracer.accumulation_image, {},
+        wavefront_raytracer.ray_counter_buffer, state);
+    accumulation_counter = state.sample_count;
+}
+
+uint64_t wavefront_raytracer_traced_rays() {
+    return get_raytracer_traced_rays();
+}
+
+void load_wavefront_raytracer(renderer& renderer) {
+    renderer.initialize = wavefront_raytracer_initialize;
+    renderer.prepare_data = wavefront_raytracer_prepare_data;
+    renderer.set_options = wavefront_raytracer_set_options;
+    renderer.set_region = wavefront_raytracer_set_region;
+    renderer.update_data = wavefront_raytracer_update_data;
+    renderer.render = wavefront_raytracer_render;
+    renderer.present = wavefront_raytracer_present;
+    renderer.destroy = wavefront_raytracer_destroy;
+    renderer.read_back = wavefront_raytracer_read_back;
+    renderer.request_read_back = wavefront_raytracer_request_read_back;
+    renderer.fetch_read_back = wavefront_raytracer_fetch_read_back;
+    renderer.fetch_accumulation = wavefront_raytracer_fetch_accumulation;
+    renderer.restore_accumulation = wavefront_raytracer_restore_accumulation;
+    renderer.traced_rays = wavefront_raytracer_traced_rays;
+}
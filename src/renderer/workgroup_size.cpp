@@ -0,0 +1,117 @@
+#include "workgroup_size.h"
+#include "check.h"
+
+#include <array>
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#include "nlohmann/json.hpp"
+#pragma clang diagnostic pop
+
+std::span<glm::uvec2 const> get_workgroup_size_candidates() {
+    static std::array<glm::uvec2, 8> const candidates{
+        glm::uvec2{ 8, 4},
+        glm::uvec2{ 8, 8},
+        glm::uvec2{16, 4},
+        glm::uvec2{16, 8},
+        glm::uvec2{ 8, 16},
+        glm::uvec2{32, 4},
+        glm::uvec2{16, 16},
+        glm::uvec2{32, 8},
+    };
+    return candidates;
+}
+
+std::string get_device_key(vk::PhysicalDevice physical_device) {
+    vk::PhysicalDeviceProperties const properties =
+        physical_device.getProperties();
+    return fmt::format("{} {:04x}:{:04x} {}", properties.deviceName.data(),
+        properties.vendorID, properties.deviceID, properties.driverVersion);
+}
+
+uint32_t get_shared_stack_size(
+    uint32_t max_shared_memory, glm::uvec2 workgroup_size) {
+    // enough for the stack of most scenes, a shallower one takes less
+    uint32_t constexpr PREFERRED_SIZE = 48;
+    uint32_t constexpr MIN_SIZE = 4;
+    uint32_t const invocations = workgroup_size.x * workgroup_size.y;
+    // the shared array has one padding entry
+    uint32_t const fitting =
+        (max_shared_memory - (uint32_t) sizeof(uint32_t)) /
+        (invocations * (uint32_t) sizeof(uint32_t));
+    uint32_t const size = std::min(PREFERRED_SIZE, fitting);
+    return size < MIN_SIZE ? 0 : size;
+}
+
+uint32_t get_shared_stack_split(
+    uint32_t shared_stack_size, uint32_t traversal_stack_size) {
+    // the private array of scene.glsl keeps this many, a deeper stack than
+    // the shared memory holds spills more
+    uint32_t constexpr PRIVATE_OVERFLOW = 8;
+    if (traversal_stack_size <= PRIVATE_OVERFLOW) {
+        return 0;
+    }
+    return std::min(shared_stack_size, traversal_stack_size - PRIVATE_OVERFLOW);
+}
+
+static nlohmann::json read_cache(std::string_view cache_file) {
+    if (!std::filesystem::exists(cache_file)) {
+        return nlohmann::json::object();
+    }
+    try {
+        std::ifstream ifs{cache_file.data()};
+        return nlohmann::json::parse(ifs);
+    } catch (std::exception& exp) {
+        // a broken cache only costs one more tuning
+        fmt::println("Ignored {}: {}", cache_file, exp.what());
+        return nlohmann::json::object();
+    }
+}
+
+std::optional<kernel_tuning> load_kernel_tuning(std::string_view cache_file,
+    std::string_view device_key, std::string_view kernel) {
+    nlohmann::json const cache = read_cache(cache_file);
+    auto const device = cache.find(std::string{device_key});
+    if (device == cache.end() || !device->contains(std::string{kernel})) {
+        return std::nullopt;
+    }
+    nlohmann::json const& tuning = device->at(std::string{kernel});
+    // entries of older versions only had the workgroup size
+    if (!tuning.is_object()) {
+        return std::nullopt;
+    }
+    nlohmann::json const& size = tuning.at("workgroup_size");
+    return kernel_tuning{
+        .workgroup_size = {size.at(0).get<uint32_t>(),
+            size.at(1).get<uint32_t>()},
+        .shared_stack_size = tuning.at("shared_stack_size").get<uint32_t>(),
+    };
+}
+
+void save_kernel_tuning(std::string_view cache_file,
+    std::string_view device_key, std::string_view kernel,
+    kernel_tuning const& tuning) {
+    nlohmann::json cache = read_cache(cache_file);
+    cache[std::string{device_key}][std::string{kernel}] = {
+        {"workgroup_size",
+         {tuning.workgroup_size.x, tuning.workgroup_size.y}},
+        {"shared_stack_size", tuning.shared_stack_size},
+    };
+    std::ofstream ofs{cache_file.data()};
+    if (!ofs) {
+        fmt::println("Can't write {}", cache_file);
+        return;
+    }
+    ofs << cache.dump(4);
+}
+
+std::pair<glm::uvec2, glm::uvec2> get_workgroup_range(
+    glm::uvec2 offset, glm::uvec2 extent, glm::uvec2 workgroup_size) {
+    glm::uvec2 const first = offset / workgroup_size;
+    glm::uvec2 const last =
+        (offset + extent + workgroup_size - glm::uvec2{1}) / workgroup_size;
+    return std::make_pair(first, last - first);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <optional>
+#include <string_view>
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#include "glm/vec2.hpp"
+#pragma clang diagnostic pop
+
+#include "vulkan/vulkan_header.h"
+
+// Workgroup shapes timed by the autotuner of a 2D compute kernel.
+std::span<glm::uvec2 const> get_workgroup_size_candidates();
+
+// Identifies the device and driver a tuned workgroup size is valid for.
+std::string get_device_key(vk::PhysicalDevice physical_device);
+
+// Specialization of a kernel found fastest on a device.
+struct kernel_tuning {
+    glm::uvec2 workgroup_size;
+    // most traversal stack entries kept in shared memory, 0 keeps them
+    // private
+    uint32_t shared_stack_size;
+};
+
+// Deepest traversal stack entries of a workgroup that still fit into the
+// shared memory, 0 if too few fit to be worth it.
+uint32_t get_shared_stack_size(
+    uint32_t max_shared_memory, glm::uvec2 workgroup_size);
+
+// Entries of a traversal stack of the size that go to shared memory, all but
+// a small private overflow as far as the shared stack size allows.
+uint32_t get_shared_stack_split(
+    uint32_t shared_stack_size, uint32_t traversal_stack_size);
+
+// The cache is a json file of tunings by device key and kernel name.
+std::optional<kernel_tuning> load_kernel_tuning(std::string_view cache_file,
+    std::string_view device_key, std::string_view kernel);
+
+void save_kernel_tuning(std::string_view cache_file,
+    std::string_view device_key, std::string_view kernel,
+    kernel_tuning const& tuning);
+
+// First workgroup and workgroup count that cover a rectangle of pixels, for
+// dispatchBase with kernels that skip pixels outside of the rectangle.
+std::pair<glm::uvec2, glm::uvec2> get_workgroup_range(
+    glm::uvec2 offset, glm::uvec2 extent, glm::uvec2 workgroup_size);
@@ -0,0 +1,102 @@
+#include <string>
+#include <cstdlib>
+#include <charconv>
+#include <string_view>
+
+#include "check.h"
+#include "utils/file.h"
+#include "utils/command_line.h"
+
+#pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
+
+static std::string_view constexpr USAGE =
+    "Usage: Raytracing [options] [scene_file]\n"
+    "  --render <file>        render offscreen into a .png, .hdr or .exr\n"
+    "  --jobs <file>          render the scenes and cameras of a job file\n"
+    "  --sequence <file>      render the camera path into numbered images\n"
+    "  --camera-path <file>   camera keyframes, the scene's if not given\n"
+    "  --spp <count>          samples per pixel to accumulate\n"
+    "  --time-limit <sec>     stop accumulating after this many seconds\n"
+    "  --seed <seed>          base seed of the sample sequence\n"
+    "  --renderer <name>      megakernel (default) or wavefront raytracer\n"
+    "  --checkpoint <sec>     save the accumulation next to the output\n"
+    "  --resume               continue from the checkpoint of the output\n"
+    "  --workers <count>      distribute --render over local processes\n"
+    "  --listen <address>     accept workers on a unix path or tcp host:port\n"
+    "  --worker <address>     render jobs of the coordinator at the address\n"
+    "  --profile <file>       write GPU timings to a .csv or .json trace\n";
+
+static uint32_t constexpr DEFAULT_SAMPLES_PER_PIXEL = 64;
+
+static uint32_t parse_uint(std::string_view option, std::string_view value) {
+    uint32_t ret = 0;
+    auto const [end, error] =
+        std::from_chars(value.data(), value.data() + value.size(), ret);
+    CHECK(error == std::errc{} && end == value.data() + value.size(),
+        "{} expects an unsigned integer, got {}", option, value);
+    return ret;
+}
+
+static float parse_float(std::string_view option, std::string_view value) {
+    std::string const str{value};
+    char* end = nullptr;
+    float const ret = std::strtof(str.c_str(), &end);
+    CHECK(end == str.c_str() + str.size() && ret >= 0.0f,
+        "{} expects a non-negative number, got {}", option, value);
+    return ret;
+}
+
+command_line parse_command_line(int argc, char* argv[]) {
+    command_line ret{};
+    ret.executable = argv[0];
+    ret.scene_file = PATH_FROM_ROOT("assets/hyperion_rect_light.json");
+    for (int i = 1; i < argc; ++i) {
+        std::string_view const option = argv[i];
+        auto const next_value = [&]() -> std::string_view {
+            CHECK(i + 1 < argc, "{} expects a value\n{}", option, USAGE);
+            return argv[++i];
+        };
+        if (option == "--render") {
+            ret.render_file = next_value();
+        } else if (option == "--jobs") {
+            ret.job_file = next_value();
+        } else if (option == "--sequence") {
+            ret.sequence_file = next_value();
+        } else if (option == "--camera-path") {
+            ret.camera_path_file = next_value();
+        } else if (option == "--spp") {
+            ret.samples_per_pixel = parse_uint(option, next_value());
+        } else if (option == "--time-limit") {
+            ret.time_limit_seconds = parse_float(option, next_value());
+        } else if (option == "--checkpoint") {
+            ret.checkpoint_interval_seconds = parse_float(option, next_value());
+        } else if (option == "--resume") {
+            ret.resume = true;
+        } else if (option == "--seed") {
+            ret.seed = parse_uint(option, next_value());
+        } else if (option == "--renderer") {
+            ret.renderer = next_value();
+            CHECK(ret.renderer == "megakernel" || ret.renderer == "wavefront",
+                "Unknown renderer {}\n{}", ret.renderer, USAGE);
+        } else if (option == "--workers") {
+            ret.local_workers = parse_uint(option, next_value());
+        } else if (option == "--listen") {
+            ret.listen_address = next_value();
+        } else if (option == "--worker") {
+            ret.coordinator_address = next_value();
+        } else if (option == "--profile") {
+            ret.profile_file = next_value();
+        } else if (option == "--help") {
+            fmt::print("{}", USAGE);
+            std::exit(0);
+        } else {
+            CHECK(!option.starts_with("--"), "Unknown option {}\n{}", option,
+                USAGE);
+            ret.scene_file = option;
+        }
+    }
+    if (ret.samples_per_pixel == 0 && ret.time_limit_seconds <= 0.0f) {
+        ret.samples_per_pixel = DEFAULT_SAMPLES_PER_PIXEL;
+    }
+    return ret;
+}
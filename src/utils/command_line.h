@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <optional>
+
+struct command_line {
+    std::string executable;
+    std::string scene_file;
+    // megakernel or wavefront, both converge to the same image
+    std::string renderer = "megakernel";
+    // render offscreen into this image instead of opening a window
+    std::string render_file;
+    // render every job of this file offscreen in one process
+    std::string job_file;
+    // render the frames of a camera path offscreen, a run of '#' in the file
+    // name is replaced by the frame number
+    std::string sequence_file;
+    // camera keyframes of the sequence, the scene file itself if empty
+    std::string camera_path_file;
+    // accumulation stops at whichever target is met first, 0 disables one
+    uint32_t samples_per_pixel = 0;
+    float time_limit_seconds = 0.0f;
+    // offline renders save their accumulation this often and can resume it
+    float checkpoint_interval_seconds = 0.0f;
+    bool resume = false;
+    // a distributed render spawns local workers and accepts remote ones on
+    // the listen address, a worker connects to its coordinator
+    uint32_t local_workers = 0;
+    std::string listen_address;
+    std::string coordinator_address;
+    // overrides the seed of the scene's render options
+    std::optional<uint32_t> seed;
+    // profiles the GPU work into a .csv of rolling statistics or a .json
+    // Chrome trace, written on exit and whenever F12 is pressed in the window
+    std::string profile_file;
+};
+
+command_line parse_command_line(int argc, char* argv[]);
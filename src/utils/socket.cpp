@@ -0,0 +1,220 @@
+#include "check.h"
+#include "utils/socket.h"
+
+#include <cerrno>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
+
+#if !defined(_WIN32)
+
+struct message_header {
+    uint32_t type;
+    uint32_t size;
+};
+
+static bool send_bytes(int socket, uint8_t const* data, size_t size) {
+    while (size > 0) {
+        ssize_t const sent = send(socket, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= (size_t) sent;
+    }
+    return true;
+}
+
+static bool receive_bytes(int socket, uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t const received = recv(socket, data, size, 0);
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= (size_t) received;
+    }
+    return true;
+}
+
+static addrinfo* resolve_tcp_address(std::string_view address, bool passive) {
+    size_t const colon = address.rfind(':');
+    std::string const host{address.substr(0, colon)};
+    std::string const port{address.substr(colon + 1)};
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo* info = nullptr;
+    int const result = getaddrinfo(host.empty() ? nullptr : host.c_str(),
+        port.c_str(), &hints, &info);
+    CHECK(result == 0, "Can't resolve {}: {}", address, gai_strerror(result));
+    return info;
+}
+
+static sockaddr_un get_unix_address(std::string_view address) {
+    sockaddr_un unix_address{};
+    unix_address.sun_family = AF_UNIX;
+    CHECK(address.size() < sizeof(unix_address.sun_path),
+        "Socket path {} is too long", address);
+    std::memcpy(unix_address.sun_path, address.data(), address.size());
+    return unix_address;
+}
+
+int listen_socket(std::string_view address) {
+    int listener = -1;
+    if (address.find(':') != std::string_view::npos) {
+        addrinfo* const info = resolve_tcp_address(address, true);
+        listener = socket(info->ai_family, info->ai_socktype, 0);
+        int const reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        int const result = bind(listener, info->ai_addr, info->ai_addrlen);
+        freeaddrinfo(info);
+        CHECK(result == 0, "Can't bind {}: {}", address, strerror(errno));
+    } else {
+        sockaddr_un const unix_address = get_unix_address(address);
+        unlink(unix_address.sun_path);
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        int const result = bind(listener, (sockaddr const*) &unix_address,
+            sizeof(unix_address));
+        CHECK(result == 0, "Can't bind {}: {}", address, strerror(errno));
+    }
+    CHECK(listen(listener, 64) == 0, "Can't listen on {}: {}", address,
+        strerror(errno));
+    return listener;
+}
+
+std::string get_private_socket_address() {
+    return fmt::format("/tmp/raytracing_{}.sock", getpid());
+}
+
+void close_listener(int listener, std::string_view address) {
+    close(listener);
+    if (address.find(':') == std::string_view::npos) {
+        unlink(std::string{address}.c_str());
+    }
+}
+
+int accept_socket(int listener) {
+    int const socket = accept(listener, nullptr, nullptr);
+    if (socket >= 0) {
+        int const no_delay = 1;
+        setsockopt(
+            socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    }
+    return socket;
+}
+
+int connect_socket(std::string_view address) {
+    int connection = -1;
+    int result = -1;
+    if (address.find(':') != std::string_view::npos) {
+        addrinfo* const info = resolve_tcp_address(address, false);
+        connection = socket(info->ai_family, info->ai_socktype, 0);
+        result = connect(connection, info->ai_addr, info->ai_addrlen);
+        freeaddrinfo(info);
+        int const no_delay = 1;
+        setsockopt(
+            connection, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    } else {
+        sockaddr_un const unix_address = get_unix_address(address);
+        connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        result = connect(connection, (sockaddr const*) &unix_address,
+            sizeof(unix_address));
+    }
+    CHECK(result == 0, "Can't connect to {}: {}", address, strerror(errno));
+    return connection;
+}
+
+void close_socket(int socket) {
+    close(socket);
+}
+
+bool send_message(int socket, uint32_t type, std::span<uint8_t const> payload) {
+    message_header const header{
+        .type = type,
+        .size = (uint32_t) payload.size(),
+    };
+    return send_bytes(socket, (uint8_t const*) &header, sizeof(header)) &&
+           send_bytes(socket, payload.data(), payload.size());
+}
+
+bool receive_message(
+    int socket, uint32_t& type, std::vector<uint8_t>& payload) {
+    message_header header{};
+    if (!receive_bytes(socket, (uint8_t*) &header, sizeof(header))) {
+        return false;
+    }
+    type = header.type;
+    payload.resize(header.size);
+    return receive_bytes(socket, payload.data(), payload.size());
+}
+
+std::vector<bool> wait_readable(std::span<int const> sockets) {
+    std::vector<pollfd> poll_fds(sockets.size());
+    for (size_t i = 0; i < sockets.size(); ++i) {
+        poll_fds[i] = pollfd{
+            .fd = sockets[i],
+            .events = POLLIN,
+            .revents = 0,
+        };
+    }
+    int result = -1;
+    do {
+        result = poll(poll_fds.data(), poll_fds.size(), -1);
+    } while (result < 0 && errno == EINTR);
+    CHECK(result > 0, "Polling sockets failed: {}", strerror(errno));
+    std::vector<bool> readable(sockets.size());
+    for (size_t i = 0; i < sockets.size(); ++i) {
+        readable[i] = (poll_fds[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+    }
+    return readable;
+}
+
+#else
+
+int listen_socket(std::string_view) {
+    CHECK(false, "Distributed rendering needs posix sockets");
+}
+
+std::string get_private_socket_address() {
+    CHECK(false, "Distributed rendering needs posix sockets");
+}
+
+void close_listener(int, std::string_view) {
+}
+
+int accept_socket(int) {
+    CHECK(false, "Distributed rendering needs posix sockets");
+}
+
+int connect_socket(std::string_view) {
+    CHECK(false, "Distributed rendering needs posix sockets");
+}
+
+void close_socket(int) {
+}
+
+bool send_message(int, uint32_t, std::span<uint8_t const>) {
+    CHECK(false, "Distributed rendering needs posix sockets");
+}
+
+bool receive_message(int, uint32_t&, std::vector<uint8_t>&) {
+    CHECK(false, "Distributed rendering needs posix sockets");
+}
+
+std::vector<bool> wait_readable(std::span<int const>) {
+    CHECK(false, "Distributed rendering needs posix sockets");
+}
+
+#endif
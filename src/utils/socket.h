@@ -0,0 +1,35 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+
+// Stream sockets for local and remote worker processes. An address with a
+// colon is a tcp "host:port", anything else the path of a unix socket.
+// Only posix systems are supported.
+
+int listen_socket(std::string_view address);
+
+// unix socket path private to this process
+std::string get_private_socket_address();
+
+// closes a listener and removes its unix socket path
+void close_listener(int listener, std::string_view address);
+
+// blocks until a peer connects unless the listener is readable already
+int accept_socket(int listener);
+
+int connect_socket(std::string_view address);
+
+void close_socket(int socket);
+
+// A message is a type and a byte payload, false means the peer has hung up
+bool send_message(int socket, uint32_t type, std::span<uint8_t const> payload);
+
+bool receive_message(
+    int socket, uint32_t& type, std::vector<uint8_t>& payload);
+
+// Blocks until one of the sockets can be read, returns their readiness
+std::vector<bool> wait_readable(std::span<int const> sockets);
@@ -85,6 +85,14 @@ vk_buffer create_frequent_readwrite_buffer(VmaAllocator vma_alloc,
             VMA_ALLOCATION_CREATE_MAPPED_BIT);
 }
 
+vk_buffer create_readback_buffer(VmaAllocator vma_alloc, uint32_t size,
+    std::vector<uint32_t> const& queues) {
+    return create_buffer(vma_alloc, size, queues, 0,
+        (VkBufferUsageFlags) (vk::BufferUsageFlagBits::eTransferDst),
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+            VMA_ALLOCATION_CREATE_MAPPED_BIT);
+}
+
 #pragma clang diagnostic ignored "-Wunsafe-buffer-usage"
 void update_buffer(VmaAllocator vma_alloc, vk::CommandBuffer command_buffer,
     vk_buffer const& buffer, std::span<const uint8_t> data, uint32_t offset) {
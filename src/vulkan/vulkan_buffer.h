@@ -30,6 +30,9 @@ vk_buffer create_frequent_readwrite_buffer(VmaAllocator vma_alloc,
     uint32_t size, std::vector<uint32_t> const& queues,
     vk::BufferUsageFlags usage);
 
+vk_buffer create_readback_buffer(
+    VmaAllocator vma_alloc, uint32_t size, std::vector<uint32_t> const& queues);
+
 void update_buffer(VmaAllocator vma_alloc, vk::CommandBuffer command_buffer,
     vk_buffer const& buffer, std::span<const uint8_t> data, uint32_t offset);
 
@@ -88,6 +88,10 @@ vk::DescriptorPool create_descriptor_pool(
                                .type = vk::DescriptorType::eStorageBuffer,
                                .descriptorCount = 50 * MAX_SETS,
                                },
+        vk::DescriptorPoolSize{
+                               .type = vk::DescriptorType::eStorageImage,
+                               .descriptorCount = 50 * MAX_SETS,
+                               },
         vk::DescriptorPoolSize{
                                .type = vk::DescriptorType::eUniformBuffer,
                                .descriptorCount = 50 * MAX_SETS,
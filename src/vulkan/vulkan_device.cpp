@@ -1,3 +1,5 @@
+#include <bit>
+#include <array>
 #include <ranges>
 #include <optional>
 
@@ -127,7 +129,8 @@ std::tuple<vk::Device, vk::PhysicalDevice, vulkan_queues>
     select_physical_device_create_device_queues(vk::Instance inst,
         vk::SurfaceKHR surface, std::span<const char*> dev_ext,
         const void* dev_creation_pnext,
-        vk::PhysicalDeviceFeatures const& enabled_features) noexcept {
+        vk::PhysicalDeviceFeatures const& enabled_features,
+        vk::PhysicalDeviceFeatures const& optional_features) noexcept {
     vk::Result result;
     vk::Device ret_dev;
     vk::PhysicalDevice ret_phy_dev;
@@ -143,8 +146,10 @@ std::tuple<vk::Device, vk::PhysicalDevice, vulkan_queues>
         queue_props = phy_dev.getQueueFamilyProperties();
         for (uint32_t i = 0; i < queue_props.size(); ++i) {
             vk::Bool32 support_present = false;
-            VK_CHECK_CREATE(result, support_present,
-                phy_dev.getSurfaceSupportKHR(i, surface));
+            if (surface) {
+                VK_CHECK_CREATE(result, support_present,
+                    phy_dev.getSurfaceSupportKHR(i, surface));
+            }
             vk::Bool32 support_graphics =
                 (queue_props[i].queueFlags & vk::QueueFlagBits::eGraphics) !=
                 vk::QueueFlagBits{};
@@ -175,6 +180,13 @@ std::tuple<vk::Device, vk::PhysicalDevice, vulkan_queues>
                 compute_queue_idx = i;
             }
         }
+        // without a surface nothing is presented, a compute queue is enough
+        if (!surface && compute_queue_idx.has_value()) {
+            if (!graphics_queue_idx.has_value()) {
+                graphics_queue_idx = compute_queue_idx;
+            }
+            present_queue_idx = graphics_queue_idx;
+        }
         if (!graphics_queue_idx.has_value() || !present_queue_idx.has_value() ||
             !compute_queue_idx.has_value()) {
             continue;
@@ -234,6 +246,22 @@ std::tuple<vk::Device, vk::PhysicalDevice, vulkan_queues>
             .pQueuePriorities = &queue_priority,
         });
     }
+    // the optional features are enabled where the device supports them, the
+    // feature struct is nothing but a row of booleans
+    using feature_bits = std::array<vk::Bool32,
+        sizeof(vk::PhysicalDeviceFeatures) / sizeof(vk::Bool32)>;
+    feature_bits features = std::bit_cast<feature_bits>(enabled_features);
+    feature_bits const optional =
+        std::bit_cast<feature_bits>(optional_features);
+    feature_bits const supported =
+        std::bit_cast<feature_bits>(ret_phy_dev.getFeatures());
+    for (size_t f = 0; f < features.size(); ++f) {
+        if (optional[f] && supported[f]) {
+            features[f] = vk::True;
+        }
+    }
+    vk::PhysicalDeviceFeatures const device_features =
+        std::bit_cast<vk::PhysicalDeviceFeatures>(features);
     VK_CHECK_CREATE(result, ret_dev,
         ret_phy_dev.createDevice(vk::DeviceCreateInfo{
             .pNext = dev_creation_pnext,
@@ -241,7 +269,7 @@ std::tuple<vk::Device, vk::PhysicalDevice, vulkan_queues>
             .pQueueCreateInfos = queue_infos.data(),
             .enabledExtensionCount = (uint32_t) dev_ext.size(),
             .ppEnabledExtensionNames = dev_ext.data(),
-            .pEnabledFeatures = &enabled_features,
+            .pEnabledFeatures = &device_features,
         }));
     VULKAN_HPP_DEFAULT_DISPATCHER.init(ret_dev);
     ret_queues.graphics_queue =